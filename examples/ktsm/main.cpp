@@ -2,6 +2,43 @@
 
 #include "../main.hpp"
 
+int stats(const char *key, const std::string &lockMode) {
+    QSharedMemory sm(key);
+    if (lockMode == "futex")
+        sm.setLockMode(QSharedMemory::FutexLock);
+    else if (lockMode == "rw")
+        sm.setLockMode(QSharedMemory::ReadWriteLock);
+    else if (lockMode == "robust")
+        sm.setLockMode(QSharedMemory::RobustLock);
+    else if (lockMode == "seqlock")
+        sm.setLockMode(QSharedMemory::SeqLock);
+    else
+        return handle_error("unknown lock mode " + lockMode);
+
+    if (!sm.attach(QSharedMemory::ReadOnly))
+        return handle_error(sm.errorString());
+    if (!sm.isLockStatisticsEnabled())
+        std::cout << "Lock statistics are disabled" << std::endl;
+
+    const QSharedMemory::LockStatistics s = sm.lockStatistics();
+    std::cout << "acquires:          " << s.acquires << std::endl;
+    std::cout << "contended:         " << s.contendedAcquires << std::endl;
+    std::cout << "timeouts:          " << s.timeouts << std::endl;
+    std::cout << "total wait (ns):   " << s.totalWaitTime.count() << std::endl;
+    std::cout << "total hold (ns):   " << s.totalHoldTime.count() << std::endl;
+    std::cout << "last holder pid:   " << s.lastHolderPid << std::endl;
+    std::cout << "bucket (ns)        wait        hold" << std::endl;
+    for (size_t i = 0; i < s.waitHistogram.size(); ++i) {
+        if (!s.waitHistogram[i] && !s.holdHistogram[i])
+            continue;
+        std::printf("< 2^%-2zu %18llu %11llu\n", i + 1,
+                    (unsigned long long)s.waitHistogram[i], (unsigned long long)s.holdHistogram[i]);
+    }
+
+    sm.detach();
+    return 0;
+}
+
 int sm_main(int, char**) {
     return 0;
 }
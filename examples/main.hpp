@@ -1,6 +1,7 @@
 #include <vector>
 #include <iostream>
 #include <fstream>
+#include <cstring>
 
 int handle_error(const std::string &msg)
 {
@@ -26,7 +27,7 @@ int load(const char *key, const std::string &path) {
     QSharedMemory sm(key);
     if (sm.isAttached()) detach(sm);
 
-    if (!sm.create(int(sizeof(size) + size)))
+    if (!sm.create(sizeof(size) + size_t(size)))
         return handle_error("unable to create system memory share");
 
     sm.lock();
@@ -60,11 +61,19 @@ int save(const char *key, const std::string &path) {
     return 0;
 }
 
+// prints the lock statistics of the segment, implemented by each example
+int stats(const char *key, const std::string &lockMode);
+
 int parseArgs(int argc, char *argv[]) {
     auto usage = [&]() {
         std::cerr << "Usage: " << argv[0] << " [load|save] <key> <filename>" << std::endl;
+        std::cerr << "       " << argv[0] << " stats <key> [futex|rw|robust|seqlock]" << std::endl;
         return 1;
     };
+    if (argc >= 3 && std::string(argv[1]) == "stats") {
+        if (argc > 4) return usage();
+        return stats(argv[2], argc == 4 ? argv[3] : "futex");
+    }
     if (argc != 4) return usage();
 
     std::string cmd(argv[1]);
@@ -4,6 +4,10 @@
 
 #include "../main.hpp"
 
+int stats(const char *, const std::string &) {
+    return handle_error("lock statistics are not available with QSharedMemory");
+}
+
 int sm_main(int argc, char *argv[]) {
     QCoreApplication a(argc, argv);
     QTimer::singleShot(0, &a, &QCoreApplication::quit);
@@ -3,6 +3,10 @@
 #define Q_CORE_EXPORT
 #define Q_D(Class) Class##Private * const d = d_func()
 
+typedef long long qint64;
+typedef unsigned long long quint64;
+typedef unsigned int quint32;
+
 namespace Qt {
     typedef void* HANDLE;
 }
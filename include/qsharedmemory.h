@@ -42,7 +42,13 @@
 
 #include "qglobal.h"
 
+#include <chrono>
+#include <functional>
+#include <limits>
 #include <memory>
+#include <string>
+#include <type_traits>
+#include <vector>
 
 class QSharedMemoryPrivate;
 
@@ -52,7 +58,72 @@ public:
     enum AccessMode
     {
         ReadOnly,
-        ReadWrite
+        ReadWrite,
+        CopyOnWrite
+    };
+
+    enum LockMode
+    {
+        SystemSemaphoreLock,
+        FutexLock,
+        ReadWriteLock,
+        RobustLock,
+        SeqLock
+    };
+
+    struct LockStatistics
+    {
+        quint64 acquires = 0;
+        quint64 contendedAcquires = 0;
+        quint64 timeouts = 0;
+        std::chrono::nanoseconds totalWaitTime{0};
+        std::chrono::nanoseconds totalHoldTime{0};
+        std::vector<quint64> waitHistogram;
+        std::vector<quint64> holdHistogram;
+        qint64 lastHolderPid = 0;
+    };
+
+    enum LockOwnership
+    {
+        ProcessOwnership,
+        ThreadOwnership,
+        RecursiveThreadOwnership
+    };
+
+    enum MappingOption
+    {
+        NoMappingOption = 0x0,
+        HugePages = 0x1,
+        HugePages1G = 0x2,
+        TransparentHugePages = 0x4,
+        Prefault = 0x8,
+        LockInMemory = 0x10,
+        FixedAddress = 0x20,
+        KeepOnDetach = 0x40
+    };
+
+    enum Seal
+    {
+        NoSeal = 0x0,
+        SealShrink = 0x1,
+        SealGrow = 0x2,
+        SealWrite = 0x4,
+        SealFutureWrite = 0x8,
+        SealSeal = 0x10
+    };
+
+    enum NumaPolicy
+    {
+        NumaDefault,
+        NumaBind,
+        NumaInterleave,
+        NumaPreferred
+    };
+
+    enum FlushMode
+    {
+        AsyncFlush,
+        SyncFlush
     };
 
     enum SharedMemoryError
@@ -65,7 +136,8 @@ public:
         NotFound,
         LockError,
         OutOfResources,
-        UnknownError
+        UnknownError,
+        LockTimeout
     };
 
     QSharedMemory();
@@ -77,20 +149,99 @@ public:
     void setNativeKey(const std::string &key);
     std::string nativeKey() const;
 
+    void setLockMode(LockMode mode);
+    LockMode lockMode() const;
+    void setLockOwnership(LockOwnership ownership);
+    LockOwnership lockOwnership() const;
+    void setLockStatisticsEnabled(bool enabled);
+    bool isLockStatisticsEnabled() const;
+    LockStatistics lockStatistics() const;
+    void resetLockStatistics();
+    void setLockStripes(int count, qint64 stripeSize = 4096);
+    int lockStripes() const;
+    void setSpinTime(std::chrono::nanoseconds spinTime);
+    std::chrono::nanoseconds spinTime() const;
+    qint64 spinAcquires() const;
+    qint64 blockedAcquires() const;
+    void setMappingOptions(int options);
+    int mappingOptions() const;
+    void setBaseAddress(void *address);
+    void *baseAddress() const;
+    qint64 prefaultedPages() const;
+    std::chrono::nanoseconds prefaultTime() const;
+    bool setNumaPolicy(NumaPolicy policy, const std::vector<int> &nodes = std::vector<int>());
+    NumaPolicy numaPolicy() const;
+    void setNumaReplicas(bool enabled);
+    bool numaReplicas() const;
+    int numaNode() const;
+    bool updateReplicas();
+
     bool create(int size, AccessMode mode = ReadWrite);
-    int size() const;
+    bool create(qint64 size, AccessMode mode = ReadWrite);
+    // any other integral size, such as long, unsigned or a sizeof() expression
+    template <typename T, typename std::enable_if<std::is_integral<T>::value, int>::type = 0>
+    bool create(T size, AccessMode mode = ReadWrite)
+    {
+        const bool tooLarge = std::is_unsigned<T>::value
+                && quint64(size) > quint64(std::numeric_limits<qint64>::max());
+        return create(tooLarge ? std::numeric_limits<qint64>::max() : qint64(size), mode);
+    }
+    qint64 size() const;
+    bool resize(qint64 size);
 
     bool attach(AccessMode mode = ReadWrite);
     bool isAttached() const;
     bool detach();
 
+    bool createAnonymous(qint64 size, AccessMode mode = ReadWrite);
+    bool attachDescriptor(int fd, AccessMode mode = ReadWrite);
+    int descriptor() const;
+    bool createFile(const std::string &fileName, qint64 size, AccessMode mode = ReadWrite);
+    bool attachFile(const std::string &fileName, AccessMode mode = ReadWrite);
+    bool flush(FlushMode mode = SyncFlush);
+    bool sendDescriptor(int socket);
+    bool receiveDescriptor(int socket, AccessMode mode = ReadWrite);
+    bool seal(int seals);
+    int seals() const;
+
     void *data();
     const void* constData() const;
     const void *data() const;
 
     bool lock();
+    bool lock(std::chrono::nanoseconds timeout);
+    bool tryLock();
     bool unlock();
 
+    bool lockForRead();
+    bool lockForRead(std::chrono::nanoseconds timeout);
+    bool lockForWrite();
+    bool lockForWrite(std::chrono::nanoseconds timeout);
+    bool unlockForRead();
+    bool unlockForWrite();
+    void setWriterPreference(bool enabled);
+    bool writerPreference() const;
+    bool lockOwnerDied() const;
+    void setConsistencyHandler(std::function<bool(QSharedMemory *)> handler);
+
+    bool lockRange(qint64 offset, qint64 length);
+    bool lockRange(qint64 offset, qint64 length, std::chrono::nanoseconds timeout);
+    bool unlockRange(qint64 offset, qint64 length);
+
+    quint32 notify();
+    quint32 changeGeneration() const;
+    bool waitForChange(quint32 lastSeenGeneration,
+                       std::chrono::nanoseconds timeout = std::chrono::nanoseconds::max());
+    int notificationDescriptor();
+    quint64 drainNotifications();
+
+    bool beginWrite();
+    bool endWrite();
+    bool read(const std::function<void(const void *data, qint64 size)> &reader,
+              std::chrono::nanoseconds timeout = std::chrono::nanoseconds::max()) const;
+    qint64 readInto(void *buffer, qint64 maxSize,
+                    std::chrono::nanoseconds timeout = std::chrono::nanoseconds::max()) const;
+
     SharedMemoryError error() const;
     std::string errorString() const;
 
@@ -98,5 +249,77 @@ private:
     std::unique_ptr<QSharedMemoryPrivate> d;
 };
 
+class QSharedMemoryReadLocker
+{
+public:
+    inline explicit QSharedMemoryReadLocker(QSharedMemory *sharedMemory)
+        : q_sm(sharedMemory), q_locked(sharedMemory && sharedMemory->lockForRead()) {}
+    inline ~QSharedMemoryReadLocker() { unlock(); }
+
+    inline bool isLocked() const { return q_locked; }
+    inline void unlock()
+    {
+        if (q_locked)
+            q_sm->unlockForRead();
+        q_locked = false;
+    }
+
+    QSharedMemoryReadLocker(const QSharedMemoryReadLocker &) = delete;
+    QSharedMemoryReadLocker &operator=(const QSharedMemoryReadLocker &) = delete;
+
+private:
+    QSharedMemory *q_sm;
+    bool q_locked;
+};
+
+class QSharedMemoryWriteLocker
+{
+public:
+    inline explicit QSharedMemoryWriteLocker(QSharedMemory *sharedMemory)
+        : q_sm(sharedMemory), q_locked(sharedMemory && sharedMemory->lockForWrite()) {}
+    inline ~QSharedMemoryWriteLocker() { unlock(); }
+
+    inline bool isLocked() const { return q_locked; }
+    inline void unlock()
+    {
+        if (q_locked)
+            q_sm->unlockForWrite();
+        q_locked = false;
+    }
+
+    QSharedMemoryWriteLocker(const QSharedMemoryWriteLocker &) = delete;
+    QSharedMemoryWriteLocker &operator=(const QSharedMemoryWriteLocker &) = delete;
+
+private:
+    QSharedMemory *q_sm;
+    bool q_locked;
+};
+
+class QSharedMemoryRangeLocker
+{
+public:
+    inline QSharedMemoryRangeLocker(QSharedMemory *sharedMemory, qint64 offset, qint64 length)
+        : q_sm(sharedMemory), q_offset(offset), q_length(length),
+          q_locked(sharedMemory && sharedMemory->lockRange(offset, length)) {}
+    inline ~QSharedMemoryRangeLocker() { unlock(); }
+
+    inline bool isLocked() const { return q_locked; }
+    inline void unlock()
+    {
+        if (q_locked)
+            q_sm->unlockRange(q_offset, q_length);
+        q_locked = false;
+    }
+
+    QSharedMemoryRangeLocker(const QSharedMemoryRangeLocker &) = delete;
+    QSharedMemoryRangeLocker &operator=(const QSharedMemoryRangeLocker &) = delete;
+
+private:
+    QSharedMemory *q_sm;
+    qint64 q_offset;
+    qint64 q_length;
+    bool q_locked;
+};
+
 #endif // QSHAREDMEMORY_H
 
@@ -44,10 +44,18 @@
 #include "qsharedmemory.h"
 #include "qsystemsemaphore.h"
 
+#include <atomic>
 #include <cassert>
+#include <chrono>
+#include <cstdint>
+#include <memory>
+#include <mutex>
 #include <string>
+#include <thread>
+#include <vector>
 
 #if !defined(_WIN32)
+#  include <pthread.h>
 #  include <sys/sem.h>
 #endif
 
@@ -60,22 +68,138 @@ public:
         assert(q_sm);
     }
 
+    // Segments with an in-segment lock still serialize create(), attach()
+    // and detach() on the key's system semaphore.
+    inline explicit QSharedMemoryLocker(QSystemSemaphore *keySemaphore) : q_sem(keySemaphore)
+    {
+        assert(q_sem);
+    }
+
     inline ~QSharedMemoryLocker()
     {
         if (q_sm)
             q_sm->unlock();
+        else if (q_sem && semLocked)
+            q_sem->release();
     }
 
     inline bool lock()
     {
         if (q_sm && q_sm->lock())
             return true;
+        if (q_sem && q_sem->acquire()) {
+            semLocked = true;
+            return true;
+        }
         q_sm = nullptr;
+        q_sem = nullptr;
         return false;
     }
 
 private:
-    QSharedMemory *q_sm;
+    QSharedMemory *q_sm = nullptr;
+    QSystemSemaphore *q_sem = nullptr;
+    bool semLocked = false;
+};
+
+/*
+    Header placed at the start of segments that use an in-segment lock
+    (any lock mode other than SystemSemaphoreLock). Segments without it
+    keep the Qt layout and stay interoperable with Qt applications.
+*/
+struct QSharedMemoryHeader
+{
+    enum : uint32_t {
+        Magic = 0x4d53544b, // "KTSM"
+        Version = 10,
+        MaxLockStripes = 64,
+        StatisticsBuckets = 32
+    };
+
+    uint32_t magic;
+    uint32_t version;
+    uint32_t headerSize;
+    uint32_t lockMode;
+
+    // bumped by resize() after segmentSize, attachments remap when it changes
+    std::atomic<uint32_t> generation;
+    std::atomic<uint64_t> segmentSize;
+
+    // address of the creator's mapping, used by FixedAddress attachments
+    uint64_t baseAddress;
+
+    // lockRange(): the data is cut in chunks of stripeSize bytes, each
+    // guarded by one of stripeCount stripe lock words
+    uint32_t stripeCount;
+    uint64_t stripeSize;
+
+    // set by a creator with NUMA replicas, which don't follow a resize()
+    uint32_t replicated;
+
+    // 0: unlocked, 1: locked, 2: locked with waiters
+    alignas(64) std::atomic<uint32_t> lockWord;
+
+    // ReadWriteLock: writer bit and reader count, the number of writers
+    // waiting and a sequence bumped on every release that waiters sleep on
+    enum : uint32_t {
+        WriterLocked = 0x80000000
+    };
+    alignas(64) std::atomic<uint32_t> rwState;
+    std::atomic<uint32_t> rwWritersWaiting;
+    std::atomic<uint32_t> rwPreferWriters;
+    alignas(64) std::atomic<uint32_t> rwWakeSequence;
+    std::atomic<uint32_t> rwSleepers;
+
+    // SeqLock: odd while a writer is between beginWrite() and endWrite()
+    alignas(64) std::atomic<uint32_t> sequence;
+
+    // bumped by notify(), waitForChange() sleeps on it while waiters is set
+    alignas(64) std::atomic<uint32_t> changeGeneration;
+    std::atomic<uint32_t> changeWaiters;
+
+    // one futex lock word per cache line, see lockWord
+    struct alignas(64) LockStripe
+    {
+        std::atomic<uint32_t> word;
+    };
+    LockStripe stripes[MaxLockStripes];
+
+    // lock statistics, updated by every process while enabled is set;
+    // histogram bucket i counts durations below 2^(i + 1) ns
+    struct alignas(64) LockStatistics
+    {
+        std::atomic<uint32_t> enabled;
+        std::atomic<uint32_t> lastHolderPid;
+        std::atomic<uint64_t> acquires;
+        std::atomic<uint64_t> contendedAcquires;
+        std::atomic<uint64_t> timeouts;
+        std::atomic<uint64_t> totalWaitTime;
+        std::atomic<uint64_t> totalHoldTime;
+        std::atomic<uint64_t> waitHistogram[StatisticsBuckets];
+        std::atomic<uint64_t> holdHistogram[StatisticsBuckets];
+    };
+    LockStatistics statistics;
+
+#if !defined(_WIN32)
+    // RobustLock: process-shared PTHREAD_MUTEX_ROBUST mutex
+    alignas(64) pthread_mutex_t robustMutex;
+#endif
+};
+
+// What a lock holder took, kept per instance or per thread, see LockOwnership
+struct QSharedMemoryLockState
+{
+    bool lockedByMe = false;
+    bool lockedForRead = false;
+    bool ownerDied = false;
+    bool writing = false;
+    int recursion = 0;
+    // lockRange(): the stripes taken, one bit per stripe, and how many
+    // held ranges of the owner use each of them
+    uint64_t stripesHeld = 0;
+    std::vector<int> stripeRefs;
+    // set when lock statistics are collected, for the hold time
+    std::chrono::steady_clock::time_point lockedAt;
 };
 
 class QSharedMemoryPrivate
@@ -84,27 +208,160 @@ public:
     QSharedMemoryPrivate();
 
     void *memory;
-    int size;
+    qint64 size;
     std::string key;
     std::string nativeKey;
     QSharedMemory::SharedMemoryError error;
     std::string errorString;
     QSystemSemaphore systemSemaphore;
-    bool lockedByMe;
+    QSharedMemoryLockState processLockState;
+    QSharedMemory::LockOwnership lockOwnership;
+    // guards the error and remapping when several threads share the instance
+    std::mutex threadMutex;
+    // keys the per thread lock states, unlike the address it is never reused
+    quint64 instanceId;
+    // locks held on the instance by its threads, guarded by threadMutex
+    int heldLocks;
+    std::function<bool(QSharedMemory *)> consistencyHandler;
+    bool preferWriters;
+    std::chrono::nanoseconds spinTime;
+    bool collectStatistics;
+    int stripeCount;
+    qint64 stripeSize;
+    std::atomic<qint64> spinAcquires;
+    std::atomic<qint64> blockedAcquires;
+    QSharedMemory::LockMode lockMode;
+    QSharedMemoryHeader *header;
+    int headerSize;
+    uint32_t generation;
+    QSharedMemory::AccessMode accessMode;
+    int memfd;
+    // openFile() found no other user of the file, it holds the guard file
+    // locked until shareFile()
+    bool soleFileUser;
+    int fileGuard;
+    // notificationDescriptor(): eventfd written by a thread sleeping on the
+    // change generation, which resumes from changeWatcherSeen
+    int changeEventFd;
+    std::thread changeWatcher;
+    std::atomic<bool> changeWatcherStop;
+    std::atomic<bool> changeWatcherDone;
+    uint32_t changeWatcherSeen;
+    int mappingOptions;
+    int attachedOptions;
+    void *requestedAddress;
+    qint64 prefaultedPages;
+    std::chrono::nanoseconds prefaultTime;
+    QSharedMemory::NumaPolicy numaPolicy;
+    std::vector<int> numaPolicyNodes;
+    bool numaReplicas;
+    std::vector<std::unique_ptr<QSharedMemory>> replicas;
+    QSharedMemory *readReplica;
+    int readReplicaNode;
 
     static int createUnixKeyFile(const std::string &fileName);
     static std::string makePlatformSafeKey(const std::string &key, const std::string &prefix = "qipc_sharedmemory_");
+#ifndef __WIN32
+    static std::string tempPath();
+#endif
 #ifdef __WIN32
     Qt::HANDLE handle();
 #elif defined(QT_POSIX_IPC)
     int handle();
+#else
+    key_t handle();
 #endif
     bool initKey();
     bool cleanHandle();
-    bool create(int size);
+    bool create(qint64 size);
     bool attach(QSharedMemory::AccessMode mode);
     bool detach();
 
+    bool createDescriptor(qint64 size);
+    bool attachDescriptor(int fd, QSharedMemory::AccessMode mode);
+    bool detachDescriptor();
+    bool openFile(const std::string &fileName, qint64 size, QSharedMemory::AccessMode mode);
+    bool shareFile();
+    bool flush(QSharedMemory::FlushMode mode);
+    inline bool detachSegment()
+    { return memfd != -1 ? detachDescriptor() : detach(); }
+    bool sendDescriptor(int socket);
+    bool receiveDescriptor(int socket);
+    bool addSeals(int seals);
+    int seals() const;
+
+    static int pageSize();
+    static size_t hugePageSize(int options);
+    static size_t segmentAlignment(int options);
+    static int segmentHeaderSize();
+    qint64 segmentSize(qint64 size, const std::string &function);
+    inline QSharedMemory::AccessMode mappingMode(QSharedMemory::AccessMode mode) const
+    {
+        // the lock word has to stay writable, ReadOnly is applied to the data only
+        return lockMode == QSharedMemory::SystemSemaphoreLock ? mode : QSharedMemory::ReadWrite;
+    }
+    bool applyMappingOptions(QSharedMemory::AccessMode mode);
+#ifndef __WIN32
+    bool prefault(QSharedMemory::AccessMode mode);
+#endif
+#ifndef __WIN32
+    bool setHugePageError(const std::string &function);
+#endif
+    bool setupMapping(QSharedMemory::AccessMode mode, bool created);
+    bool initHeader(QSharedMemory::AccessMode mode);
+    bool resetLockState();
+    bool checkHeader(QSharedMemory::AccessMode mode);
+    bool protect(void *address, size_t length);
+    bool mapPrivate(qint64 offset);
+    bool mapFixed(bool created);
+    bool moveMapping(void *address);
+#ifndef __WIN32
+    bool mapDescriptorAt(int fd, void *address);
+    bool remapPrivate(qint64 newSize, const std::string &function);
+#endif
+    bool applyNumaPolicy(bool move);
+    static int currentNumaNode();
+    static std::vector<int> numaNodes();
+    bool setupReplicas(QSharedMemory::AccessMode mode, bool created);
+    void clearReplicas();
+    int segmentDescriptor() const;
+    bool resize(qint64 size, const std::string &function);
+    bool remapSegment(qint64 newSize, const std::string &function);
+    bool remap();
+    static quint64 newInstanceId();
+    QSharedMemoryLockState &lockState();
+    const QSharedMemoryLockState *findLockState() const;
+    void dropLockState();
+    void holdLocks(int count);
+    void setLockError(QSharedMemory::SharedMemoryError e, const std::string &message);
+    inline void checkGeneration()
+    {
+        if (header && header->generation.load(std::memory_order_acquire) != generation)
+            remap();
+    }
+    int acquireLock(std::chrono::nanoseconds timeout);
+    bool statisticsEnabled() const
+    { return header && header->statistics.enabled.load(std::memory_order_relaxed); }
+    void recordAcquire(QSharedMemoryLockState &state, std::chrono::steady_clock::time_point waitStart);
+    void recordRelease(QSharedMemoryLockState &state);
+    static qint64 currentProcessId();
+    bool futexLock(std::atomic<uint32_t> &word, std::chrono::nanoseconds timeout);
+    static void futexUnlock(std::atomic<uint32_t> &word);
+    bool waitForChange(uint32_t lastSeenGeneration, std::chrono::nanoseconds timeout);
+    bool startChangeWatcher();
+    bool stopChangeWatcher();
+    void closeChangeDescriptor();
+    quint64 drainChangeDescriptor();
+    uint64_t stripeMask(qint64 offset, qint64 length, const std::string &function);
+    bool rwLockForRead(std::chrono::nanoseconds timeout);
+    bool rwLockForWrite(std::chrono::nanoseconds timeout);
+    void rwUnlock(bool read);
+    void rwWake();
+    bool initRobustLock();
+    int robustLock(std::chrono::nanoseconds timeout);
+    bool robustUnlock();
+    void robustMarkConsistent();
+
     void setErrorString(const std::string& function);
 
     bool tryLocker(QSharedMemoryLocker *locker, const std::string &function) {
@@ -0,0 +1,100 @@
+/****************************************************************************
+**
+** Copyright (C) 2016 The Qt Company Ltd.
+** Contact: https://www.qt.io/licensing/
+**
+** This file is part of the QtCore module of the Qt Toolkit.
+**
+** $QT_BEGIN_LICENSE:LGPL$
+** Commercial License Usage
+** Licensees holding valid commercial Qt licenses may use this file in
+** accordance with the commercial license agreement provided with the
+** Software or, alternatively, in accordance with the terms contained in
+** a written agreement between you and The Qt Company. For licensing terms
+** and conditions see https://www.qt.io/terms-conditions. For further
+** information use the contact form at https://www.qt.io/contact-us.
+**
+** GNU Lesser General Public License Usage
+** Alternatively, this file may be used under the terms of the GNU Lesser
+** General Public License version 3 as published by the Free Software
+** Foundation and appearing in the file LICENSE.LGPL3 included in the
+** packaging of this file. Please review the following information to
+** ensure the GNU Lesser General Public License version 3 requirements
+** will be met: https://www.gnu.org/licenses/lgpl-3.0.html.
+**
+** GNU General Public License Usage
+** Alternatively, this file may be used under the terms of the GNU
+** General Public License version 2.0 or (at your option) the GNU General
+** Public license version 3 or any later version approved by the KDE Free
+** Qt Foundation. The licenses are as published by the Free Software
+** Foundation and appearing in the file LICENSE.GPL2 and LICENSE.GPL3
+** included in the packaging of this file. Please review the following
+** information to ensure the GNU General Public License requirements will
+** be met: https://www.gnu.org/licenses/gpl-2.0.html and
+** https://www.gnu.org/licenses/gpl-3.0.html.
+**
+** $QT_END_LICENSE$
+**
+****************************************************************************/
+
+#ifndef QSHAREDRINGBUFFER_H
+#define QSHAREDRINGBUFFER_H
+
+#include "qglobal.h"
+
+#include <chrono>
+#include <climits>
+#include <functional>
+#include <memory>
+#include <string>
+
+class QSharedMemory;
+class QSharedRingBufferPrivate;
+
+class Q_CORE_EXPORT QSharedRingBuffer
+{
+public:
+    enum RingBufferError
+    {
+        NoError,
+        NotAttached,
+        InvalidFormat,
+        InvalidSize,
+        Timeout
+    };
+
+    explicit QSharedRingBuffer(QSharedMemory *sharedMemory = nullptr);
+    ~QSharedRingBuffer();
+
+    void setSharedMemory(QSharedMemory *sharedMemory);
+    QSharedMemory *sharedMemory() const;
+
+    bool initialize();
+    bool attach();
+    bool isAttached() const;
+    void detach();
+
+    qint64 capacity() const;
+    qint64 maxMessageSize() const;
+    qint64 bytesAvailable() const;
+    bool isEmpty() const;
+
+    void *reserve(qint64 size, std::chrono::nanoseconds timeout = std::chrono::nanoseconds(0));
+    bool commit(qint64 size);
+    bool write(const void *data, qint64 size, std::chrono::nanoseconds timeout = std::chrono::nanoseconds(0));
+
+    int read(const std::function<void(const void *data, qint64 size)> &reader, int maxMessages = INT_MAX,
+             std::chrono::nanoseconds timeout = std::chrono::nanoseconds(0));
+    qint64 readInto(void *buffer, qint64 maxSize, std::chrono::nanoseconds timeout = std::chrono::nanoseconds(0));
+
+    RingBufferError error() const;
+    std::string errorString() const;
+
+    QSharedRingBuffer(const QSharedRingBuffer &) = delete;
+    QSharedRingBuffer &operator=(const QSharedRingBuffer &) = delete;
+
+private:
+    std::unique_ptr<QSharedRingBufferPrivate> d;
+};
+
+#endif // QSHAREDRINGBUFFER_H
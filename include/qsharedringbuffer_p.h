@@ -0,0 +1,117 @@
+/****************************************************************************
+**
+** Copyright (C) 2016 The Qt Company Ltd.
+** Contact: https://www.qt.io/licensing/
+**
+** This file is part of the QtCore module of the Qt Toolkit.
+**
+** $QT_BEGIN_LICENSE:LGPL$
+** Commercial License Usage
+** Licensees holding valid commercial Qt licenses may use this file in
+** accordance with the commercial license agreement provided with the
+** Software or, alternatively, in accordance with the terms contained in
+** a written agreement between you and The Qt Company. For licensing terms
+** and conditions see https://www.qt.io/terms-conditions. For further
+** information use the contact form at https://www.qt.io/contact-us.
+**
+** GNU Lesser General Public License Usage
+** Alternatively, this file may be used under the terms of the GNU Lesser
+** General Public License version 3 as published by the Free Software
+** Foundation and appearing in the file LICENSE.LGPL3 included in the
+** packaging of this file. Please review the following information to
+** ensure the GNU Lesser General Public License version 3 requirements
+** will be met: https://www.gnu.org/licenses/lgpl-3.0.html.
+**
+** GNU General Public License Usage
+** Alternatively, this file may be used under the terms of the GNU
+** General Public License version 2.0 or (at your option) the GNU General
+** Public license version 3 or any later version approved by the KDE Free
+** Qt Foundation. The licenses are as published by the Free Software
+** Foundation and appearing in the file LICENSE.GPL2 and LICENSE.GPL3
+** included in the packaging of this file. Please review the following
+** information to ensure the GNU General Public License requirements will
+** be met: https://www.gnu.org/licenses/gpl-2.0.html and
+** https://www.gnu.org/licenses/gpl-3.0.html.
+**
+** $QT_END_LICENSE$
+**
+****************************************************************************/
+
+#ifndef QSHAREDRINGBUFFER_P_H
+#define QSHAREDRINGBUFFER_P_H
+
+#include "qsharedringbuffer.h"
+
+#include <atomic>
+#include <cstdint>
+#include <string>
+
+// Lives at the start of the segment's data, followed by the ring. The
+// positions only grow, their offset in the ring is position & (capacity - 1).
+// Each index has a cache line of its own, together with the futex word its
+// writer checks after moving it: the other side only sets that word before
+// it sleeps.
+struct QSharedRingBufferHeader
+{
+    enum { Magic = 0x4b545352, Version = 2 };
+
+    // stored last by initialize(), it publishes the other fields
+    std::atomic<uint64_t> magic;
+    uint32_t version;
+    uint64_t capacity;
+    alignas(64) std::atomic<uint64_t> tail;        // written by the producer
+    std::atomic<uint32_t> consumerWaiting;
+    alignas(64) std::atomic<uint64_t> head;        // written by the consumer
+    std::atomic<uint32_t> producerWaiting;
+};
+
+// Precedes every message in the ring. A message never wraps: if it doesn't
+// fit before the end, a padding record fills the rest of the ring and the
+// message starts at offset 0.
+struct QSharedRingBufferRecord
+{
+    enum { Message, Padding };
+
+    uint32_t size;
+    uint32_t type;
+};
+
+class QSharedRingBufferPrivate
+{
+public:
+    inline void setError(QSharedRingBuffer::RingBufferError e, const std::string &message)
+    { error = e; errorString = message; }
+    inline void clearError()
+    { if (error != QSharedRingBuffer::NoError) setError(QSharedRingBuffer::NoError, std::string()); }
+
+    static inline uint64_t recordSize(qint64 size)
+    { return (sizeof(QSharedRingBufferRecord) + uint64_t(size) + 7) & ~uint64_t(7); }
+    inline QSharedRingBufferRecord *record(uint64_t position) const
+    { return reinterpret_cast<QSharedRingBufferRecord *>(ring + (position & mask)); }
+
+    bool isMapped(const std::string &function);
+    bool waitForSpace(const char *function, uint64_t needed, std::chrono::nanoseconds timeout);
+    bool waitForData(const char *function, std::chrono::nanoseconds timeout);
+    void publishTail();
+    void publishHead();
+
+    QSharedMemory *sharedMemory = nullptr;
+    QSharedRingBufferHeader *header = nullptr;
+    char *ring = nullptr;
+    uint64_t capacity = 0;
+    uint64_t mask = 0;
+
+    // the producer's and consumer's own positions and their last look at
+    // the other side's, so an index is only read when the cached one runs out
+    uint64_t tail = 0;
+    uint64_t cachedHead = 0;
+    uint64_t reserved = 0;
+    qint64 reservedSize = -1;
+    uint64_t head = 0;
+    uint64_t cachedTail = 0;
+
+    std::string errorString;
+    QSharedRingBuffer::RingBufferError error = QSharedRingBuffer::NoError;
+};
+
+#endif // QSHAREDRINGBUFFER_P_H
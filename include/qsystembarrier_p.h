@@ -0,0 +1,129 @@
+/****************************************************************************
+**
+** Copyright (C) 2016 The Qt Company Ltd.
+** Contact: https://www.qt.io/licensing/
+**
+** This file is part of the QtCore module of the Qt Toolkit.
+**
+** $QT_BEGIN_LICENSE:LGPL$
+** Commercial License Usage
+** Licensees holding valid commercial Qt licenses may use this file in
+** accordance with the commercial license agreement provided with the
+** Software or, alternatively, in accordance with the terms contained in
+** a written agreement between you and The Qt Company. For licensing terms
+** and conditions see https://www.qt.io/terms-conditions. For further
+** information use the contact form at https://www.qt.io/contact-us.
+**
+** GNU Lesser General Public License Usage
+** Alternatively, this file may be used under the terms of the GNU Lesser
+** General Public License version 3 as published by the Free Software
+** Foundation and appearing in the file LICENSE.LGPL3 included in the
+** packaging of this file. Please review the following information to
+** ensure the GNU Lesser General Public License version 3 requirements
+** will be met: https://www.gnu.org/licenses/lgpl-3.0.html.
+**
+** GNU General Public License Usage
+** Alternatively, this file may be used under the terms of the GNU
+** General Public License version 2.0 or (at your option) the GNU General
+** Public license version 3 or any later version approved by the KDE Free
+** Qt Foundation. The licenses are as published by the Free Software
+** Foundation and appearing in the file LICENSE.GPL2 and LICENSE.GPL3
+** included in the packaging of this file. Please review the following
+** information to ensure the GNU General Public License requirements will
+** be met: https://www.gnu.org/licenses/gpl-2.0.html and
+** https://www.gnu.org/licenses/gpl-3.0.html.
+**
+** $QT_END_LICENSE$
+**
+****************************************************************************/
+
+#ifndef QSYSTEMBARRIER_P_H
+#define QSYSTEMBARRIER_P_H
+
+#include "qsystembarrier.h"
+
+#include "qsharedmemory_p.h"
+#include "qcore_unix_p.h"
+
+#include <sys/file.h>
+
+#include <atomic>
+#include <cstdint>
+#include <string>
+
+// Lives at the start of the barrier's segment. The phase and the number of
+// arrivals in it change together in one word, so an arrival always knows
+// which phase it counted for; the futex word only trails the phase.
+struct QSystemBarrierHeader
+{
+    enum { Magic = 0x4b545342, Version = 1 };
+
+    std::atomic<uint32_t> magic;
+    uint32_t version;
+    uint32_t count;
+    alignas(64) std::atomic<uint64_t> state; // generation << 32 | arrived
+    alignas(64) std::atomic<uint32_t> generation;
+    std::atomic<uint32_t> waiters;
+};
+
+// Holds the exclusive flock on the guard file of a barrier for a scope.
+class QSystemBarrierLocker
+{
+public:
+    inline explicit QSystemBarrierLocker(int keyLockFd) : fd(keyLockFd) {}
+    inline ~QSystemBarrierLocker()
+    {
+        if (locked)
+            ::flock(fd, LOCK_UN);
+    }
+
+    inline bool lock()
+    {
+        int res;
+        EINTR_LOOP(res, ::flock(fd, LOCK_EX));
+        locked = res == 0;
+        return locked;
+    }
+
+private:
+    int fd;
+    bool locked = false;
+};
+
+class QSystemBarrierPrivate
+{
+public:
+    std::string makeKeyFileName()
+    {
+        return QSharedMemoryPrivate::makePlatformSafeKey(key, "qipc_systembarrier_");
+    }
+    // the guard file stays in the temporary directory on both backends and
+    // is never removed, so every instance of a key locks the same inode
+    std::string makeKeyLockFileName()
+    {
+        const std::string name = QSharedMemoryPrivate::makePlatformSafeKey(key, "qipc_systembarrier_");
+        return QSharedMemoryPrivate::tempPath() + '/' + name.substr(name.rfind('/') + 1) + ".lock";
+    }
+
+    inline void setError(QSystemBarrier::SystemBarrierError e, const std::string &message)
+    { error = e; errorString = message; }
+    inline void clearError()
+    { if (error != QSystemBarrier::NoError) setError(QSystemBarrier::NoError, std::string()); }
+    void setSharedMemoryError(const std::string &function);
+    void setKeyLockError(const std::string &function);
+
+    bool handle(QSystemBarrier::AccessMode mode);
+    void cleanHandle();
+    QSystemBarrierHeader *header() const
+    { return static_cast<QSystemBarrierHeader *>(const_cast<void *>(segment.constData())); }
+
+    std::string key;
+    int count{};
+    QSharedMemory segment;
+    // serializes attaching and the last detach, the segment has a native key
+    int keyLockFd = -1;
+    std::string errorString;
+    QSystemBarrier::SystemBarrierError error{QSystemBarrier::NoError};
+};
+
+#endif // QSYSTEMBARRIER_P_H
@@ -48,8 +48,21 @@
 #   include <semaphore.h>
 #endif
 
+#include <atomic>
+#include <cstdint>
 #include <string>
 
+#ifdef QT_POSIX_IPC
+// Shared by the users of a POSIX semaphore next to its batch gate. Every
+// release bumps the counter, so batch acquirers can sleep on it as a futex
+// until resources come back instead of polling.
+struct QSystemSemaphoreBatchState
+{
+    std::atomic<uint32_t> releases;
+    std::atomic<uint32_t> waiters;
+};
+#endif
+
 class QSystemSemaphorePrivate
 {
 public:
@@ -61,21 +74,26 @@ public:
 
     inline void setError(QSystemSemaphore::SystemSemaphoreError e, const std::string &message)
     { error = e; errorString = message; }
+    // only writes on a change, threads sharing a QSharedMemory lock succeed concurrently
     inline void clearError()
-    { setError(QSystemSemaphore::NoError, std::string()); }
+    { if (error != QSystemSemaphore::NoError) setError(QSystemSemaphore::NoError, std::string()); }
 
 #ifdef __WIN32
     Qt::HANDLE handle(QSystemSemaphore::AccessMode mode = QSystemSemaphore::Open);
+    Qt::HANDLE batchHandle();
     void setErrorString(const std::string &function);
 #elif defined(QT_POSIX_IPC)
     bool handle(QSystemSemaphore::AccessMode mode = QSystemSemaphore::Open);
+    bool batchHandle();
     void setErrorString(const std::string &function);
 #else
     key_t handle(QSystemSemaphore::AccessMode mode = QSystemSemaphore::Open);
     void setErrorString(const std::string &function);
 #endif
     void cleanHandle();
-    bool modifySemaphore(int count);
+    // timeout only applies to acquiring, nanoseconds::max() waits forever;
+    // a negative count takes all the resources or none of them
+    bool modifySemaphore(int count, std::chrono::nanoseconds timeout = std::chrono::nanoseconds::max());
 
     std::string key;
     std::string fileName;
@@ -85,6 +103,8 @@ public:
     Qt::HANDLE semaphoreLock{};
 #elif defined(QT_POSIX_IPC)
     sem_t *semaphore;
+    sem_t *batchSemaphore;
+    QSystemSemaphoreBatchState *batchState;
     bool createdSemaphore;
 #else
     key_t unix_key;
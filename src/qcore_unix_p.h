@@ -0,0 +1,31 @@
+#pragma once
+
+#include <cerrno>
+#include <unistd.h>
+
+// Minimal replacement for the Qt private header private/qcore_unix_p.h:
+// only the helpers needed by the unix backends are provided.
+
+#define EINTR_LOOP(var, cmd)                    \
+    do {                                        \
+        var = cmd;                              \
+    } while (var == -1 && errno == EINTR)
+
+static inline int qt_safe_close(int fd)
+{
+    int ret;
+    EINTR_LOOP(ret, ::close(fd));
+    return ret;
+}
+
+#if !defined(QT_POSIX_IPC)
+#include <string>
+#include <sys/ipc.h>
+
+static inline key_t qt_safe_ftok(const std::string &fileName, int projId)
+{
+    // Qt derives the System V IPC key from the key file with project id 'Q',
+    // keep it that way to stay interoperable with Qt applications.
+    return ::ftok(fileName.c_str(), projId);
+}
+#endif
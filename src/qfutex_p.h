@@ -0,0 +1,98 @@
+#pragma once
+
+#include <atomic>
+#include <chrono>
+#include <cerrno>
+#include <cstdint>
+#include <ctime>
+
+// Minimal replacement for the Qt private header private/qfutex_p.h.
+// The words live in shared memory, so the process-shared (non private)
+// futex operations are used. Where futexes are not available waiting
+// degrades to yielding; callers always re-check the word after waking.
+
+#if defined(__linux__)
+#  include <climits>
+#  include <linux/futex.h>
+#  include <sys/syscall.h>
+#  include <unistd.h>
+
+namespace QtLinuxFutex {
+    constexpr inline bool futexAvailable() { return true; }
+
+    inline int _q_futex(std::atomic<uint32_t> &addr, int op, uint32_t val, const timespec *timeout = nullptr)
+    {
+        return int(syscall(SYS_futex, reinterpret_cast<uint32_t *>(&addr), op, val, timeout, nullptr, 0));
+    }
+
+    // Blocks while addr == expectedValue. Returns false on timeout.
+    inline bool futexWait(std::atomic<uint32_t> &addr, uint32_t expectedValue, const timespec *timeout = nullptr)
+    {
+        if (_q_futex(addr, FUTEX_WAIT, expectedValue, timeout) == -1)
+            return errno != ETIMEDOUT;
+        return true;
+    }
+
+    inline void futexWakeOne(std::atomic<uint32_t> &addr)
+    {
+        _q_futex(addr, FUTEX_WAKE, 1);
+    }
+
+    inline void futexWakeAll(std::atomic<uint32_t> &addr)
+    {
+        _q_futex(addr, FUTEX_WAKE, INT_MAX);
+    }
+}
+namespace QtFutex = QtLinuxFutex;
+
+#else
+#  include <thread>
+
+namespace QtDummyFutex {
+    constexpr inline bool futexAvailable() { return false; }
+
+    inline bool futexWait(std::atomic<uint32_t> &addr, uint32_t expectedValue, const timespec * = nullptr)
+    {
+        if (addr.load(std::memory_order_relaxed) == expectedValue)
+            std::this_thread::yield();
+        return true;
+    }
+
+    inline void futexWakeOne(std::atomic<uint32_t> &) {}
+    inline void futexWakeAll(std::atomic<uint32_t> &) {}
+}
+namespace QtFutex = QtDummyFutex;
+
+#endif
+
+// Returns the point in time a wait with timeout gives up, or
+// time_point::max() for nanoseconds::max(), which waits forever.
+inline std::chrono::steady_clock::time_point futexDeadline(std::chrono::nanoseconds timeout)
+{
+    const auto now = std::chrono::steady_clock::now();
+    if (timeout == std::chrono::nanoseconds::max()
+            || now > std::chrono::steady_clock::time_point::max() - timeout)
+        return std::chrono::steady_clock::time_point::max();
+    return now + timeout;
+}
+
+// Waits on word while it holds expected. FUTEX_WAIT takes a relative
+// timeout, so it is recomputed from the deadline for every wait. Returns
+// false once the deadline has passed.
+inline bool futexWaitUntil(std::atomic<uint32_t> &word, uint32_t expected,
+                           std::chrono::steady_clock::time_point deadline)
+{
+    if (deadline == std::chrono::steady_clock::time_point::max()) {
+        QtFutex::futexWait(word, expected);
+        return true;
+    }
+    const auto left = std::chrono::duration_cast<std::chrono::nanoseconds>(
+                deadline - std::chrono::steady_clock::now());
+    if (left <= std::chrono::nanoseconds(0))
+        return false;
+    struct timespec ts;
+    ts.tv_sec = time_t(left.count() / 1000000000);
+    ts.tv_nsec = long(left.count() % 1000000000);
+    QtFutex::futexWait(word, expected, &ts);
+    return true;
+}
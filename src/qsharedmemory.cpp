@@ -41,8 +41,46 @@
 #include "qsharedmemory_p.h"
 #include "qsystemsemaphore.h"
 
+#include "qfutex_p.h"
 #include "sha1.hpp"
 
+#include <algorithm>
+#include <cerrno>
+#include <cstdio>
+#include <cstring>
+#include <limits>
+#include <new>
+#include <mutex>
+#include <thread>
+#include <unordered_map>
+
+#ifndef __WIN32
+#include <cstdlib>
+
+/*!
+    \internal
+
+    Returns the system's temporary directory the same way QDir::tempPath()
+    does on Unix: $TMPDIR if set, /tmp otherwise, without a trailing slash.
+  */
+std::string QSharedMemoryPrivate::tempPath()
+{
+    const char *tmpdir = std::getenv("TMPDIR");
+    std::string path = (tmpdir && *tmpdir) ? tmpdir : "/tmp";
+
+    // QDir::cleanPath(): collapse repeated separators and drop the trailing one
+    std::string clean;
+    for (char ch : path) {
+        if (ch == '/' && !clean.empty() && clean.back() == '/')
+            continue;
+        clean += ch;
+    }
+    if (clean.size() > 1 && clean.back() == '/')
+        clean.pop_back();
+    return clean;
+}
+#endif
+
 /*!
     \internal
 
@@ -68,9 +106,9 @@ std::string QSharedMemoryPrivate::makePlatformSafeKey(const std::string &key, co
 #ifdef __WIN32
     return result;
 #elif defined(QT_POSIX_IPC)
-    return QLatin1Char('/') + result;
+    return '/' + result;
 #else
-    return QDir::tempPath() + QLatin1Char('/') + result;
+    return tempPath() + '/' + result;
 #endif
 }
 
@@ -156,6 +194,10 @@ QSharedMemory::QSharedMemory(const std::string &key) : QSharedMemory() {
  */
 QSharedMemory::~QSharedMemory()
 {
+    d->closeChangeDescriptor();
+    // anonymous segments have no key to clear
+    if (d->memfd != -1)
+        detach();
     setKey(std::string());
 }
 
@@ -296,9 +338,25 @@ std::string QSharedMemory::nativeKey() const
   the attach operation is not performed and \tt false is returned. When the
   return value is \tt false, call error() to determine which error occurred.
 
+  The \a size is not limited to 2 GiB, see the qint64 overload. Sizes of
+  any other integral type, such as long, unsigned or a sizeof()
+  expression, are passed on to the qint64 overload; an unsigned size
+  too large for it fails with InvalidSize.
+
   \sa error()
  */
 bool QSharedMemory::create(int size, AccessMode mode)
+{
+    return create(qint64(size), mode);
+}
+
+/*!
+  \overload create()
+
+  Creates a shared memory segment of \a size bytes, which may exceed
+  2 GiB, and attaches to it with the given access \a mode.
+ */
+bool QSharedMemory::create(qint64 size, AccessMode mode)
 {
     if (!d->initKey())
         return false;
@@ -310,20 +368,441 @@ bool QSharedMemory::create(int size, AccessMode mode)
 #endif
 
     std::string function = "QSharedMemory::create";
-    QSharedMemoryLocker lock(this);
+    QSharedMemoryLocker lock = d->lockMode == SystemSemaphoreLock
+            ? QSharedMemoryLocker(this) : QSharedMemoryLocker(&d->systemSemaphore);
     if (!d->key.empty() && !d->tryLocker(&lock, function))
         return false;
 
-    if (size <= 0) {
-        d->error = QSharedMemory::InvalidSize;
-        d->errorString = function + ": create size is less then 0";
+#if !defined(__WIN32) && !defined(QT_POSIX_IPC)
+    // fail before the segment exists rather than leave it unattached
+    if (mode == CopyOnWrite) {
+        d->error = UnknownError;
+        d->errorString = function + ": copy-on-write is not supported for System V segments";
+        return false;
+    }
+#endif
+
+    d->attachedOptions = d->mappingOptions;
+    const qint64 segmentSize = d->segmentSize(size, function);
+    if (!segmentSize)
+        return false;
+
+    if (!d->create(segmentSize) || !d->attach(d->mappingMode(mode)))
+        return false;
+
+    return d->setupMapping(mode, true);
+}
+
+/*!
+  Sets the lock \a mode used by create() and attach(). The mode of an
+  already attached segment does not change until it is attached again.
+
+  SystemSemaphoreLock, the default, keeps the Qt segment layout. Any other
+  mode places a small header in front of the data returned by data(), so
+  all processes using a segment must agree on the lock mode.
+
+  \sa lockMode(), lock()
+ */
+void QSharedMemory::setLockMode(LockMode mode)
+{
+    d->lockMode = mode;
+}
+
+/*!
+  Sets the mapping \a options used by the next create() or attach(), a
+  combination of QSharedMemory::MappingOption values.
+
+  With HugePages or HugePages1G the segment is backed by hugetlb pages and
+  its size is rounded up to a multiple of the huge page size. If the huge
+  page pool can't provide the pages, create() fails with OutOfResources
+  instead of silently using normal pages. Processes attaching to such a
+  segment must use the same huge page option.
+
+  Prefault and LockInMemory move the page faults of the first accesses
+  into create() and attach(), see prefaultedPages() and prefaultTime().
+
+  \sa mappingOptions()
+ */
+void QSharedMemory::setMappingOptions(int options)
+{
+    d->mappingOptions = options;
+}
+
+/*!
+  Returns the mapping options set with setMappingOptions().
+
+  \sa setMappingOptions()
+ */
+int QSharedMemory::mappingOptions() const
+{
+    return d->mappingOptions;
+}
+
+/*!
+  Returns the number of page faults taken to prefault the segment on the
+  last create() or attach() with the Prefault or LockInMemory option, or 0.
+  Pages that were already resident in the page cache still count as a
+  (minor) fault.
+
+  \sa prefaultTime(), setMappingOptions()
+ */
+qint64 QSharedMemory::prefaultedPages() const
+{
+    return d->prefaultedPages;
+}
+
+/*!
+  Returns the time spent prefaulting the segment on the last create() or
+  attach() with the Prefault or LockInMemory option.
+
+  \sa prefaultedPages(), setMappingOptions()
+ */
+std::chrono::nanoseconds QSharedMemory::prefaultTime() const
+{
+    return d->prefaultTime;
+}
+
+/*!
+  Sets the NUMA memory \a policy of the segment and the \a nodes it
+  applies to. If the segment is attached the policy is applied right away
+  and pages already in use are migrated, otherwise it is applied by the
+  next create() or attach() before the segment is first touched. Returns
+  \c false if the policy can't be applied; the previous policy is kept.
+
+  The policy belongs to the segment, so it applies to the pages faulted in
+  by every process using it. With NumaPreferred only the first node is
+  used.
+
+  \sa numaPolicy(), setNumaReplicas()
+ */
+bool QSharedMemory::setNumaPolicy(NumaPolicy policy, const std::vector<int> &nodes)
+{
+    const NumaPolicy oldPolicy = d->numaPolicy;
+    std::vector<int> oldNodes = d->numaPolicyNodes;
+    d->numaPolicy = policy;
+    d->numaPolicyNodes = nodes;
+    if (isAttached() && !d->applyNumaPolicy(true)) {
+        d->numaPolicy = oldPolicy;
+        d->numaPolicyNodes = std::move(oldNodes);
         return false;
     }
+    return true;
+}
+
+/*!
+  Returns the NUMA policy set with setNumaPolicy().
+
+  \sa setNumaPolicy()
+ */
+QSharedMemory::NumaPolicy QSharedMemory::numaPolicy() const
+{
+    return d->numaPolicy;
+}
+
+/*!
+  Enables or disables read-mostly replicas for the next create() or
+  attach(). A segment created with replicas gets one copy of its data per
+  online NUMA node, each bound to its node. A ReadOnly or CopyOnWrite
+  attach() maps the copy of the node the calling thread runs on and data()
+  returns it, so readers never touch remote memory. Writers update the primary segment
+  under lock() and then publish it with updateReplicas().
+
+  Replicas need a key set with setKey(); the option is ignored for native
+  keys and anonymous segments. A segment with replicas can't be resize()d.
+
+  \sa numaReplicas(), updateReplicas(), numaNode()
+ */
+void QSharedMemory::setNumaReplicas(bool enabled)
+{
+    d->numaReplicas = enabled;
+}
+
+/*!
+  Returns \c true if replicas are enabled.
+
+  \sa setNumaReplicas()
+ */
+bool QSharedMemory::numaReplicas() const
+{
+    return d->numaReplicas;
+}
+
+/*!
+  Returns the NUMA node of the replica data() refers to, or -1 if data()
+  refers to the primary segment.
+
+  \sa setNumaReplicas()
+ */
+int QSharedMemory::numaNode() const
+{
+    return d->readReplicaNode;
+}
 
-    if (!d->create(size))
+/*!
+  Copies the contents of the primary segment to all replicas and returns
+  \c true. Call it with the lock held after changing the data. Replicas
+  are only mapped writable by ReadWrite attachments, calling this function
+  on any other attachment fails with PermissionDenied.
+
+  \sa setNumaReplicas(), lock()
+ */
+bool QSharedMemory::updateReplicas()
+{
+    const std::string function = "QSharedMemory::updateReplicas";
+    if (!isAttached()) {
+        d->error = NotFound;
+        d->errorString = function + ": not attached";
         return false;
+    }
+    if (d->readReplica) {
+        d->error = PermissionDenied;
+        d->errorString = function + ": replicas are attached read only";
+        return false;
+    }
+
+    const qint64 dataSize = size();
+    for (const auto &replica : d->replicas)
+        memcpy(replica->data(), constData(), size_t(dataSize));
+    return true;
+}
+
+/*!
+  Sets the \a address create() maps a FixedAddress segment at. By default
+  the system chooses the address. The address must be page aligned and
+  should be far from the ranges the system uses for other mappings, so
+  that it is free in every process attaching to the segment.
+
+  \sa baseAddress(), setMappingOptions()
+ */
+void QSharedMemory::setBaseAddress(void *address)
+{
+    d->requestedAddress = address;
+}
+
+/*!
+  Returns the address the attached segment starts at in every process
+  using the FixedAddress option, or null if the segment is not attached.
+  The segment header, if any, lies between this address and data().
+
+  \sa setBaseAddress()
+ */
+void *QSharedMemory::baseAddress() const
+{
+    d->checkGeneration();
+    return d->memory;
+}
+
+/*!
+  Returns the lock mode set with setLockMode().
+
+  \sa setLockMode()
+ */
+QSharedMemory::LockMode QSharedMemory::lockMode() const
+{
+    return d->lockMode;
+}
+
+/*!
+  Sets who owns the lock of this instance to \a ownership.
+
+  With ProcessOwnership, the default, the instance holds the lock on
+  behalf of its process and must only be used by one thread at a time.
+  With ThreadOwnership the instance can be shared by a pool of threads:
+  lock(), lockForRead(), unlock(), beginWrite() and the other lock
+  functions track which thread holds the lock, so a thread can't unlock
+  what another thread locked, and threads of the process wait for each
+  other like separate processes do. RecursiveThreadOwnership additionally
+  lets the holding thread lock again; it must unlock as often as it
+  locked. A thread holding a read lock can't take the write lock.
+
+  The error of a failed lock call is then shared by the threads: it is
+  the one of the last call that failed. The ownership must not be changed
+  while the lock is held.
+
+  \sa lockOwnership(), lock()
+ */
+void QSharedMemory::setLockOwnership(LockOwnership ownership)
+{
+    if (d->lockState().lockedByMe) {
+        std::cout << "Warning: QSharedMemory::setLockOwnership: the lock is held" << std::endl;
+        return;
+    }
+    d->dropLockState();
+    d->lockOwnership = ownership;
+}
+
+/*!
+  Returns who owns the lock of this instance.
+
+  \sa setLockOwnership()
+ */
+QSharedMemory::LockOwnership QSharedMemory::lockOwnership() const
+{
+    return d->lockOwnership;
+}
+
+/*!
+  Enables or disables, as \a enabled says, collecting statistics about
+  the segment lock: how often lock(), lockForRead() and the functions
+  built on them took it, how often they had to wait and for how long,
+  how long it was held and by which process. See lockStatistics().
+
+  The statistics live in the segment header, so every attached process
+  contributes to them. The setting is applied by create() and, if the
+  segment is attached, right away for all processes. It is off by
+  default; when on, a lock costs two clock reads and a few atomic
+  additions. Segments with the SystemSemaphoreLock mode have no header
+  and no statistics.
+
+  \sa isLockStatisticsEnabled(), resetLockStatistics()
+ */
+void QSharedMemory::setLockStatisticsEnabled(bool enabled)
+{
+    d->collectStatistics = enabled;
+    if (d->header)
+        d->header->statistics.enabled.store(enabled, std::memory_order_relaxed);
+}
+
+/*!
+  Returns \c true if lock statistics are collected.
+
+  \sa setLockStatisticsEnabled()
+ */
+bool QSharedMemory::isLockStatisticsEnabled() const
+{
+    return d->header ? d->statisticsEnabled() : d->collectStatistics;
+}
+
+/*!
+  Returns the lock statistics collected by all processes using the
+  attached segment. Bucket \c i of the wait and hold time histograms
+  counts the durations below 2^(i + 1) nanoseconds not counted by a lower
+  bucket, the last bucket all longer ones. Uncontended locks count as
+  waits of 0.
+
+  The counters are read one by one while other processes may update
+  them, so they can be slightly inconsistent with each other.
+
+  \sa setLockStatisticsEnabled()
+ */
+QSharedMemory::LockStatistics QSharedMemory::lockStatistics() const
+{
+    LockStatistics result;
+    if (!d->header)
+        return result;
+
+    const QSharedMemoryHeader::LockStatistics &stats = d->header->statistics;
+    result.acquires = stats.acquires.load(std::memory_order_relaxed);
+    result.contendedAcquires = stats.contendedAcquires.load(std::memory_order_relaxed);
+    result.timeouts = stats.timeouts.load(std::memory_order_relaxed);
+    result.totalWaitTime = std::chrono::nanoseconds(stats.totalWaitTime.load(std::memory_order_relaxed));
+    result.totalHoldTime = std::chrono::nanoseconds(stats.totalHoldTime.load(std::memory_order_relaxed));
+    for (uint32_t i = 0; i < QSharedMemoryHeader::StatisticsBuckets; ++i) {
+        result.waitHistogram.push_back(stats.waitHistogram[i].load(std::memory_order_relaxed));
+        result.holdHistogram.push_back(stats.holdHistogram[i].load(std::memory_order_relaxed));
+    }
+    result.lastHolderPid = stats.lastHolderPid.load(std::memory_order_relaxed);
+    return result;
+}
+
+/*!
+  Sets all lock statistics of the attached segment to zero.
+
+  \sa lockStatistics()
+ */
+void QSharedMemory::resetLockStatistics()
+{
+    if (!d->header)
+        return;
+
+    QSharedMemoryHeader::LockStatistics &stats = d->header->statistics;
+    stats.acquires.store(0, std::memory_order_relaxed);
+    stats.contendedAcquires.store(0, std::memory_order_relaxed);
+    stats.timeouts.store(0, std::memory_order_relaxed);
+    stats.totalWaitTime.store(0, std::memory_order_relaxed);
+    stats.totalHoldTime.store(0, std::memory_order_relaxed);
+    for (uint32_t i = 0; i < QSharedMemoryHeader::StatisticsBuckets; ++i) {
+        stats.waitHistogram[i].store(0, std::memory_order_relaxed);
+        stats.holdHistogram[i].store(0, std::memory_order_relaxed);
+    }
+}
+
+/*!
+  Sets the number of range lock stripes of segments created by this
+  instance to \a count and the size of the chunks they guard to
+  \a stripeSize bytes, see lockRange(). The data is cut in chunks of
+  \a stripeSize bytes and each chunk is hashed to one of the \a count
+  stripes, so it pays to make \a stripeSize the size of a record. The
+  default is 64 stripes, the maximum, of 4096 bytes.
+
+  Attached segments use the stripes they were created with.
+
+  \sa lockStripes(), lockRange()
+ */
+void QSharedMemory::setLockStripes(int count, qint64 stripeSize)
+{
+    d->stripeCount = std::max(1, std::min(count, int(QSharedMemoryHeader::MaxLockStripes)));
+    d->stripeSize = std::max(stripeSize, qint64(1));
+}
+
+/*!
+  Returns the number of range lock stripes of the attached segment, or
+  the number set with setLockStripes() if it is not attached.
+
+  \sa setLockStripes()
+ */
+int QSharedMemory::lockStripes() const
+{
+    return d->header ? int(d->header->stripeCount) : d->stripeCount;
+}
+
+/*!
+  Sets the time lock() spins on a contended FutexLock or SeqLock segment
+  before it sleeps in the kernel to \a spinTime. While spinning it polls
+  the lock word with exponentially growing runs of pause instructions, so
+  a lock held for less than a context switch is taken without one.
+
+  The default of 0 sleeps right away, which is the better choice when the
+  lock is held for long or the machine has fewer cores than lockers. Use
+  spinAcquires() and blockedAcquires() to tune the time.
+
+  \sa spinTime(), lock()
+ */
+void QSharedMemory::setSpinTime(std::chrono::nanoseconds spinTime)
+{
+    d->spinTime = std::max(spinTime, std::chrono::nanoseconds(0));
+}
+
+/*!
+  Returns the time lock() spins before it sleeps.
+
+  \sa setSpinTime()
+ */
+std::chrono::nanoseconds QSharedMemory::spinTime() const
+{
+    return d->spinTime;
+}
+
+/*!
+  Returns how many contended lock() calls of this instance took the lock
+  while spinning, without sleeping in the kernel.
+
+  \sa blockedAcquires(), setSpinTime()
+ */
+qint64 QSharedMemory::spinAcquires() const
+{
+    return d->spinAcquires.load(std::memory_order_relaxed);
+}
+
+/*!
+  Returns how many contended lock() calls of this instance had to sleep
+  in the kernel before they took the lock.
 
-    return d->attach(mode);
+  \sa spinAcquires(), setSpinTime()
+ */
+qint64 QSharedMemory::blockedAcquires() const
+{
+    return d->blockedAcquires.load(std::memory_order_relaxed);
 }
 
 /*!
@@ -335,9 +814,77 @@ bool QSharedMemory::create(int size, AccessMode mode)
 
   \sa create(), attach()
  */
-int QSharedMemory::size() const
+qint64 QSharedMemory::size() const
+{
+    d->checkGeneration();
+    return d->size - d->headerSize;
+}
+
+/*!
+  Grows the attached segment to hold \a size bytes of data and returns
+  \c true. The contents are kept and the new part is zero filled; the
+  address returned by data() may change.
+
+  Other instances attached to the segment are not detached: they notice
+  the new size from a generation counter in the segment header and remap
+  on their next lock(), data() or size() call. This needs the segment
+  header, so the segment must use a lockMode() other than
+  SystemSemaphoreLock. Segments can only grow, and System V segments
+  (other than anonymous ones) can't be resized at all. Neither can
+  segments created with NUMA replicas, see setNumaReplicas(), whichever
+  attachment calls resize().
+
+  The segment is locked while it is resized, unless the caller already
+  holds the lock. With ThreadOwnership the mapping only moves while no
+  other thread holds a lock, range locks included, on this instance:
+  resize() then fails with LockError, and data() or size() keep the old
+  mapping until the other threads released their locks. Pointers the
+  calling thread got from data() before are no longer valid.
+
+  \sa size(), create()
+ */
+bool QSharedMemory::resize(qint64 size)
 {
-    return d->size;
+    const std::string function = "QSharedMemory::resize";
+    if (!isAttached()) {
+        d->error = NotFound;
+        d->errorString = function + ": not attached";
+        return false;
+    }
+    if (!d->header) {
+        d->error = UnknownError;
+        d->errorString = function + ": segment has no lock header";
+        return false;
+    }
+    if (d->accessMode != ReadWrite) {
+        d->error = PermissionDenied;
+        d->errorString = function + ": segment is not attached read write";
+        return false;
+    }
+    if (d->header->replicated) {
+        d->error = UnknownError;
+        d->errorString = function + ": segment has NUMA replicas";
+        return false;
+    }
+
+    const bool locked = d->lockState().lockedByMe;
+    if (!locked && !lock())
+        return false;
+    bool shared = false;
+    if (d->lockOwnership != ProcessOwnership) {
+        std::lock_guard<std::mutex> guard(d->threadMutex);
+        shared = d->heldLocks > 1;
+    }
+    if (shared) {
+        if (!locked)
+            unlock();
+        d->setLockError(LockError, function + ": other threads hold locks on the instance");
+        return false;
+    }
+    const bool ok = d->remap() && d->resize(size, function);
+    if (!locked)
+        unlock();
+    return ok;
 }
 
 /*!
@@ -350,6 +897,110 @@ int QSharedMemory::size() const
 
   \value ReadWrite Reading and writing the shared memory segment are
   both allowed.
+
+  \value CopyOnWrite The segment is mapped privately (MAP_PRIVATE,
+  FILE_MAP_COPY). Reading shares the pages with the other processes, a page
+  is copied on the first write to it and the change stays local to this
+  attachment. The segment header of a lockMode() other than
+  SystemSemaphoreLock stays shared, so lock() keeps working. Not available
+  for System V segments, and such attachments don't follow a resize().
+*/
+
+/*!
+  \enum QSharedMemory::LockMode
+
+  \value SystemSemaphoreLock lock() and unlock() acquire and release a
+  QSystemSemaphore derived from the key. Segments keep the Qt layout.
+
+  \value FutexLock The lock word lives in a header at the start of the
+  segment. An uncontended lock() or unlock() is a single atomic operation,
+  the kernel is only entered (FUTEX_WAIT/FUTEX_WAKE) when the lock is
+  contended. create(), attach() and detach() still use the system
+  semaphore of the key.
+
+  \value ReadWriteLock Like FutexLock, but the lock in the header is a
+  reader-writer lock: any number of processes can hold lockForRead() at
+  the same time, lockForWrite() and lock() are exclusive. See
+  setWriterPreference().
+
+  \value RobustLock The lock is a process-shared robust pthread mutex
+  (PTHREAD_MUTEX_ROBUST) in the segment header. If a process dies holding
+  it, the next lock() succeeds and reports lockOwnerDied(), after running
+  the handler set with setConsistencyHandler(). The mutex is owned by a
+  thread: unlock() must be called by the thread that called lock(). Not
+  available on Windows.
+
+  \value SeqLock For one writer and many readers that only need a
+  consistent copy of the data. The writer brackets its updates with
+  beginWrite() and endWrite(), readers use read() or readInto(), which
+  take no lock and never hold up the writer: they copy the data and retry
+  if a write overlapped the copy. lock() works as with FutexLock and is
+  what keeps concurrent writers apart.
+*/
+
+/*!
+  \enum QSharedMemory::MappingOption
+
+  \value NoMappingOption Normal pages.
+  \value HugePages Back the segment with 2 MiB hugetlb pages
+  (SHM_HUGETLB, MFD_HUGETLB or a file on a hugetlbfs mount for POSIX keys).
+  \value HugePages1G Back the segment with 1 GiB hugetlb pages.
+  \value TransparentHugePages Use normal pages and ask the kernel to back
+  the mapping with transparent huge pages (MADV_HUGEPAGE). The size is
+  rounded up to 2 MiB.
+  \value Prefault Fault in all pages when the segment is mapped, so the
+  first access to a page doesn't take a page fault.
+  \value LockInMemory Fault in all pages and lock them in memory with
+  mlock(), so they are never paged out. Fails with OutOfResources if
+  RLIMIT_MEMLOCK is too low.
+  \value FixedAddress Map the segment at the same address in every process,
+  so that pointers into it can be stored in it. create() records the
+  address in the segment header, attach() maps the segment there and fails
+  with OutOfResources if the range is in use. Needs a lockMode() other
+  than SystemSemaphoreLock; resize() grows such segments in place.
+  \value KeepOnDetach POSIX segments only: detach() never removes the
+  segment, like Qt 5.15 on Linux. By default every attachment holds a
+  shared flock() on the segment and the last one to detach() removes it,
+  which differs from Qt: Qt processes don't take the flock(), so a segment
+  they still have attached is removed once the last ktsm process detaches,
+  and later attaches fail with NotFound. Set it when sharing a segment
+  with Qt processes.
+*/
+
+/*!
+  \enum QSharedMemory::NumaPolicy
+
+  Memory policies applied with mbind(), see setNumaPolicy().
+
+  \value NumaDefault The policy of the faulting thread, usually the node
+  it runs on.
+  \value NumaBind Pages are only allocated on the given nodes.
+  \value NumaInterleave Pages are interleaved over the given nodes.
+  \value NumaPreferred Pages are allocated on the given node when
+  possible and on other nodes otherwise.
+*/
+
+/*!
+  \enum QSharedMemory::FlushMode
+
+  \value AsyncFlush Start writing the dirty pages back and return
+  (MS_ASYNC).
+  \value SyncFlush Write the dirty pages back and wait for the write to
+  complete (MS_SYNC).
+*/
+
+/*!
+  \enum QSharedMemory::Seal
+
+  File seals of anonymous segments, see seal().
+
+  \value NoSeal No seal.
+  \value SealShrink The segment can't be made smaller.
+  \value SealGrow The segment can't be made larger.
+  \value SealWrite The contents can't be modified.
+  \value SealFutureWrite No new writable mappings, existing ones stay
+  writable.
+  \value SealSeal No further seals can be added.
 */
 
 /*!
@@ -369,14 +1020,16 @@ bool QSharedMemory::attach(AccessMode mode)
     if (isAttached() || !d->initKey())
         return false;
 
-    QSharedMemoryLocker lock(this);
+    QSharedMemoryLocker lock = d->lockMode == SystemSemaphoreLock
+            ? QSharedMemoryLocker(this) : QSharedMemoryLocker(&d->systemSemaphore);
     if (!d->key.empty() && !d->tryLocker(&lock, "QSharedMemory::attach"))
         return false;
 
     if (isAttached() || !d->handle())
         return false;
 
-    return d->attach(mode);
+    d->attachedOptions = d->mappingOptions;
+    return d->attach(d->mappingMode(mode)) && d->setupMapping(mode, false);
 }
 
 /*!
@@ -405,25 +1058,272 @@ bool QSharedMemory::detach()
     if (!isAttached())
         return false;
 
-    QSharedMemoryLocker lock(this);
+    // the watcher thread sleeps in the header
+    d->closeChangeDescriptor();
+
+    QSharedMemoryLocker lock = !d->header
+            ? QSharedMemoryLocker(this) : QSharedMemoryLocker(&d->systemSemaphore);
     if (!d->key.empty() && !d->tryLocker(&lock, "QSharedMemory::detach"))
         return false;
 
-    return d->detach();
+    // Don't leave the in-segment lock held by a mapping that goes away.
+    if (d->header && d->lockState().lockedByMe)
+        unlock();
+    d->dropLockState();
+
+    if (!d->detachSegment())
+        return false;
+
+    d->clearReplicas();
+    d->header = nullptr;
+    d->headerSize = 0;
+    return true;
 }
 
 /*!
-  Returns a pointer to the contents of the shared memory segment, if
-  one is attached. Otherwise it returns null. Remember to lock the
-  shared memory with lock() before reading from or writing to the
-  shared memory, and remember to release the lock with unlock() after
-  you are done.
+  Creates an anonymous shared memory segment of \a size bytes and attaches
+  to it with the given access \a mode. The segment is backed by
+  memfd_create(): it has no name that other processes could look up and
+  disappears once the last descriptor and mapping are gone, even after a
+  crash. Share it with another process by passing descriptor() over a Unix
+  domain socket, see sendDescriptor() and receiveDescriptor().
 
-  \sa attach()
+  Any key is cleared. Anonymous segments have no key semaphore, use a
+  lockMode() with an in-segment lock if lock() is needed.
+
+  Only available on Linux.
+
+  \sa attachDescriptor(), seal()
  */
-void *QSharedMemory::data()
+bool QSharedMemory::createAnonymous(qint64 size, AccessMode mode)
 {
-    return d->memory;
+    const std::string function = "QSharedMemory::createAnonymous";
+    if (isAttached())
+        detach();
+    setKey(std::string());
+
+    d->attachedOptions = d->mappingOptions;
+    const qint64 segmentSize = d->segmentSize(size, function);
+    if (!segmentSize)
+        return false;
+
+    if (!d->createDescriptor(segmentSize) || !d->attachDescriptor(-1, d->mappingMode(mode)))
+        return false;
+
+    return d->setupMapping(mode, true);
+}
+
+/*!
+  Attaches to the anonymous segment referred to by the file descriptor
+  \a fd with the given access \a mode. The caller keeps ownership of \a fd,
+  QSharedMemory works on its own duplicate.
+
+  \sa createAnonymous(), receiveDescriptor()
+ */
+bool QSharedMemory::attachDescriptor(int fd, AccessMode mode)
+{
+    if (isAttached())
+        return false;
+    setKey(std::string());
+
+    if (fd < 0) {
+        d->error = QSharedMemory::KeyError;
+        d->errorString = "QSharedMemory::attachDescriptor: invalid descriptor";
+        return false;
+    }
+
+    d->attachedOptions = d->mappingOptions;
+    return d->attachDescriptor(fd, d->mappingMode(mode)) && d->setupMapping(mode, false);
+}
+
+/*!
+  Returns the file descriptor of the attached anonymous or file-backed
+  segment, or -1 if the segment was not created with createAnonymous() or
+  createFile() or attached with attachDescriptor() or attachFile(). The descriptor stays owned by QSharedMemory.
+ */
+int QSharedMemory::descriptor() const
+{
+    return d->memfd;
+}
+
+/*!
+  Creates a file-backed segment of \a size bytes and attaches to it with
+  the given access \a mode. The regular file \a fileName, on disk or on a
+  tmpfs, is the backing store of the segment: it is not removed when the
+  last process detaches, so the contents survive a restart and can be
+  attached again with attachFile(). Fails with AlreadyExists if the file
+  exists. The file \a fileName + ".lock" next to it serializes attaching
+  and is kept as well; attachFile() creates it if it is missing.
+
+  Any key is cleared. Like anonymous segments, file-backed segments have no
+  key semaphore: use a lockMode() with an in-segment lock if lock() is
+  needed. Dirty pages are written back by the kernel at its own pace, call
+  flush() to control when they reach the disk.
+
+  Only available on Linux.
+
+  \sa attachFile(), flush(), createAnonymous()
+ */
+bool QSharedMemory::createFile(const std::string &fileName, qint64 size, AccessMode mode)
+{
+    const std::string function = "QSharedMemory::createFile";
+    if (isAttached())
+        detach();
+    setKey(std::string());
+
+    d->attachedOptions = d->mappingOptions;
+    const qint64 segmentSize = d->segmentSize(size, function);
+    if (!segmentSize)
+        return false;
+
+    if (!d->openFile(fileName, segmentSize, d->mappingMode(mode)))
+        return false;
+    if (!d->attachDescriptor(-1, d->mappingMode(mode)) || !d->setupMapping(mode, true)) {
+        if (isAttached())
+            detach();
+        std::remove(fileName.c_str());
+        d->shareFile();
+        return false;
+    }
+    return d->shareFile();
+}
+
+/*!
+  Attaches to the file-backed segment stored in \a fileName with the given
+  access \a mode, keeping its contents. The lockMode() must match the one
+  used by createFile().
+
+  The lock state kept in the segment header is not persistent: if no other
+  process has the file attached, a lock or waiter left behind by a process
+  that crashed is cleared, along with the lock statistics.
+
+  \sa createFile(), flush()
+ */
+bool QSharedMemory::attachFile(const std::string &fileName, AccessMode mode)
+{
+    if (isAttached())
+        return false;
+    setKey(std::string());
+
+    d->attachedOptions = d->mappingOptions;
+    if (!d->openFile(fileName, 0, d->mappingMode(mode)))
+        return false;
+    if (!d->attachDescriptor(-1, d->mappingMode(mode)) || !d->setupMapping(mode, false)) {
+        d->shareFile();
+        return false;
+    }
+    if (d->soleFileUser && d->lockMode != SystemSemaphoreLock && !d->resetLockState()) {
+        const SharedMemoryError e = d->error;
+        const std::string s = d->errorString;
+        detach();
+        d->error = e;
+        d->errorString = s;
+        d->shareFile();
+        return false;
+    }
+    return d->shareFile();
+}
+
+/*!
+  Writes the modified pages of the segment back to its backing store and
+  returns \c true. With SyncFlush, the default, the call returns once the
+  data has been written; with AsyncFlush the write-back is only started.
+  This matters for file-backed segments; for other segments the call is
+  cheap and has no visible effect.
+
+  \sa createFile()
+ */
+bool QSharedMemory::flush(FlushMode mode)
+{
+    if (!isAttached()) {
+        d->error = NotFound;
+        d->errorString = "QSharedMemory::flush: not attached";
+        return false;
+    }
+    d->checkGeneration();
+    return d->flush(mode);
+}
+
+/*!
+  Sends the descriptor() of the attached anonymous segment over the Unix
+  domain \a socket as SCM_RIGHTS ancillary data. Returns \c true on success.
+
+  \sa receiveDescriptor()
+ */
+bool QSharedMemory::sendDescriptor(int socket)
+{
+    if (d->memfd == -1) {
+        d->error = QSharedMemory::NotFound;
+        d->errorString = "QSharedMemory::sendDescriptor: not attached to an anonymous segment";
+        return false;
+    }
+    return d->sendDescriptor(socket);
+}
+
+/*!
+  Receives a segment descriptor sent with sendDescriptor() from the Unix
+  domain \a socket and attaches to it with the given access \a mode.
+
+  \sa sendDescriptor(), attachDescriptor()
+ */
+bool QSharedMemory::receiveDescriptor(int socket, AccessMode mode)
+{
+    if (isAttached())
+        return false;
+    setKey(std::string());
+
+    if (!d->receiveDescriptor(socket))
+        return false;
+
+    d->attachedOptions = d->mappingOptions;
+    return d->attachDescriptor(-1, d->mappingMode(mode)) && d->setupMapping(mode, false);
+}
+
+/*!
+  Adds the \l {QSharedMemory::Seal} {seals} given by \a seals to the
+  attached anonymous segment. Seals can never be removed, so once
+  SealShrink is set, readers can rely on size() without defensive checks.
+
+  SealWrite fails while writable mappings exist; SealFutureWrite only
+  prevents new ones.
+
+  \sa seals()
+ */
+bool QSharedMemory::seal(int seals)
+{
+    if (d->memfd == -1) {
+        d->error = QSharedMemory::NotFound;
+        d->errorString = "QSharedMemory::seal: not attached to an anonymous segment";
+        return false;
+    }
+    return d->addSeals(seals);
+}
+
+/*!
+  Returns the seals of the attached anonymous segment.
+
+  \sa seal()
+ */
+int QSharedMemory::seals() const
+{
+    return d->memfd != -1 ? d->seals() : NoSeal;
+}
+
+/*!
+  Returns a pointer to the contents of the shared memory segment, if
+  one is attached. Otherwise it returns null. Remember to lock the
+  shared memory with lock() before reading from or writing to the
+  shared memory, and remember to release the lock with unlock() after
+  you are done.
+
+  \sa attach()
+ */
+void *QSharedMemory::data()
+{
+    d->checkGeneration();
+    if (d->readReplica)
+        return d->readReplica->data();
+    return d->header ? static_cast<char *>(d->memory) + d->headerSize : d->memory;
 }
 
 /*!
@@ -437,7 +1337,10 @@ void *QSharedMemory::data()
  */
 const void* QSharedMemory::constData() const
 {
-    return d->memory;
+    d->checkGeneration();
+    if (d->readReplica)
+        return d->readReplica->constData();
+    return d->header ? static_cast<const char *>(d->memory) + d->headerSize : d->memory;
 }
 
 /*!
@@ -445,7 +1348,7 @@ const void* QSharedMemory::constData() const
  */
 const void *QSharedMemory::data() const
 {
-    return d->memory;
+    return constData();
 }
 
 /*!
@@ -457,24 +1360,289 @@ const void *QSharedMemory::data() const
   that you have set the key with setNativeKey() or that
   QSystemSemaphore::acquire() failed due to an unknown system error.
 
+  With a lockMode() other than SystemSemaphoreLock the lock is taken in the
+  segment header, so the segment must be attached.
+
   \sa unlock(), data(), QSystemSemaphore::acquire()
  */
 bool QSharedMemory::lock()
 {
-    if (d->lockedByMe) {
-        std::cout << "Warning: QSharedMemory::lock: already locked" << std::endl;
+    return lock(std::chrono::nanoseconds::max());
+}
+
+/*!
+  \overload lock()
+
+  Locks the shared memory segment like lock(), but waits at most \a timeout
+  for another process to release it. If the lock can't be taken in time,
+  \c false is returned and error() is LockTimeout, which tells a busy
+  segment apart from a LockError. The wait uses sem_timedwait(),
+  semtimedop() or a futex wait with a timeout, depending on the lock mode
+  and backend.
+
+  \sa tryLock(), unlock()
+ */
+bool QSharedMemory::lock(std::chrono::nanoseconds timeout)
+{
+    std::string function = "QSharedMemory::lock";
+    if (d->lockState().lockedByMe) {
+        QSharedMemoryLockState &state = d->lockState();
+        // holding only the shared lock, reporting success would let the
+        // caller write while readers are inside
+        if (state.lockedForRead) {
+            d->setLockError(QSharedMemory::LockError, function + ": a read lock can't be upgraded");
+            return false;
+        }
+        if (d->lockOwnership != RecursiveThreadOwnership) {
+            std::cout << "Warning: QSharedMemory::lock: already locked" << std::endl;
+            return true;
+        }
+        ++state.recursion;
         return true;
     }
-    if (d->systemSemaphore.acquire()) {
-        d->lockedByMe = true;
+    if (d->lockMode != SystemSemaphoreLock && !d->header) {
+        d->setLockError(QSharedMemory::LockError, function + ": not attached");
+        d->dropLockState();
+        return false;
+    }
+    if (timeout < std::chrono::nanoseconds(0))
+        timeout = std::chrono::nanoseconds(0);
+
+    // with statistics a non-blocking attempt first tells contended locks apart
+    const bool statistics = d->statisticsEnabled();
+    int status = d->acquireLock(statistics ? std::chrono::nanoseconds(0) : timeout);
+    std::chrono::steady_clock::time_point waitStart;
+    if (statistics && status == ETIMEDOUT && timeout != std::chrono::nanoseconds(0)) {
+        waitStart = std::chrono::steady_clock::now();
+        status = d->acquireLock(timeout);
+    }
+
+    if (status == 0 || status == EOWNERDEAD) {
+        const bool ownerDied = status == EOWNERDEAD;
+        QSharedMemoryLockState &state = d->lockState();
+        state.lockedByMe = true;
+        state.ownerDied = ownerDied;
+        d->holdLocks(1);
+        if (statistics)
+            d->recordAcquire(state, waitStart);
+        d->checkGeneration();
+        if (ownerDied) {
+            // The data may have been left half written. A segment that the
+            // handler can't repair is left unrecoverable for every process.
+            if (d->consistencyHandler && !d->consistencyHandler(this)) {
+                state.lockedByMe = false;
+                state.lockedAt = std::chrono::steady_clock::time_point();
+                d->dropLockState();
+                d->holdLocks(-1);
+                d->robustUnlock();
+                d->setLockError(QSharedMemory::LockError,
+                                function + ": the previous owner died, the segment can't be recovered");
+                return false;
+            }
+            d->robustMarkConsistent();
+        }
         return true;
     }
-    std::string function = "QSharedMemory::lock";
-    d->errorString = function + ": unable to lock";
-    d->error = QSharedMemory::LockError;
+    d->dropLockState();
+    if (status == ETIMEDOUT) {
+        if (statistics)
+            d->header->statistics.timeouts.fetch_add(1, std::memory_order_relaxed);
+        d->setLockError(QSharedMemory::LockTimeout, function + ": timed out");
+    } else {
+        d->setLockError(QSharedMemory::LockError,
+                        function + (status == ENOTRECOVERABLE ? ": the lock is not recoverable"
+                                                              : ": unable to lock"));
+    }
     return false;
 }
 
+/*!
+  Locks the shared memory segment if it is not locked by another process
+  and returns \c true, without blocking. Otherwise returns \c false with
+  the error LockTimeout.
+
+  \sa lock(), unlock()
+ */
+bool QSharedMemory::tryLock()
+{
+    return lock(std::chrono::nanoseconds(0));
+}
+
+/*!
+  Locks the segment for reading and returns \c true. With the
+  ReadWriteLock mode any number of processes can hold the read lock at the
+  same time, while lockForWrite() waits for all of them. With the other
+  lock modes this is the same as lock().
+
+  \sa lockForWrite(), unlockForRead(), QSharedMemoryReadLocker
+ */
+bool QSharedMemory::lockForRead()
+{
+    return lockForRead(std::chrono::nanoseconds::max());
+}
+
+/*!
+  \overload lockForRead()
+
+  Waits at most \a timeout for the read lock. If no writer released the
+  segment in time, \c false is returned and error() is LockTimeout.
+ */
+bool QSharedMemory::lockForRead(std::chrono::nanoseconds timeout)
+{
+    if (d->lockMode != ReadWriteLock)
+        return lock(timeout);
+    if (d->lockState().lockedByMe) {
+        // a write lock covers reading too
+        if (d->lockOwnership == RecursiveThreadOwnership) {
+            ++d->lockState().recursion;
+            return true;
+        }
+        std::cout << "Warning: QSharedMemory::lockForRead: already locked" << std::endl;
+        return true;
+    }
+    std::string function = "QSharedMemory::lockForRead";
+    if (!d->header) {
+        d->setLockError(QSharedMemory::LockError, function + ": not attached");
+        d->dropLockState();
+        return false;
+    }
+    if (timeout < std::chrono::nanoseconds(0))
+        timeout = std::chrono::nanoseconds(0);
+
+    const bool statistics = d->statisticsEnabled();
+    bool locked = d->rwLockForRead(statistics ? std::chrono::nanoseconds(0) : timeout);
+    std::chrono::steady_clock::time_point waitStart;
+    if (statistics && !locked && timeout != std::chrono::nanoseconds(0)) {
+        waitStart = std::chrono::steady_clock::now();
+        locked = d->rwLockForRead(timeout);
+    }
+    if (!locked) {
+        if (statistics)
+            d->header->statistics.timeouts.fetch_add(1, std::memory_order_relaxed);
+        d->setLockError(QSharedMemory::LockTimeout, function + ": timed out");
+        d->dropLockState();
+        return false;
+    }
+    QSharedMemoryLockState &state = d->lockState();
+    state.lockedByMe = true;
+    state.lockedForRead = true;
+    d->holdLocks(1);
+    if (statistics)
+        d->recordAcquire(state, waitStart);
+    d->checkGeneration();
+    return true;
+}
+
+/*!
+  Locks the segment for writing and returns \c true. This is the same as
+  lock(). A read lock held through this instance can't be upgraded: the
+  call fails with LockError instead of waiting for itself.
+
+  \sa lockForRead(), unlockForWrite(), QSharedMemoryWriteLocker
+ */
+bool QSharedMemory::lockForWrite()
+{
+    return lock();
+}
+
+/*!
+  \overload lockForWrite()
+
+  Waits at most \a timeout for the write lock, see lock().
+ */
+bool QSharedMemory::lockForWrite(std::chrono::nanoseconds timeout)
+{
+    return lock(timeout);
+}
+
+/*!
+  Releases a lock taken with lockForRead(). Returns \c false if this
+  instance holds no lock or holds the write lock.
+
+  \sa lockForRead()
+ */
+bool QSharedMemory::unlockForRead()
+{
+    const QSharedMemoryLockState &state = d->lockState();
+    if (d->lockMode == ReadWriteLock && state.lockedByMe && !state.lockedForRead && !state.recursion)
+        return false;
+    return unlock();
+}
+
+/*!
+  Releases a lock taken with lockForWrite() or lock(). Returns \c false if
+  this instance holds no lock or holds a read lock.
+
+  \sa lockForWrite()
+ */
+bool QSharedMemory::unlockForWrite()
+{
+    if (d->lockState().lockedForRead)
+        return false;
+    return unlock();
+}
+
+/*!
+  Sets whether waiting writers take precedence over new readers of a
+  ReadWriteLock segment. When \a enabled, the default, lockForRead() waits
+  while a writer is waiting, so a continuous stream of readers can't
+  starve a writer; a process must then not take the read lock twice
+  through different instances. When disabled, readers only wait for a
+  writer holding the lock, which maximizes read throughput.
+
+  The preference is stored in the segment header: it is applied by
+  create() and, if the segment is attached, right away for all processes.
+
+  \sa writerPreference(), lockForRead()
+ */
+void QSharedMemory::setWriterPreference(bool enabled)
+{
+    d->preferWriters = enabled;
+    if (d->header && d->lockMode == ReadWriteLock)
+        d->header->rwPreferWriters.store(enabled, std::memory_order_relaxed);
+}
+
+/*!
+  Returns \c true if the last lock() of a RobustLock segment found that
+  the previous owner of the lock died without unlocking it. The lock is
+  held and the segment was marked consistent again, but its contents may
+  be half updated: check or repair them before relying on them.
+
+  \sa setConsistencyHandler()
+ */
+bool QSharedMemory::lockOwnerDied() const
+{
+    const QSharedMemoryLockState *state = d->findLockState();
+    return state && state->ownerDied;
+}
+
+/*!
+  Sets the \a handler lock() runs when it takes over the lock of a
+  RobustLock segment from a process that died holding it. The handler is
+  called with the lock held and checks or repairs the data. If it returns
+  \c false, the segment is marked unrecoverable: lock() fails with
+  LockError in this and every other process until the segment is created
+  again.
+
+  \sa lockOwnerDied()
+ */
+void QSharedMemory::setConsistencyHandler(std::function<bool(QSharedMemory *)> handler)
+{
+    d->consistencyHandler = std::move(handler);
+}
+
+/*!
+  Returns \c true if waiting writers take precedence over new readers.
+
+  \sa setWriterPreference()
+ */
+bool QSharedMemory::writerPreference() const
+{
+    if (d->header && d->lockMode == ReadWriteLock)
+        return d->header->rwPreferWriters.load(std::memory_order_relaxed) != 0;
+    return d->preferWriters;
+}
+
 /*!
   Releases the lock on the shared memory segment and returns \c true, if
   the lock is currently held by this process. If the segment is not
@@ -485,44 +1653,1150 @@ bool QSharedMemory::lock()
  */
 bool QSharedMemory::unlock()
 {
-    if (!d->lockedByMe)
+    QSharedMemoryLockState &state = d->lockState();
+    if (!state.lockedByMe) {
+        d->dropLockState();
         return false;
-    d->lockedByMe = false;
-    if (d->systemSemaphore.release())
+    }
+    if (state.recursion > 0) {
+        --state.recursion;
+        return true;
+    }
+    const bool read = state.lockedForRead;
+    d->recordRelease(state);
+    state.lockedByMe = false;
+    state.lockedForRead = false;
+    d->dropLockState();
+    d->holdLocks(-1);
+
+    if (d->header && d->lockMode == ReadWriteLock) {
+        d->rwUnlock(read);
+        return true;
+    }
+    if (!d->header) {
+        if (d->systemSemaphore.release())
+            return true;
+    } else if (d->lockMode != RobustLock) {
+        d->futexUnlock(d->header->lockWord);
         return true;
+    } else if (d->robustUnlock()) {
+        return true;
+    }
     std::string function = "QSharedMemory::unlock";
-    d->errorString = function + ": unable to unlock";
-    d->error = QSharedMemory::LockError;
+    d->setLockError(QSharedMemory::LockError, function + ": unable to unlock");
     return false;
 }
 
 /*!
-  \enum QSharedMemory::SharedMemoryError
-
-  \value NoError No error occurred.
+  Locks the \a length bytes of data starting at \a offset and returns
+  \c true. Writers to ranges that hash to different stripes, see
+  setLockStripes(), don't wait for each other, so processes updating
+  independent records of one segment run in parallel.
+
+  A range spanning several stripes takes them in a fixed order, which
+  rules out deadlocks between ranges. Range locks are independent of
+  lock(): a process holding the segment lock must still lock the ranges
+  it shares with range lockers. Like lock(), they are owned by the
+  instance, or with ThreadOwnership by the calling thread, see
+  setLockOwnership(); unlockRange() must be called by the owner with the
+  same range. An owner may lock ranges that share stripes with ranges it
+  already holds: it only waits for the stripes it doesn't hold yet, and a
+  shared stripe stays locked until the last of its ranges is unlocked.
+
+  Range locks need a segment header, so the lockMode() must not be
+  SystemSemaphoreLock.
+
+  \sa unlockRange(), QSharedMemoryRangeLocker
+ */
+bool QSharedMemory::lockRange(qint64 offset, qint64 length)
+{
+    return lockRange(offset, length, std::chrono::nanoseconds::max());
+}
 
-  \value PermissionDenied The operation failed because the caller
-  didn't have the required permissions.
+/*!
+  \overload lockRange()
 
-  \value InvalidSize A create operation failed because the requested
-  size was invalid.
+  Waits at most \a timeout for the range. If it can't be locked in time,
+  none of its stripes are held, \c false is returned and error() is
+  LockTimeout.
+ */
+bool QSharedMemory::lockRange(qint64 offset, qint64 length, std::chrono::nanoseconds timeout)
+{
+    const std::string function = "QSharedMemory::lockRange";
+    const uint64_t mask = d->stripeMask(offset, length, function);
+    if (!mask)
+        return false;
+    if (timeout < std::chrono::nanoseconds(0))
+        timeout = std::chrono::nanoseconds(0);
+
+    // stripes the owner holds for other ranges are counted, not taken again
+    const QSharedMemoryLockState *held = d->findLockState();
+    const uint64_t needed = held ? mask & ~held->stripesHeld : mask;
+    const auto start = std::chrono::steady_clock::now();
+    for (uint64_t taken = 0, left = needed; left; left &= left - 1) {
+        const int stripe = __builtin_ctzll(left);
+        std::chrono::nanoseconds remaining = timeout;
+        if (timeout != std::chrono::nanoseconds::max() && timeout != std::chrono::nanoseconds(0))
+            remaining = std::max(timeout - (std::chrono::steady_clock::now() - start),
+                                 std::chrono::nanoseconds(0));
+        if (!d->futexLock(d->header->stripes[stripe].word, remaining)) {
+            for (; taken; taken &= taken - 1)
+                d->futexUnlock(d->header->stripes[__builtin_ctzll(taken)].word);
+            d->setLockError(QSharedMemory::LockTimeout, function + ": timed out");
+            return false;
+        }
+        taken |= uint64_t(1) << stripe;
+    }
+    QSharedMemoryLockState &state = d->lockState();
+    state.stripesHeld |= mask;
+    state.stripeRefs.resize(QSharedMemoryHeader::MaxLockStripes);
+    for (uint64_t left = mask; left; left &= left - 1)
+        ++state.stripeRefs[__builtin_ctzll(left)];
+    d->checkGeneration();
+    d->holdLocks(__builtin_popcountll(needed));
+    return true;
+}
 
-  \value KeyError The operation failed because of an invalid key.
+/*!
+  Unlocks the range locked with lockRange(\a offset, \a length) and
+  returns \c true. Returns \c false and sets the error to LockError if
+  the range is not valid or the caller doesn't hold all of its stripes,
+  which are then left alone. Stripes still used by other ranges of the
+  caller stay locked.
 
-  \value AlreadyExists A create() operation failed because a shared
-  memory segment with the specified key already existed.
+  \sa lockRange()
+ */
+bool QSharedMemory::unlockRange(qint64 offset, qint64 length)
+{
+    const std::string function = "QSharedMemory::unlockRange";
+    const uint64_t mask = d->stripeMask(offset, length, function);
+    if (!mask)
+        return false;
+    const QSharedMemoryLockState *state = d->findLockState();
+    if (!state || (state->stripesHeld & mask) != mask) {
+        d->setLockError(QSharedMemory::LockError, function + ": range is not locked by the caller");
+        return false;
+    }
+    QSharedMemoryLockState &held = d->lockState();
+    uint64_t released = 0;
+    for (uint64_t left = mask; left; left &= left - 1) {
+        const int stripe = __builtin_ctzll(left);
+        if (--held.stripeRefs[stripe] == 0)
+            released |= uint64_t(1) << stripe;
+    }
+    held.stripesHeld &= ~released;
+    for (uint64_t left = released; left; left &= left - 1)
+        d->futexUnlock(d->header->stripes[__builtin_ctzll(left)].word);
+    d->holdLocks(-__builtin_popcountll(released));
+    d->dropLockState();
+    return true;
+}
 
-  \value NotFound An attach() failed because a shared memory segment
-  with the specified key could not be found.
+/*!
+  Tells the processes waiting in waitForChange() that the segment changed
+  and returns the new change generation. Call it after publishing, for
+  example after unlock() or endWrite(). Without waiters it costs one
+  atomic increment; otherwise it wakes all of them with a single
+  FUTEX_WAKE.
 
-  \value LockError The attempt to lock() the shared memory segment
-  failed because create() or attach() failed and returned false, or
-  because a system error occurred in QSystemSemaphore::acquire().
+  Notifications need a segment header, so the lockMode() must not be
+  SystemSemaphoreLock. Returns 0 if the segment has none.
 
-  \value OutOfResources A create() operation failed because there was
-  not enough memory available to fill the request.
+  \sa waitForChange(), changeGeneration()
+ */
+quint32 QSharedMemory::notify()
+{
+    if (!d->header) {
+        d->setLockError(QSharedMemory::LockError, "QSharedMemory::notify: segment has no lock header");
+        return 0;
+    }
+    const uint32_t generation = d->header->changeGeneration.fetch_add(1) + 1;
+    if (d->header->changeWaiters.load())
+        QtFutex::futexWakeAll(d->header->changeGeneration);
+    return generation;
+}
+
+/*!
+  Returns the change generation of the segment: the number of notify()
+  calls, wrapping around at 2^32.
+
+  \sa notify(), waitForChange()
+ */
+quint32 QSharedMemory::changeGeneration() const
+{
+    return d->header ? d->header->changeGeneration.load(std::memory_order_acquire) : 0;
+}
+
+/*!
+  Waits until the change generation differs from \a lastSeenGeneration,
+  or for at most \a timeout, and returns \c true if it does. Returns
+  right away if a notify() came since the caller read
+  \a lastSeenGeneration, so no notification is missed:
+
+  \code
+  quint32 seen = sm.changeGeneration();
+  for (;;) {
+      // consume the data, then sleep until the producer publishes more
+      sm.waitForChange(seen);
+      seen = sm.changeGeneration();
+  }
+  \endcode
+
+  The wait is a futex wait: it takes no CPU time and returns within a
+  wakeup latency of the notify(). On timeout \c false is returned and
+  error() is LockTimeout.
+
+  \sa notify()
+ */
+bool QSharedMemory::waitForChange(quint32 lastSeenGeneration, std::chrono::nanoseconds timeout)
+{
+    const std::string function = "QSharedMemory::waitForChange";
+    if (!d->header) {
+        d->setLockError(QSharedMemory::LockError, function + ": segment has no lock header");
+        return false;
+    }
+    if (d->waitForChange(lastSeenGeneration, timeout))
+        return true;
+    d->setLockError(QSharedMemory::LockTimeout, function + ": timed out");
+    return false;
+}
+
+/*!
+  Returns a file descriptor that becomes readable when notify() is called
+  on the segment, for event loops that poll descriptors and can't block
+  in waitForChange(). Returns -1 if the segment has no lock header or on
+  platforms other than Linux.
+
+  The descriptor is an eventfd in non-blocking mode. A helper thread,
+  started by the first call, sleeps on the change generation and adds to
+  it the number of notifications since its last wakeup, so a burst of
+  notify() calls costs the event loop one wakeup. Read it with
+  drainNotifications(). The descriptor belongs to this instance and is
+  closed by detach().
+
+  \sa drainNotifications(), waitForChange()
+ */
+int QSharedMemory::notificationDescriptor()
+{
+    if (!d->header) {
+        d->setLockError(QSharedMemory::LockError,
+                        "QSharedMemory::notificationDescriptor: segment has no lock header");
+        return -1;
+    }
+    return d->startChangeWatcher() ? d->changeEventFd : -1;
+}
+
+/*!
+  Resets the notificationDescriptor() and returns the number of notify()
+  calls it counted since the last drain, or 0 if there were none. It
+  never blocks.
+
+  \sa notificationDescriptor()
+ */
+quint64 QSharedMemory::drainNotifications()
+{
+    return d->changeEventFd == -1 ? 0 : d->drainChangeDescriptor();
+}
+
+/*!
+  Starts an update of a SeqLock segment and returns \c true. The segment
+  is locked, see lock(), and readers retry any copy that overlaps the
+  update until endWrite() is called.
+
+  \sa endWrite(), read()
+ */
+bool QSharedMemory::beginWrite()
+{
+    std::string function = "QSharedMemory::beginWrite";
+    if (d->lockMode != SeqLock || !d->header) {
+        d->setLockError(QSharedMemory::LockError,
+                        function + (d->header ? ": segment doesn't use SeqLock" : ": not attached"));
+        return false;
+    }
+    if (d->accessMode == ReadOnly) {
+        d->setLockError(QSharedMemory::PermissionDenied, function + ": segment is attached read only");
+        return false;
+    }
+    if (d->lockState().writing) {
+        std::cout << "Warning: QSharedMemory::beginWrite: already writing" << std::endl;
+        return true;
+    }
+    if (!lock())
+        return false;
+
+    // the odd sequence must be visible before any store to the data
+    d->header->sequence.fetch_add(1, std::memory_order_relaxed);
+    std::atomic_thread_fence(std::memory_order_release);
+    d->lockState().writing = true;
+    return true;
+}
+
+/*!
+  Publishes the update started with beginWrite() and unlocks the segment.
+  Returns \c false if no update was in progress.
+
+  \sa beginWrite()
+ */
+bool QSharedMemory::endWrite()
+{
+    QSharedMemoryLockState &state = d->lockState();
+    if (!state.writing) {
+        d->dropLockState();
+        return false;
+    }
+    state.writing = false;
+    d->header->sequence.fetch_add(1, std::memory_order_release);
+    return unlock();
+}
+
+/*!
+  Calls \a reader with the data and the size of a SeqLock segment, without
+  locking it, until the call did not overlap an update. Returns \c false
+  if the segment is not attached or doesn't use SeqLock.
+
+  \a reader can be called with data that is being written: it should only
+  copy it out, and must not act on the copy before read() returns.
+
+  If no consistent snapshot could be taken within \a timeout, \c false is
+  returned and error() is LockTimeout. This happens when a writer died
+  between beginWrite() and endWrite(), which leaves the update open for
+  good; the default timeout waits forever.
+
+  \sa readInto(), beginWrite()
+ */
+bool QSharedMemory::read(const std::function<void(const void *data, qint64 size)> &reader,
+                         std::chrono::nanoseconds timeout) const
+{
+    std::string function = "QSharedMemory::read";
+    if (d->lockMode != SeqLock || !d->header) {
+        d->setLockError(QSharedMemory::LockError,
+                        function + (d->header ? ": segment doesn't use SeqLock" : ": not attached"));
+        return false;
+    }
+
+    const std::atomic<uint32_t> &sequence = d->header->sequence;
+    // the clock is only read once a first attempt failed
+    std::chrono::steady_clock::time_point deadline;
+    bool retrying = false;
+    for (;;) {
+        const uint32_t before = sequence.load(std::memory_order_acquire);
+        if (!(before & 1)) {
+            d->checkGeneration();
+            reader(static_cast<const char *>(d->memory) + d->headerSize, d->size - d->headerSize);
+            std::atomic_thread_fence(std::memory_order_acquire);
+            if (sequence.load(std::memory_order_relaxed) == before)
+                return true;
+        }
+
+        if (!retrying) {
+            deadline = futexDeadline(std::max(timeout, std::chrono::nanoseconds(0)));
+            retrying = true;
+        }
+        if (std::chrono::steady_clock::now() >= deadline) {
+            d->setLockError(QSharedMemory::LockTimeout, function + ": timed out");
+            return false;
+        }
+        // the writer only holds the sequence for a copy, don't sleep
+        if (before & 1)
+            std::this_thread::yield();
+    }
+}
+
+/*!
+  Copies a consistent snapshot of at most \a maxSize bytes of the data of
+  a SeqLock segment to \a buffer and returns the number of bytes copied,
+  or -1 on error. Gives up after \a timeout like read().
+
+  \sa read()
+ */
+qint64 QSharedMemory::readInto(void *buffer, qint64 maxSize, std::chrono::nanoseconds timeout) const
+{
+    qint64 copied = -1;
+    const bool ok = read([buffer, maxSize, &copied](const void *data, qint64 size) {
+        copied = std::min(size, std::max(maxSize, qint64(0)));
+        memcpy(buffer, data, size_t(copied));
+    }, timeout);
+    return ok ? copied : -1;
+}
+
+/*!
+    \internal
+
+    Size of the header in front of the data, a multiple of the page size so
+    that the data of a ReadOnly attachment can be protected separately.
+  */
+int QSharedMemoryPrivate::segmentHeaderSize()
+{
+    const int page = pageSize();
+    return int((sizeof(QSharedMemoryHeader) + page - 1) / page) * page;
+}
+
+/*!
+    \internal
+
+    Returns the hugetlb page size selected by the mapping \a options, or 0
+    if the segment uses normal (possibly transparent huge) pages.
+  */
+size_t QSharedMemoryPrivate::hugePageSize(int options)
+{
+    if (options & QSharedMemory::HugePages1G)
+        return size_t(1) << 30;
+    if (options & QSharedMemory::HugePages)
+        return size_t(1) << 21;
+    return 0;
+}
+
+/*!
+    \internal
+
+    Returns the granularity the segment size is rounded up to.
+  */
+size_t QSharedMemoryPrivate::segmentAlignment(int options)
+{
+    if (const size_t size = hugePageSize(options))
+        return size;
+    if (options & QSharedMemory::TransparentHugePages)
+        return size_t(1) << 21;
+    return 1;
+}
+
+/*!
+    \internal
+
+    Returns the number of bytes to allocate for \a size bytes of data: the
+    segment header if the lock mode needs one, rounded up to the huge page
+    size if huge pages are used. Returns 0 and sets the error if \a size is
+    invalid.
+  */
+qint64 QSharedMemoryPrivate::segmentSize(qint64 size, const std::string &function)
+{
+    if (size <= 0) {
+        error = QSharedMemory::InvalidSize;
+        errorString = function + ": create size is less then 0";
+        return 0;
+    }
+
+    // the whole segment has to be addressable by size_t and off_t
+    const qint64 headerSize = lockMode == QSharedMemory::SystemSemaphoreLock ? 0 : segmentHeaderSize();
+    const qint64 alignment = qint64(segmentAlignment(attachedOptions));
+    const qint64 limit = qint64(std::min<quint64>(std::numeric_limits<size_t>::max() >> 1,
+                                                  quint64(std::numeric_limits<qint64>::max())));
+    if (size > limit - headerSize - alignment) {
+        error = QSharedMemory::InvalidSize;
+        errorString = function + ": create size is too large";
+        return 0;
+    }
+    return (headerSize + size + alignment - 1) / alignment * alignment;
+}
+
+/*!
+    \internal
+
+    Completes create() (\a created is true) or attach() once the backend has
+    mapped the segment: applies the mapping options, then sets up or checks
+    the segment header with the requested access \a mode.
+  */
+bool QSharedMemoryPrivate::setupMapping(QSharedMemory::AccessMode mode, bool created)
+{
+    // A copy-on-write attachment keeps the header and its lock shared, only
+    // the data is mapped privately. The memory policy has to be in place
+    // before the header is written or Prefault touches the pages.
+    const bool privateData = mode == QSharedMemory::CopyOnWrite
+            && lockMode != QSharedMemory::SystemSemaphoreLock;
+    if (((attachedOptions & QSharedMemory::FixedAddress) && !mapFixed(created))
+            || (privateData && !mapPrivate(segmentHeaderSize()))
+            || !applyNumaPolicy(false) || !applyMappingOptions(mode)) {
+        const QSharedMemory::SharedMemoryError e = error;
+        const std::string s = errorString;
+        detachSegment();
+        error = e;
+        errorString = s;
+        return false;
+    }
+
+    accessMode = mode;
+    if (lockMode != QSharedMemory::SystemSemaphoreLock
+            && !(created ? initHeader(mode) : checkHeader(mode)))
+        return false;
+
+    return setupReplicas(mode, created);
+}
+
+/*!
+    \internal
+
+    Moves the mapping of a FixedAddress segment: the creator maps it at the
+    requested base address, if any, and attachments at the address recorded
+    in the header by the creator. Runs before anything else touches the
+    mapping, a header that doesn't validate is left to checkHeader().
+  */
+bool QSharedMemoryPrivate::mapFixed(bool created)
+{
+    if (lockMode == QSharedMemory::SystemSemaphoreLock) {
+        error = QSharedMemory::UnknownError;
+        errorString = std::string(created ? "QSharedMemory::create" : "QSharedMemory::attach")
+                + ": FixedAddress needs a lock mode with a segment header";
+        return false;
+    }
+
+    void *address = requestedAddress;
+    if (!created) {
+        const auto *h = static_cast<const QSharedMemoryHeader *>(memory);
+        if (size < qint64(sizeof(QSharedMemoryHeader)) || h->magic != QSharedMemoryHeader::Magic
+                || h->version != QSharedMemoryHeader::Version)
+            return true;
+        address = reinterpret_cast<void *>(uintptr_t(h->baseAddress));
+    }
+    return !address || address == memory || moveMapping(address);
+}
+
+/*!
+    \internal
+
+    Creates (\a created is true) or attaches the per node replicas of a
+    keyed segment when replicas are enabled. Each replica is a segment of
+    its own, bound to its node. Writers map all of them to keep them up to
+    date, ReadOnly and CopyOnWrite attachments only map the replica of the
+    local node. Replicas missing on attach are skipped, data() then stays
+    on the primary segment.
+  */
+bool QSharedMemoryPrivate::setupReplicas(QSharedMemory::AccessMode mode, bool created)
+{
+    if (!numaReplicas || key.empty())
+        return true;
+
+    const qint64 dataSize = size - headerSize;
+    const int localNode = currentNumaNode();
+    for (int node : numaNodes()) {
+        if (mode != QSharedMemory::ReadWrite && node != localNode)
+            continue;
+
+        std::unique_ptr<QSharedMemory> replica(new QSharedMemory(key + ":numa" + std::to_string(node)));
+        replica->setMappingOptions(attachedOptions & ~QSharedMemory::FixedAddress);
+        replica->setNumaPolicy(QSharedMemory::NumaBind, std::vector<int>(1, node));
+        if (created ? !replica->create(dataSize) : !replica->attach(mode)) {
+            if (!created)
+                continue;
+            const QSharedMemory::SharedMemoryError e = replica->error();
+            const std::string s = replica->errorString();
+            clearReplicas();
+            detachSegment();
+            header = nullptr;
+            headerSize = 0;
+            error = e;
+            errorString = s;
+            return false;
+        }
+
+        if (mode != QSharedMemory::ReadWrite) {
+            readReplica = replica.get();
+            readReplicaNode = node;
+        }
+        replicas.push_back(std::move(replica));
+    }
+    if (created && header)
+        header->replicated = 1;
+    return true;
+}
+
+void QSharedMemoryPrivate::clearReplicas()
+{
+    readReplica = nullptr;
+    readReplicaNode = -1;
+    replicas.clear();
+}
+
+/*!
+    \internal
+
+    Initializes the header of a segment just created and attached, the
+    caller holds the key lock so no other process can see it half done.
+  */
+bool QSharedMemoryPrivate::initHeader(QSharedMemory::AccessMode mode)
+{
+    header = new (memory) QSharedMemoryHeader;
+    header->magic = QSharedMemoryHeader::Magic;
+    header->version = QSharedMemoryHeader::Version;
+    header->headerSize = uint32_t(segmentHeaderSize());
+    header->lockMode = uint32_t(lockMode);
+    header->generation.store(0, std::memory_order_relaxed);
+    header->segmentSize.store(uint64_t(size), std::memory_order_relaxed);
+    header->baseAddress = uint64_t(reinterpret_cast<uintptr_t>(memory));
+    header->statistics.enabled.store(collectStatistics, std::memory_order_relaxed);
+    header->stripeCount = uint32_t(stripeCount);
+    header->stripeSize = uint64_t(stripeSize);
+    header->replicated = 0;
+    header->rwPreferWriters.store(preferWriters, std::memory_order_relaxed);
+    header->changeGeneration.store(0, std::memory_order_relaxed);
+    headerSize = int(header->headerSize);
+    generation = 0;
+
+    if (!resetLockState()) {
+        const QSharedMemory::SharedMemoryError e = error;
+        const std::string s = errorString;
+        detachSegment();
+        header = nullptr;
+        headerSize = 0;
+        error = e;
+        errorString = s;
+        return false;
+    }
+
+    return mode == QSharedMemory::ReadWrite || checkHeader(mode);
+}
+
+/*!
+    \internal
+
+    Clears the lock and waiter words of the header and the lock statistics,
+    and sets up the robust mutex again. Used for a new header, and for a
+    file-backed segment attached while no other process uses it: a lock
+    held by a process that is gone would never be released otherwise.
+  */
+bool QSharedMemoryPrivate::resetLockState()
+{
+    QSharedMemoryHeader::LockStatistics &stats = header->statistics;
+    stats.lastHolderPid.store(0, std::memory_order_relaxed);
+    stats.acquires.store(0, std::memory_order_relaxed);
+    stats.contendedAcquires.store(0, std::memory_order_relaxed);
+    stats.timeouts.store(0, std::memory_order_relaxed);
+    stats.totalWaitTime.store(0, std::memory_order_relaxed);
+    stats.totalHoldTime.store(0, std::memory_order_relaxed);
+    for (uint32_t i = 0; i < QSharedMemoryHeader::StatisticsBuckets; ++i) {
+        stats.waitHistogram[i].store(0, std::memory_order_relaxed);
+        stats.holdHistogram[i].store(0, std::memory_order_relaxed);
+    }
+    for (QSharedMemoryHeader::LockStripe &stripe : header->stripes)
+        stripe.word.store(0, std::memory_order_relaxed);
+    header->lockWord.store(0, std::memory_order_relaxed);
+    header->rwState.store(0, std::memory_order_relaxed);
+    header->rwWritersWaiting.store(0, std::memory_order_relaxed);
+    header->rwWakeSequence.store(0, std::memory_order_relaxed);
+    header->rwSleepers.store(0, std::memory_order_relaxed);
+    header->sequence.store(0, std::memory_order_relaxed);
+    header->changeWaiters.store(0, std::memory_order_release);
+
+    return lockMode != QSharedMemory::RobustLock || initRobustLock();
+}
+
+/*!
+    \internal
+
+    Validates the header of a segment mapped by attach() and applies the
+    access \a mode to the data part.
+  */
+bool QSharedMemoryPrivate::checkHeader(QSharedMemory::AccessMode mode)
+{
+    const std::string function = "QSharedMemory::attach";
+    auto *h = static_cast<QSharedMemoryHeader *>(memory);
+    if (size < qint64(sizeof(QSharedMemoryHeader)) || h->magic != QSharedMemoryHeader::Magic
+            || h->version != QSharedMemoryHeader::Version || qint64(h->headerSize) > size) {
+        detachSegment();
+        error = QSharedMemory::KeyError;
+        errorString = function + ": segment has no compatible lock header";
+        return false;
+    }
+    if (h->lockMode != uint32_t(lockMode)) {
+        detachSegment();
+        error = QSharedMemory::KeyError;
+        errorString = function + ": segment uses a different lock mode";
+        return false;
+    }
+
+    header = h;
+    headerSize = int(h->headerSize);
+    generation = h->generation.load(std::memory_order_acquire);
+    // hugetlb mappings can only be protected in huge page units
+    if (mode == QSharedMemory::ReadOnly && size > headerSize && !hugePageSize(attachedOptions)
+            && !protect(static_cast<char *>(memory) + headerSize, size_t(size - headerSize))) {
+        detachSegment();
+        header = nullptr;
+        headerSize = 0;
+        return false;
+    }
+    return true;
+}
+
+/*!
+    \internal
+
+    Follows a resize() done through another attachment: maps the segment
+    with the size recorded in the header. On failure the old mapping stays
+    valid, since segments only grow.
+
+    The mapping may move. While other threads sharing the instance hold a
+    lock on it, they may use pointers into it, so the remap is put off
+    until they released their locks; the old mapping is still valid.
+  */
+bool QSharedMemoryPrivate::remap()
+{
+    // threads sharing the instance must not move the mapping twice
+    std::unique_lock<std::mutex> guard(threadMutex, std::defer_lock);
+    if (lockOwnership != QSharedMemory::ProcessOwnership)
+        guard.lock();
+    const uint32_t current = header->generation.load(std::memory_order_acquire);
+    if (current == generation)
+        return true;
+    if (lockOwnership != QSharedMemory::ProcessOwnership
+            && heldLocks > (lockState().lockedByMe ? 1 : 0))
+        return true;
+    const qint64 newSize = qint64(header->segmentSize.load(std::memory_order_relaxed));
+    if (newSize > size) {
+        // the change watcher sleeps on a word in the header, which may move
+        const bool watching = stopChangeWatcher();
+        const bool remapped = remapSegment(newSize, "QSharedMemory::remap");
+        if (watching)
+            startChangeWatcher();
+        if (!remapped)
+            return false;
+        // replicas don't grow with the segment, data() falls back to it
+        for (const auto &replica : replicas) {
+            if (replica->size() < size - headerSize) {
+                clearReplicas();
+                break;
+            }
+        }
+    }
+    generation = current;
+    return true;
+}
+
+/*!
+    \internal
+
+    Returns a new id for an instance, never 0.
+  */
+quint64 QSharedMemoryPrivate::newInstanceId()
+{
+    static std::atomic<quint64> lastId(0);
+    return lastId.fetch_add(1, std::memory_order_relaxed) + 1;
+}
+
+/*!
+    \internal
+
+    The lock states of the instances the calling thread used, keyed by the
+    instanceId. An entry only lives while the thread holds the lock or a
+    range, and one left behind by a destroyed instance never applies to a
+    new one.
+  */
+static std::unordered_map<quint64, QSharedMemoryLockState> &threadLockStates()
+{
+    static thread_local std::unordered_map<quint64, QSharedMemoryLockState> states;
+    return states;
+}
+
+/*!
+    \internal
+
+    Returns what the lock holder took: the calling thread with
+    ThreadOwnership, the instance otherwise.
+  */
+QSharedMemoryLockState &QSharedMemoryPrivate::lockState()
+{
+    if (lockOwnership == QSharedMemory::ProcessOwnership)
+        return processLockState;
+    return threadLockStates()[instanceId];
+}
+
+/*!
+    \internal
+
+    Returns the lock state of the lock holder like lockState(), or null if
+    the calling thread has none; unlike lockState() it never adds one.
+  */
+const QSharedMemoryLockState *QSharedMemoryPrivate::findLockState() const
+{
+    if (lockOwnership == QSharedMemory::ProcessOwnership)
+        return &processLockState;
+    const auto &states = threadLockStates();
+    const auto it = states.find(instanceId);
+    return it != states.end() ? &it->second : nullptr;
+}
+
+/*!
+    \internal
+
+    Forgets the lock state of the calling thread once it holds no lock or
+    range, so the entry doesn't outlive the instance.
+  */
+void QSharedMemoryPrivate::dropLockState()
+{
+    if (lockOwnership == QSharedMemory::ProcessOwnership)
+        return;
+    auto &states = threadLockStates();
+    const auto it = states.find(instanceId);
+    if (it != states.end() && !it->second.lockedByMe && !it->second.stripesHeld)
+        states.erase(it);
+}
+
+/*!
+    \internal
+
+    Counts \a count more (or fewer, if negative) locks held by threads
+    sharing the instance, which keep remap() from moving the mapping.
+  */
+void QSharedMemoryPrivate::holdLocks(int count)
+{
+    if (lockOwnership == QSharedMemory::ProcessOwnership)
+        return;
+    std::lock_guard<std::mutex> guard(threadMutex);
+    heldLocks += count;
+}
+
+void QSharedMemoryPrivate::setLockError(QSharedMemory::SharedMemoryError e, const std::string &message)
+{
+    std::unique_lock<std::mutex> guard(threadMutex, std::defer_lock);
+    if (lockOwnership != QSharedMemory::ProcessOwnership)
+        guard.lock();
+    error = e;
+    errorString = message;
+}
+
+/*!
+    \internal
+
+    Returns the set of stripes guarding the \a length bytes at \a offset
+    as a bit mask, or 0 after setting the error if the range can't be
+    locked. Chunks are spread over the stripes by Fibonacci hashing.
+  */
+uint64_t QSharedMemoryPrivate::stripeMask(qint64 offset, qint64 length, const std::string &function)
+{
+    if (!header) {
+        setLockError(QSharedMemory::LockError, function + (memory ? ": segment has no lock header"
+                                                                   : ": not attached"));
+        return 0;
+    }
+    checkGeneration();
+    if (offset < 0 || length <= 0 || offset > size - headerSize - length) {
+        setLockError(QSharedMemory::LockError, function + ": range is out of bounds");
+        return 0;
+    }
+
+    const uint32_t count = header->stripeCount;
+    const uint64_t chunkSize = header->stripeSize;
+    const uint64_t first = uint64_t(offset) / chunkSize;
+    const uint64_t last = uint64_t(offset + length - 1) / chunkSize;
+    if (last - first + 1 >= count)
+        return count == 64 ? ~uint64_t(0) : (uint64_t(1) << count) - 1;
+
+    uint64_t mask = 0;
+    for (uint64_t chunk = first; chunk <= last; ++chunk)
+        mask |= uint64_t(1) << ((chunk * 0x9e3779b97f4a7c15ULL >> 32) % count);
+    return mask;
+}
+
+/*!
+    \internal
+
+    Takes the segment lock for writing within \a timeout. Returns 0,
+    EOWNERDEAD for a RobustLock whose owner died, ETIMEDOUT or another
+    error.
+  */
+int QSharedMemoryPrivate::acquireLock(std::chrono::nanoseconds timeout)
+{
+    if (!header) {
+        const bool acquired = timeout == std::chrono::nanoseconds::max() ? systemSemaphore.acquire()
+                                                                         : systemSemaphore.tryAcquire(timeout);
+        if (acquired)
+            return 0;
+        return systemSemaphore.error() == QSystemSemaphore::Timeout ? ETIMEDOUT : EIO;
+    }
+
+    switch (lockMode) {
+    case QSharedMemory::RobustLock:
+        return robustLock(timeout);
+    case QSharedMemory::ReadWriteLock:
+        return rwLockForWrite(timeout) ? 0 : ETIMEDOUT;
+    default:
+        return futexLock(header->lockWord, timeout) ? 0 : ETIMEDOUT;
+    }
+}
+
+/*!
+    \internal
+
+    Returns the histogram bucket of \a duration: the position of its
+    highest set bit in nanoseconds.
+  */
+static uint32_t statisticsBucket(std::chrono::nanoseconds duration)
+{
+    const uint64_t ns = uint64_t(std::max(duration.count(), std::chrono::nanoseconds::rep(1)));
+    return std::min(uint32_t(63 - __builtin_clzll(ns)), uint32_t(QSharedMemoryHeader::StatisticsBuckets - 1));
+}
+
+/*!
+    \internal
+
+    Counts a lock taken after waiting since \a waitStart, or right away if
+    it is the epoch, and starts the hold time of the \a state.
+  */
+void QSharedMemoryPrivate::recordAcquire(QSharedMemoryLockState &state,
+                                         std::chrono::steady_clock::time_point waitStart)
+{
+    QSharedMemoryHeader::LockStatistics &stats = header->statistics;
+    state.lockedAt = std::chrono::steady_clock::now();
+    stats.acquires.fetch_add(1, std::memory_order_relaxed);
+    stats.lastHolderPid.store(uint32_t(currentProcessId()), std::memory_order_relaxed);
+    if (waitStart == std::chrono::steady_clock::time_point()) {
+        stats.waitHistogram[0].fetch_add(1, std::memory_order_relaxed);
+        return;
+    }
+    const auto wait = std::chrono::duration_cast<std::chrono::nanoseconds>(state.lockedAt - waitStart);
+    stats.contendedAcquires.fetch_add(1, std::memory_order_relaxed);
+    stats.totalWaitTime.fetch_add(uint64_t(wait.count()), std::memory_order_relaxed);
+    stats.waitHistogram[statisticsBucket(wait)].fetch_add(1, std::memory_order_relaxed);
+}
+
+/*!
+    \internal
+
+    Counts the hold time of a lock about to be released, if its acquire
+    was counted.
+  */
+void QSharedMemoryPrivate::recordRelease(QSharedMemoryLockState &state)
+{
+    if (state.lockedAt == std::chrono::steady_clock::time_point())
+        return;
+    const auto hold = std::chrono::duration_cast<std::chrono::nanoseconds>(
+                std::chrono::steady_clock::now() - state.lockedAt);
+    state.lockedAt = std::chrono::steady_clock::time_point();
+    if (!header)
+        return;
+    QSharedMemoryHeader::LockStatistics &stats = header->statistics;
+    stats.totalHoldTime.fetch_add(uint64_t(hold.count()), std::memory_order_relaxed);
+    stats.holdHistogram[statisticsBucket(hold)].fetch_add(1, std::memory_order_relaxed);
+}
+
+/*!
+    \internal
+
+    Tells the CPU that the thread is busy waiting, which saves power and
+    lets a sibling hyper-thread run, most likely the lock holder.
+  */
+static inline void cpuRelax()
+{
+#if defined(__x86_64__) || defined(__i386__)
+    __builtin_ia32_pause();
+#elif defined(__aarch64__) || defined(__arm__)
+    asm volatile("yield");
+#else
+    std::atomic_signal_fence(std::memory_order_seq_cst);
+#endif
+}
+
+/*!
+    \internal
+
+    Takes the lock \a word in the segment header: 0 is unlocked, 1 locked
+    and 2 locked with possible waiters. Only the contended path enters the
+    kernel.
+    Returns false if the lock wasn't released within \a timeout.
+  */
+bool QSharedMemoryPrivate::futexLock(std::atomic<uint32_t> &word, std::chrono::nanoseconds timeout)
+{
+    uint32_t c = 0;
+    if (word.compare_exchange_strong(c, 1, std::memory_order_acquire, std::memory_order_relaxed))
+        return true;
+    if (timeout == std::chrono::nanoseconds(0))
+        return false;
+
+    const auto deadline = futexDeadline(timeout);
+    if (spinTime > std::chrono::nanoseconds(0)) {
+        // Spin with read-only polls so the cache line isn't bounced between
+        // spinners, then take the lock as 1: a sleeper woken meanwhile sets
+        // it to 2 again before it goes back to sleep.
+        const auto spinDeadline = std::min(deadline, futexDeadline(spinTime));
+        int pauses = 1;
+        do {
+            for (int i = 0; i < pauses; ++i)
+                cpuRelax();
+            pauses = std::min(pauses * 2, 64);
+            c = word.load(std::memory_order_relaxed);
+            if (c == 0 && word.compare_exchange_strong(c, 1, std::memory_order_acquire,
+                                                       std::memory_order_relaxed)) {
+                spinAcquires.fetch_add(1, std::memory_order_relaxed);
+                return true;
+            }
+        } while (std::chrono::steady_clock::now() < spinDeadline);
+    }
+
+    if (c != 2)
+        c = word.exchange(2, std::memory_order_acquire);
+    while (c != 0) {
+        if (!futexWaitUntil(word, 2, deadline))
+            return false;
+        c = word.exchange(2, std::memory_order_acquire);
+    }
+    blockedAcquires.fetch_add(1, std::memory_order_relaxed);
+    return true;
+}
+
+void QSharedMemoryPrivate::futexUnlock(std::atomic<uint32_t> &word)
+{
+    if (word.exchange(0, std::memory_order_release) == 2)
+        QtFutex::futexWakeOne(word);
+}
+
+/*!
+    \internal
+
+    Sleeps on the change generation until it differs from
+    \a lastSeenGeneration. A waiter registers before it reads the
+    generation and notify() bumps it before it checks for waiters, both
+    sequentially consistent, so a notification can't slip in between.
+  */
+bool QSharedMemoryPrivate::waitForChange(uint32_t lastSeenGeneration, std::chrono::nanoseconds timeout)
+{
+    std::atomic<uint32_t> &generation = header->changeGeneration;
+    if (generation.load(std::memory_order_acquire) != lastSeenGeneration)
+        return true;
+    if (timeout <= std::chrono::nanoseconds(0))
+        return false;
+
+    const auto deadline = futexDeadline(timeout);
+    header->changeWaiters.fetch_add(1);
+    bool changed = true;
+    while (generation.load() == lastSeenGeneration) {
+        if (!futexWaitUntil(generation, lastSeenGeneration, deadline)) {
+            changed = false;
+            break;
+        }
+    }
+    header->changeWaiters.fetch_sub(1);
+    return changed;
+}
+
+/*!
+    \internal
+
+    Takes a read lock of the ReadWriteLock mode. Waiters sleep on the wake
+    sequence, which every release bumps before it checks for sleepers; a
+    waiter registers as sleeper before it reads the sequence and checks the
+    state again, so a release can't slip in between unnoticed.
+  */
+bool QSharedMemoryPrivate::rwLockForRead(std::chrono::nanoseconds timeout)
+{
+    std::atomic<uint32_t> &state = header->rwState;
+    const auto deadline = futexDeadline(timeout);
+    auto readable = [this](uint32_t s) {
+        return !(s & QSharedMemoryHeader::WriterLocked)
+                && !(header->rwPreferWriters.load(std::memory_order_relaxed)
+                     && header->rwWritersWaiting.load(std::memory_order_relaxed));
+    };
+
+    for (;;) {
+        uint32_t s = state.load(std::memory_order_relaxed);
+        if (readable(s)) {
+            if (state.compare_exchange_weak(s, s + 1, std::memory_order_acquire, std::memory_order_relaxed))
+                return true;
+            continue;
+        }
+        if (timeout == std::chrono::nanoseconds(0))
+            return false;
+
+        header->rwSleepers.fetch_add(1);
+        const uint32_t sequence = header->rwWakeSequence.load();
+        bool waited = true;
+        if (!readable(state.load()))
+            waited = futexWaitUntil(header->rwWakeSequence, sequence, deadline);
+        header->rwSleepers.fetch_sub(1);
+        if (!waited)
+            return false;
+    }
+}
+
+/*!
+    \internal
+
+    Takes the write lock of the ReadWriteLock mode, announcing the writer
+    so that readers give way to it if writers are preferred.
+  */
+bool QSharedMemoryPrivate::rwLockForWrite(std::chrono::nanoseconds timeout)
+{
+    std::atomic<uint32_t> &state = header->rwState;
+    uint32_t s = 0;
+    if (state.compare_exchange_strong(s, QSharedMemoryHeader::WriterLocked, std::memory_order_acquire,
+                                      std::memory_order_relaxed))
+        return true;
+    if (timeout == std::chrono::nanoseconds(0))
+        return false;
+
+    const auto deadline = futexDeadline(timeout);
+    header->rwWritersWaiting.fetch_add(1);
+    for (;;) {
+        s = 0;
+        if (state.compare_exchange_strong(s, QSharedMemoryHeader::WriterLocked, std::memory_order_acquire,
+                                          std::memory_order_relaxed))
+            break;
+
+        header->rwSleepers.fetch_add(1);
+        const uint32_t sequence = header->rwWakeSequence.load();
+        bool waited = true;
+        if (state.load() != 0)
+            waited = futexWaitUntil(header->rwWakeSequence, sequence, deadline);
+        header->rwSleepers.fetch_sub(1);
+        if (!waited) {
+            // readers held back for this writer may go on
+            header->rwWritersWaiting.fetch_sub(1);
+            rwWake();
+            return false;
+        }
+    }
+    header->rwWritersWaiting.fetch_sub(1);
+    return true;
+}
+
+void QSharedMemoryPrivate::rwUnlock(bool read)
+{
+    std::atomic<uint32_t> &state = header->rwState;
+    if (read) {
+        // only the last reader can let a writer in
+        if ((state.fetch_sub(1, std::memory_order_release) & ~QSharedMemoryHeader::WriterLocked) == 1)
+            rwWake();
+    } else {
+        state.fetch_and(~QSharedMemoryHeader::WriterLocked, std::memory_order_release);
+        rwWake();
+    }
+}
+
+void QSharedMemoryPrivate::rwWake()
+{
+    header->rwWakeSequence.fetch_add(1);
+    if (header->rwSleepers.load())
+        QtFutex::futexWakeAll(header->rwWakeSequence);
+}
+
+/*!
+  \enum QSharedMemory::SharedMemoryError
+
+  \value NoError No error occurred.
+
+  \value PermissionDenied The operation failed because the caller
+  didn't have the required permissions.
+
+  \value InvalidSize A create operation failed because the requested
+  size was invalid.
+
+  \value KeyError The operation failed because of an invalid key.
+
+  \value AlreadyExists A create() operation failed because a shared
+  memory segment with the specified key already existed.
+
+  \value NotFound An attach() failed because a shared memory segment
+  with the specified key could not be found.
+
+  \value LockError The attempt to lock() the shared memory segment
+  failed because create() or attach() failed and returned false, or
+  because a system error occurred in QSystemSemaphore::acquire().
+
+  \value OutOfResources A create() operation failed because there was
+  not enough memory available to fill the request.
 
   \value UnknownError Something else happened and it was bad.
+
+  \value LockTimeout lock() with a timeout or tryLock() gave up because
+  the segment stayed locked by another process.
 */
 
 /*!
@@ -533,6 +2807,9 @@ bool QSharedMemory::unlock()
  */
 QSharedMemory::SharedMemoryError QSharedMemory::error() const
 {
+    std::unique_lock<std::mutex> guard(d->threadMutex, std::defer_lock);
+    if (d->lockOwnership != ProcessOwnership)
+        guard.lock();
     return d->error;
 }
 
@@ -546,6 +2823,9 @@ QSharedMemory::SharedMemoryError QSharedMemory::error() const
  */
 std::string QSharedMemory::errorString() const
 {
+    std::unique_lock<std::mutex> guard(d->threadMutex, std::defer_lock);
+    if (d->lockOwnership != ProcessOwnership)
+        guard.lock();
     return d->errorString;
 }
 
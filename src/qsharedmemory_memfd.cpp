@@ -0,0 +1,342 @@
+/****************************************************************************
+**
+** Copyright (C) 2016 The Qt Company Ltd.
+** Contact: https://www.qt.io/licensing/
+**
+** This file is part of the QtCore module of the Qt Toolkit.
+**
+** $QT_BEGIN_LICENSE:LGPL$
+** Commercial License Usage
+** Licensees holding valid commercial Qt licenses may use this file in
+** accordance with the commercial license agreement provided with the
+** Software or, alternatively, in accordance with the terms contained in
+** a written agreement between you and The Qt Company. For licensing terms
+** and conditions see https://www.qt.io/terms-conditions. For further
+** information use the contact form at https://www.qt.io/contact-us.
+**
+** GNU Lesser General Public License Usage
+** Alternatively, this file may be used under the terms of the GNU Lesser
+** General Public License version 3 as published by the Free Software
+** Foundation and appearing in the file LICENSE.LGPL3 included in the
+** packaging of this file. Please review the following information to
+** ensure the GNU Lesser General Public License version 3 requirements
+** will be met: https://www.gnu.org/licenses/lgpl-3.0.html.
+**
+** GNU General Public License Usage
+** Alternatively, this file may be used under the terms of the GNU
+** General Public License version 2.0 or (at your option) the GNU General
+** Public license version 3 or any later version approved by the KDE Free
+** Qt Foundation. The licenses are as published by the Free Software
+** Foundation and appearing in the file LICENSE.GPL2 and LICENSE.GPL3
+** included in the packaging of this file. Please review the following
+** information to ensure the GNU General Public License requirements will
+** be met: https://www.gnu.org/licenses/gpl-2.0.html and
+** https://www.gnu.org/licenses/gpl-3.0.html.
+**
+** $QT_END_LICENSE$
+**
+****************************************************************************/
+
+#include "qsharedmemory.h"
+#include "qsharedmemory_p.h"
+
+#include <errno.h>
+
+#if defined(__linux__)
+
+#include <sys/types.h>
+#include <sys/mman.h>
+#include <sys/socket.h>
+#include <sys/stat.h>
+#include <fcntl.h>
+#include <unistd.h>
+
+#include <cstring>
+#include <vector>
+
+#include "qcore_unix_p.h"
+
+#ifndef MFD_HUGE_SHIFT
+#define MFD_HUGE_SHIFT 26
+#endif
+
+// Anonymous segments: memfd_create() objects which have no name in any
+// namespace and are shared by passing the file descriptor (SCM_RIGHTS).
+
+static const struct {
+    int seal;
+    int native;
+} sealTable[] = {
+    { QSharedMemory::SealShrink, F_SEAL_SHRINK },
+    { QSharedMemory::SealGrow, F_SEAL_GROW },
+    { QSharedMemory::SealWrite, F_SEAL_WRITE },
+#ifdef F_SEAL_FUTURE_WRITE
+    { QSharedMemory::SealFutureWrite, F_SEAL_FUTURE_WRITE },
+#endif
+    { QSharedMemory::SealSeal, F_SEAL_SEAL }
+};
+
+bool QSharedMemoryPrivate::createDescriptor(qint64 size)
+{
+    unsigned int flags = MFD_CLOEXEC | MFD_ALLOW_SEALING;
+    if (const size_t pageSize = hugePageSize(attachedOptions))
+        flags |= MFD_HUGETLB | (unsigned(__builtin_ctzll(pageSize)) << MFD_HUGE_SHIFT);
+
+    int fd = ::memfd_create("qipc_sharedmemory_anonymous", flags);
+    if (fd == -1) {
+        setErrorString("QSharedMemory::createAnonymous (memfd_create)");
+        return false;
+    }
+
+    int ret;
+    EINTR_LOOP(ret, ::ftruncate(fd, off_t(size)));
+    if (ret == -1) {
+        setErrorString("QSharedMemory::createAnonymous (ftruncate)");
+        qt_safe_close(fd);
+        return false;
+    }
+
+    // reserve the hugetlb pages so an exhausted pool fails here
+    if (hugePageSize(attachedOptions)) {
+        EINTR_LOOP(ret, ::fallocate(fd, 0, 0, off_t(size)));
+        if (ret == -1) {
+            if (!setHugePageError("QSharedMemory::createAnonymous (fallocate)"))
+                setErrorString("QSharedMemory::createAnonymous (fallocate)");
+            qt_safe_close(fd);
+            return false;
+        }
+    }
+
+    memfd = fd;
+    return true;
+}
+
+bool QSharedMemoryPrivate::attachDescriptor(int fd, QSharedMemory::AccessMode mode)
+{
+    const std::string function = "QSharedMemory::attachDescriptor";
+
+    // memfd is already set for created and received segments, otherwise
+    // the caller keeps ownership of fd and we take our own reference
+    if (memfd == -1) {
+        memfd = ::fcntl(fd, F_DUPFD_CLOEXEC, 0);
+        if (memfd == -1) {
+            setErrorString(function + " (dup)");
+            return false;
+        }
+    }
+
+    struct stat st;
+    if (::fstat(memfd, &st) == -1) {
+        setErrorString(function + " (fstat)");
+        qt_safe_close(memfd);
+        memfd = -1;
+        return false;
+    }
+    size = qint64(st.st_size);
+
+    const int mprot = (mode == QSharedMemory::ReadOnly ? PROT_READ : PROT_READ | PROT_WRITE);
+    const int mflags = (mode == QSharedMemory::CopyOnWrite ? MAP_PRIVATE : MAP_SHARED);
+    memory = ::mmap(nullptr, size_t(size), mprot, mflags, memfd, 0);
+    if (memory == MAP_FAILED || !memory) {
+        if (!setHugePageError(function + " (mmap)"))
+            setErrorString(function + " (mmap)");
+        qt_safe_close(memfd);
+        memfd = -1;
+        memory = nullptr;
+        size = 0;
+        return false;
+    }
+
+    return true;
+}
+
+bool QSharedMemoryPrivate::detachDescriptor()
+{
+    if (::munmap(memory, size_t(size)) == -1) {
+        setErrorString("QSharedMemory::detach (munmap)");
+        return false;
+    }
+    memory = nullptr;
+    size = 0;
+
+    // the object goes away with its last descriptor and mapping
+    qt_safe_close(memfd);
+    memfd = -1;
+
+    return true;
+}
+
+bool QSharedMemoryPrivate::sendDescriptor(int socket)
+{
+    char byte = 0;
+    iovec iov = { &byte, sizeof(byte) };
+
+    union {
+        cmsghdr header;
+        char buffer[CMSG_SPACE(sizeof(int))];
+    } control;
+    std::memset(&control, 0, sizeof(control));
+
+    msghdr msg = {};
+    msg.msg_iov = &iov;
+    msg.msg_iovlen = 1;
+    msg.msg_control = control.buffer;
+    msg.msg_controllen = sizeof(control.buffer);
+
+    cmsghdr *cmsg = CMSG_FIRSTHDR(&msg);
+    cmsg->cmsg_level = SOL_SOCKET;
+    cmsg->cmsg_type = SCM_RIGHTS;
+    cmsg->cmsg_len = CMSG_LEN(sizeof(int));
+    std::memcpy(CMSG_DATA(cmsg), &memfd, sizeof(int));
+
+    ssize_t ret;
+    EINTR_LOOP(ret, ::sendmsg(socket, &msg, MSG_NOSIGNAL));
+    if (ret == -1) {
+        setErrorString("QSharedMemory::sendDescriptor (sendmsg)");
+        return false;
+    }
+    return true;
+}
+
+bool QSharedMemoryPrivate::receiveDescriptor(int socket)
+{
+    const std::string function = "QSharedMemory::receiveDescriptor";
+    char byte;
+    iovec iov = { &byte, sizeof(byte) };
+
+    // room for a few descriptors, so a sender passing more than one can be
+    // told apart from a truncated message and all of them get closed
+    union {
+        cmsghdr header;
+        char buffer[CMSG_SPACE(sizeof(int) * 8)];
+    } control;
+
+    msghdr msg = {};
+    msg.msg_iov = &iov;
+    msg.msg_iovlen = 1;
+    msg.msg_control = control.buffer;
+    msg.msg_controllen = sizeof(control.buffer);
+
+    ssize_t ret;
+    EINTR_LOOP(ret, ::recvmsg(socket, &msg, MSG_CMSG_CLOEXEC));
+    if (ret == -1) {
+        setErrorString(function + " (recvmsg)");
+        return false;
+    }
+
+    // the kernel installed every descriptor of the message already
+    std::vector<int> fds;
+    for (cmsghdr *cmsg = CMSG_FIRSTHDR(&msg); cmsg; cmsg = CMSG_NXTHDR(&msg, cmsg)) {
+        if (cmsg->cmsg_level != SOL_SOCKET || cmsg->cmsg_type != SCM_RIGHTS)
+            continue;
+        const size_t count = (cmsg->cmsg_len - CMSG_LEN(0)) / sizeof(int);
+        for (size_t i = 0; i < count; ++i) {
+            int fd;
+            std::memcpy(&fd, CMSG_DATA(cmsg) + i * sizeof(int), sizeof(int));
+            fds.push_back(fd);
+        }
+    }
+
+    if (ret == 0 || fds.size() != 1 || (msg.msg_flags & MSG_CTRUNC)) {
+        for (int fd : fds)
+            qt_safe_close(fd);
+        error = QSharedMemory::NotFound;
+        errorString = function + ": no descriptor received";
+        return false;
+    }
+
+    memfd = fds.front();
+    return true;
+}
+
+bool QSharedMemoryPrivate::addSeals(int seals)
+{
+    int native = 0;
+    for (const auto &entry : sealTable) {
+        if (seals & entry.seal)
+            native |= entry.native;
+    }
+
+    if (::fcntl(memfd, F_ADD_SEALS, native) == -1) {
+        const std::string function = "QSharedMemory::seal";
+        switch (errno) {
+        case EBUSY:
+            errorString = function + ": segment is mapped writable";
+            error = QSharedMemory::PermissionDenied;
+            break;
+        case EPERM:
+            errorString = function + ": segment is sealed";
+            error = QSharedMemory::PermissionDenied;
+            break;
+        default:
+            setErrorString(function);
+        }
+        return false;
+    }
+    return true;
+}
+
+int QSharedMemoryPrivate::seals() const
+{
+    const int native = ::fcntl(memfd, F_GET_SEALS);
+    if (native == -1)
+        return QSharedMemory::NoSeal;
+
+    int seals = QSharedMemory::NoSeal;
+    for (const auto &entry : sealTable) {
+        if (native & entry.native)
+            seals |= entry.seal;
+    }
+    return seals;
+}
+
+#else
+
+static const char notSupported[] = ": anonymous segments are not supported on this platform";
+
+bool QSharedMemoryPrivate::createDescriptor(qint64)
+{
+    error = QSharedMemory::UnknownError;
+    errorString = std::string("QSharedMemory::createAnonymous") + notSupported;
+    return false;
+}
+
+bool QSharedMemoryPrivate::attachDescriptor(int, QSharedMemory::AccessMode)
+{
+    error = QSharedMemory::UnknownError;
+    errorString = std::string("QSharedMemory::attachDescriptor") + notSupported;
+    return false;
+}
+
+bool QSharedMemoryPrivate::detachDescriptor()
+{
+    return false;
+}
+
+bool QSharedMemoryPrivate::sendDescriptor(int)
+{
+    error = QSharedMemory::UnknownError;
+    errorString = std::string("QSharedMemory::sendDescriptor") + notSupported;
+    return false;
+}
+
+bool QSharedMemoryPrivate::receiveDescriptor(int)
+{
+    error = QSharedMemory::UnknownError;
+    errorString = std::string("QSharedMemory::receiveDescriptor") + notSupported;
+    return false;
+}
+
+bool QSharedMemoryPrivate::addSeals(int)
+{
+    error = QSharedMemory::UnknownError;
+    errorString = std::string("QSharedMemory::seal") + notSupported;
+    return false;
+}
+
+int QSharedMemoryPrivate::seals() const
+{
+    return QSharedMemory::NoSeal;
+}
+
+#endif
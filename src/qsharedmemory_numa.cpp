@@ -0,0 +1,187 @@
+/****************************************************************************
+**
+** Copyright (C) 2016 The Qt Company Ltd.
+** Contact: https://www.qt.io/licensing/
+**
+** This file is part of the QtCore module of the Qt Toolkit.
+**
+** $QT_BEGIN_LICENSE:LGPL$
+** Commercial License Usage
+** Licensees holding valid commercial Qt licenses may use this file in
+** accordance with the commercial license agreement provided with the
+** Software or, alternatively, in accordance with the terms contained in
+** a written agreement between you and The Qt Company. For licensing terms
+** and conditions see https://www.qt.io/terms-conditions. For further
+** information use the contact form at https://www.qt.io/contact-us.
+**
+** GNU Lesser General Public License Usage
+** Alternatively, this file may be used under the terms of the GNU Lesser
+** General Public License version 3 as published by the Free Software
+** Foundation and appearing in the file LICENSE.LGPL3 included in the
+** packaging of this file. Please review the following information to
+** ensure the GNU Lesser General Public License version 3 requirements
+** will be met: https://www.gnu.org/licenses/lgpl-3.0.html.
+**
+** GNU General Public License Usage
+** Alternatively, this file may be used under the terms of the GNU
+** General Public License version 2.0 or (at your option) the GNU General
+** Public license version 3 or any later version approved by the KDE Free
+** Qt Foundation. The licenses are as published by the Free Software
+** Foundation and appearing in the file LICENSE.GPL2 and LICENSE.GPL3
+** included in the packaging of this file. Please review the following
+** information to ensure the GNU General Public License requirements will
+** be met: https://www.gnu.org/licenses/gpl-2.0.html and
+** https://www.gnu.org/licenses/gpl-3.0.html.
+**
+** $QT_END_LICENSE$
+**
+****************************************************************************/
+
+#include "qsharedmemory.h"
+#include "qsharedmemory_p.h"
+
+#include <errno.h>
+
+#if defined(__linux__)
+
+#include <linux/mempolicy.h>
+#include <sys/syscall.h>
+#include <unistd.h>
+
+#include <algorithm>
+#include <cstdio>
+#include <fstream>
+
+// NUMA placement without a libnuma dependency: the policy is set with the
+// raw mbind() system call. On shared mappings the policy is attached to the
+// shared object, so it applies to pages faulted in by any process.
+
+static std::vector<unsigned long> nodeMask(const std::vector<int> &nodes, unsigned long *maxNode)
+{
+    const size_t bits = sizeof(unsigned long) * 8;
+    int highest = 0;
+    for (int node : nodes)
+        highest = std::max(highest, node);
+
+    std::vector<unsigned long> mask(size_t(highest) / bits + 1, 0);
+    for (int node : nodes)
+        mask[size_t(node) / bits] |= 1UL << (size_t(node) % bits);
+    *maxNode = mask.size() * bits + 1;
+    return mask;
+}
+
+/*!
+    \internal
+
+    Applies the NUMA policy to the current mapping. \a move migrates the
+    pages already faulted in, which is only needed once the segment is in use.
+  */
+bool QSharedMemoryPrivate::applyNumaPolicy(bool move)
+{
+    if (numaPolicy == QSharedMemory::NumaDefault && !move)
+        return true;
+
+    int mode = MPOL_DEFAULT;
+    switch (numaPolicy) {
+    case QSharedMemory::NumaDefault: mode = MPOL_DEFAULT; break;
+    case QSharedMemory::NumaBind: mode = MPOL_BIND; break;
+    case QSharedMemory::NumaInterleave: mode = MPOL_INTERLEAVE; break;
+    case QSharedMemory::NumaPreferred: mode = MPOL_PREFERRED; break;
+    }
+
+    const std::string function = "QSharedMemory::setNumaPolicy (mbind)";
+    std::vector<int> nodes = numaPolicyNodes;
+    if (mode == MPOL_PREFERRED && nodes.size() > 1)
+        nodes.resize(1);
+    if (mode != MPOL_DEFAULT && nodes.empty()) {
+        errorString = function + ": no NUMA nodes given";
+        error = QSharedMemory::UnknownError;
+        return false;
+    }
+    for (int node : nodes) {
+        if (node < 0) {
+            errorString = function + ": invalid NUMA node";
+            error = QSharedMemory::UnknownError;
+            return false;
+        }
+    }
+
+    unsigned long maxNode = 0;
+    std::vector<unsigned long> mask;
+    if (mode != MPOL_DEFAULT)
+        mask = nodeMask(nodes, &maxNode);
+
+    const unsigned flags = move ? MPOL_MF_MOVE : 0;
+    if (::syscall(SYS_mbind, memory, size_t(size), mode, mask.empty() ? nullptr : mask.data(),
+                  maxNode, flags) == -1) {
+        if (errno == EINVAL) {
+            errorString = function + ": invalid NUMA node";
+            error = QSharedMemory::UnknownError;
+        } else {
+            setErrorString(function);
+        }
+        return false;
+    }
+    return true;
+}
+
+/*!
+    \internal
+
+    Returns the NUMA node of the CPU the calling thread runs on.
+  */
+int QSharedMemoryPrivate::currentNumaNode()
+{
+    unsigned cpu = 0, node = 0;
+    if (::syscall(SYS_getcpu, &cpu, &node, nullptr) == -1)
+        return 0;
+    return int(node);
+}
+
+/*!
+    \internal
+
+    Returns the online NUMA nodes, parsed from a list such as "0-1,4".
+  */
+std::vector<int> QSharedMemoryPrivate::numaNodes()
+{
+    std::vector<int> nodes;
+    std::ifstream online("/sys/devices/system/node/online");
+    std::string range;
+    while (std::getline(online, range, ',')) {
+        int first = 0, last = 0;
+        const int n = std::sscanf(range.c_str(), "%d-%d", &first, &last);
+        if (n < 1)
+            continue;
+        if (n == 1)
+            last = first;
+        for (int node = first; node <= last; ++node)
+            nodes.push_back(node);
+    }
+    if (nodes.empty())
+        nodes.push_back(0);
+    return nodes;
+}
+
+#else
+
+bool QSharedMemoryPrivate::applyNumaPolicy(bool)
+{
+    if (numaPolicy == QSharedMemory::NumaDefault)
+        return true;
+    error = QSharedMemory::UnknownError;
+    errorString = "QSharedMemory::setNumaPolicy: NUMA policies are not supported on this platform";
+    return false;
+}
+
+int QSharedMemoryPrivate::currentNumaNode()
+{
+    return 0;
+}
+
+std::vector<int> QSharedMemoryPrivate::numaNodes()
+{
+    return { 0 };
+}
+
+#endif
@@ -0,0 +1,301 @@
+/****************************************************************************
+**
+** Copyright (C) 2016 The Qt Company Ltd.
+** Contact: https://www.qt.io/licensing/
+**
+** This file is part of the QtCore module of the Qt Toolkit.
+**
+** $QT_BEGIN_LICENSE:LGPL$
+** Commercial License Usage
+** Licensees holding valid commercial Qt licenses may use this file in
+** accordance with the commercial license agreement provided with the
+** Software or, alternatively, in accordance with the terms contained in
+** a written agreement between you and The Qt Company. For licensing terms
+** and conditions see https://www.qt.io/terms-conditions. For further
+** information use the contact form at https://www.qt.io/contact-us.
+**
+** GNU Lesser General Public License Usage
+** Alternatively, this file may be used under the terms of the GNU Lesser
+** General Public License version 3 as published by the Free Software
+** Foundation and appearing in the file LICENSE.LGPL3 included in the
+** packaging of this file. Please review the following information to
+** ensure the GNU Lesser General Public License version 3 requirements
+** will be met: https://www.gnu.org/licenses/lgpl-3.0.html.
+**
+** GNU General Public License Usage
+** Alternatively, this file may be used under the terms of the GNU
+** General Public License version 2.0 or (at your option) the GNU General
+** Public license version 3 or any later version approved by the KDE Free
+** Qt Foundation. The licenses are as published by the Free Software
+** Foundation and appearing in the file LICENSE.GPL2 and LICENSE.GPL3
+** included in the packaging of this file. Please review the following
+** information to ensure the GNU General Public License requirements will
+** be met: https://www.gnu.org/licenses/gpl-2.0.html and
+** https://www.gnu.org/licenses/gpl-3.0.html.
+**
+** $QT_END_LICENSE$
+**
+****************************************************************************/
+
+#include "qsharedmemory.h"
+#include "qsharedmemory_p.h"
+#include "qsystemsemaphore.h"
+
+#include <errno.h>
+
+#ifdef QT_POSIX_IPC
+
+#include <sys/types.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <sys/file.h>
+#include <fcntl.h>
+#include <unistd.h>
+
+#include <cstdlib>
+#include <fstream>
+
+#include "qcore_unix_p.h"
+
+/*!
+    \internal
+
+    Returns the mount point of a hugetlbfs file system providing pages of
+    \a pageSize bytes. shm_open() objects live on tmpfs which can't use
+    hugetlb pages, so huge page segments are files on such a mount.
+  */
+static std::string hugetlbfsPath(size_t pageSize)
+{
+    std::ifstream mounts("/proc/mounts");
+    std::string device, dir, type, options, rest;
+    while (mounts >> device >> dir >> type >> options) {
+        std::getline(mounts, rest);
+        if (type != "hugetlbfs")
+            continue;
+
+        // mounts without a pagesize option use the default huge page size
+        size_t mountPageSize = size_t(1) << 21;
+        const std::string::size_type pos = options.find("pagesize=");
+        if (pos != std::string::npos) {
+            char *end = nullptr;
+            mountPageSize = std::strtoull(options.c_str() + pos + 9, &end, 10);
+            switch (*end) {
+            case 'G': mountPageSize <<= 30; break;
+            case 'M': mountPageSize <<= 20; break;
+            case 'K':
+            case 'k': mountPageSize <<= 10; break;
+            default: break;
+            }
+        }
+        if (mountPageSize == pageSize)
+            return dir;
+    }
+    return std::string();
+}
+
+static int openSegment(const std::string &name, int options, int oflag, mode_t mode)
+{
+    int fd;
+    if (const size_t pageSize = QSharedMemoryPrivate::hugePageSize(options)) {
+        const std::string dir = hugetlbfsPath(pageSize);
+        if (dir.empty()) {
+            errno = ENODEV;
+            return -1;
+        }
+        EINTR_LOOP(fd, ::open((dir + name).c_str(), oflag | O_CLOEXEC, mode));
+        return fd;
+    }
+
+#ifdef O_CLOEXEC
+    // First try with O_CLOEXEC flag, if that fails, fall back to normal flags
+    EINTR_LOOP(fd, ::shm_open(name.c_str(), oflag | O_CLOEXEC, mode));
+    if (fd == -1)
+        EINTR_LOOP(fd, ::shm_open(name.c_str(), oflag, mode));
+#else
+    EINTR_LOOP(fd, ::shm_open(name.c_str(), oflag, mode));
+#endif
+    return fd;
+}
+
+static int unlinkSegment(const std::string &name, int options)
+{
+    if (const size_t pageSize = QSharedMemoryPrivate::hugePageSize(options))
+        return ::unlink((hugetlbfsPath(pageSize) + name).c_str());
+    return ::shm_unlink(name.c_str());
+}
+
+int QSharedMemoryPrivate::handle()
+{
+    // don't allow making handles on empty keys
+    if (nativeKey.empty()) {
+        errorString = "QSharedMemory::handle: key is empty";
+        error = QSharedMemory::KeyError;
+        return 0;
+    }
+    return 1;
+}
+
+int QSharedMemoryPrivate::segmentDescriptor() const
+{
+    return memfd != -1 ? memfd : hand;
+}
+
+bool QSharedMemoryPrivate::moveMapping(void *address)
+{
+    return mapDescriptorAt(segmentDescriptor(), address);
+}
+
+bool QSharedMemoryPrivate::cleanHandle()
+{
+    qt_safe_close(hand);
+    hand = -1;
+
+    return true;
+}
+
+bool QSharedMemoryPrivate::create(qint64 size)
+{
+    if (!handle())
+        return false;
+
+    const int fd = openSegment(nativeKey, attachedOptions, O_RDWR | O_CREAT | O_EXCL, 0600);
+    if (fd == -1) {
+        const int errorNumber = errno;
+        const std::string function("QSharedMemory::attach (shm_open)");
+        switch (errorNumber) {
+        case ENAMETOOLONG:
+        case EINVAL:
+            errorString = function + ": bad name";
+            error = QSharedMemory::KeyError;
+            break;
+        case ENODEV:
+            errorString = function + ": no hugetlbfs mount for the huge page size";
+            error = QSharedMemory::OutOfResources;
+            break;
+        default:
+            setErrorString(function);
+        }
+        return false;
+    }
+
+    // the size may only be set once
+    int ret;
+    EINTR_LOOP(ret, ::ftruncate(fd, off_t(size)));
+    if (ret == -1) {
+        setErrorString("QSharedMemory::create (ftruncate)");
+        qt_safe_close(fd);
+        return false;
+    }
+
+    // hugetlb pages are only taken from the pool when faulted in, reserve
+    // them now so an exhausted pool fails create() and not a later access
+    if (hugePageSize(attachedOptions)) {
+        EINTR_LOOP(ret, ::fallocate(fd, 0, 0, off_t(size)));
+        if (ret == -1) {
+            if (!setHugePageError("QSharedMemory::create (fallocate)"))
+                setErrorString("QSharedMemory::create (fallocate)");
+            qt_safe_close(fd);
+            unlinkSegment(nativeKey, attachedOptions);
+            return false;
+        }
+    }
+
+    qt_safe_close(fd);
+
+    return true;
+}
+
+bool QSharedMemoryPrivate::attach(QSharedMemory::AccessMode mode)
+{
+    // copy-on-write mappings never write to the object
+    const int oflag = (mode == QSharedMemory::ReadWrite ? O_RDWR : O_RDONLY);
+    const mode_t omode = (mode == QSharedMemory::ReadWrite ? 0600 : 0400);
+
+    hand = openSegment(nativeKey, attachedOptions, oflag, omode);
+    if (hand == -1) {
+        const int errorNumber = errno;
+        const std::string function("QSharedMemory::attach (shm_open)");
+        switch (errorNumber) {
+        case ENAMETOOLONG:
+        case EINVAL:
+            errorString = function + ": bad name";
+            error = QSharedMemory::KeyError;
+            break;
+        case ENODEV:
+            errorString = function + ": no hugetlbfs mount for the huge page size";
+            error = QSharedMemory::OutOfResources;
+            break;
+        default:
+            setErrorString(function);
+        }
+        hand = -1;
+        return false;
+    }
+
+    // grab the size
+    struct stat st;
+    if (::fstat(hand, &st) == -1) {
+        setErrorString("QSharedMemory::attach (fstat)");
+        cleanHandle();
+        return false;
+    }
+    size = qint64(st.st_size);
+
+    // grab the memory
+    const int mprot = (mode == QSharedMemory::ReadOnly ? PROT_READ : PROT_READ | PROT_WRITE);
+    const int mflags = (mode == QSharedMemory::CopyOnWrite ? MAP_PRIVATE : MAP_SHARED);
+    memory = ::mmap(nullptr, size_t(size), mprot, mflags, hand, 0);
+    if (memory == MAP_FAILED || !memory) {
+        if (!setHugePageError("QSharedMemory::attach (mmap)"))
+            setErrorString("QSharedMemory::attach (mmap)");
+        cleanHandle();
+        memory = nullptr;
+        size = 0;
+        return false;
+    }
+
+#ifdef F_ADD_SEALS
+    // Make sure the shared memory region will not shrink
+    // otherwise someone could cause SIGBUS on us.
+    // (see http://lwn.net/Articles/594919/)
+    fcntl(hand, F_ADD_SEALS, F_SEAL_SHRINK);
+#endif
+
+    // Register this attachment. The shared lock is held for as long as the
+    // handle is open and lets detach() tell whether it is the last user.
+    int ret;
+    EINTR_LOOP(ret, ::flock(hand, LOCK_SH));
+
+    return true;
+}
+
+bool QSharedMemoryPrivate::detach()
+{
+    // detach from the memory segment
+    if (::munmap(memory, size_t(size)) == -1) {
+        setErrorString("QSharedMemory::detach (munmap)");
+        return false;
+    }
+    memory = nullptr;
+    size = 0;
+
+    // On Linux the st_nlink field of struct stat is always 1, so unlike QNX
+    // it can't be used to count the attachments, and Qt 5.15 leaks the
+    // segment. Every attached instance holds a shared flock() on its handle
+    // instead: if an exclusive lock can be taken, no other ktsm instance is
+    // attached. Qt processes don't take the lock, KeepOnDetach leaves the
+    // segment to them.
+    const bool unlink = !(attachedOptions & QSharedMemory::KeepOnDetach)
+            && ::flock(hand, LOCK_EX | LOCK_NB) == 0;
+
+    cleanHandle();
+
+    if (unlink) {
+        if (unlinkSegment(nativeKey, attachedOptions) == -1 && errno != ENOENT)
+            setErrorString("QSharedMemory::detach (shm_unlink)");
+    }
+
+    return true;
+}
+
+#endif // QT_POSIX_IPC
@@ -0,0 +1,270 @@
+/****************************************************************************
+**
+** Copyright (C) 2016 The Qt Company Ltd.
+** Contact: https://www.qt.io/licensing/
+**
+** This file is part of the QtCore module of the Qt Toolkit.
+**
+** $QT_BEGIN_LICENSE:LGPL$
+** Commercial License Usage
+** Licensees holding valid commercial Qt licenses may use this file in
+** accordance with the commercial license agreement provided with the
+** Software or, alternatively, in accordance with the terms contained in
+** a written agreement between you and The Qt Company. For licensing terms
+** and conditions see https://www.qt.io/terms-conditions. For further
+** information use the contact form at https://www.qt.io/contact-us.
+**
+** GNU Lesser General Public License Usage
+** Alternatively, this file may be used under the terms of the GNU Lesser
+** General Public License version 3 as published by the Free Software
+** Foundation and appearing in the file LICENSE.LGPL3 included in the
+** packaging of this file. Please review the following information to
+** ensure the GNU Lesser General Public License version 3 requirements
+** will be met: https://www.gnu.org/licenses/lgpl-3.0.html.
+**
+** GNU General Public License Usage
+** Alternatively, this file may be used under the terms of the GNU
+** General Public License version 2.0 or (at your option) the GNU General
+** Public license version 3 or any later version approved by the KDE Free
+** Qt Foundation. The licenses are as published by the Free Software
+** Foundation and appearing in the file LICENSE.GPL2 and LICENSE.GPL3
+** included in the packaging of this file. Please review the following
+** information to ensure the GNU General Public License requirements will
+** be met: https://www.gnu.org/licenses/gpl-2.0.html and
+** https://www.gnu.org/licenses/gpl-3.0.html.
+**
+** $QT_END_LICENSE$
+**
+****************************************************************************/
+
+#include "qsharedmemory.h"
+#include "qsharedmemory_p.h"
+#include "qsystemsemaphore.h"
+
+#include <errno.h>
+
+#ifndef QT_POSIX_IPC
+
+#include <sys/types.h>
+#include <sys/ipc.h>
+#include <sys/shm.h>
+#include <sys/stat.h>
+#include <fcntl.h>
+#include <unistd.h>
+
+#include "qcore_unix_p.h"
+
+#ifndef SHM_HUGE_SHIFT
+#define SHM_HUGE_SHIFT 26
+#endif
+
+/*!
+    \internal
+
+    If not already made create the handle used for accessing the shared memory.
+*/
+int QSharedMemoryPrivate::segmentDescriptor() const
+{
+    // System V segments have a fixed size, only anonymous ones can grow
+    return memfd;
+}
+
+key_t QSharedMemoryPrivate::handle()
+{
+    // already made
+    if (unix_key)
+        return unix_key;
+
+    // don't allow making handles on empty keys
+    if (nativeKey.empty()) {
+        errorString = "QSharedMemory::handle:: key is empty";
+        error = QSharedMemory::KeyError;
+        return 0;
+    }
+
+    // ftok requires that an actual file exists somewhere
+    if (::access(nativeKey.c_str(), F_OK) == -1) {
+        errorString = "QSharedMemory::handle:: UNIX key file doesn't exist";
+        error = QSharedMemory::NotFound;
+        return 0;
+    }
+
+    unix_key = qt_safe_ftok(nativeKey, 'Q');
+    if (-1 == unix_key) {
+        errorString = "QSharedMemory::handle:: ftok failed";
+        error = QSharedMemory::KeyError;
+        unix_key = 0;
+    }
+    return unix_key;
+}
+
+bool QSharedMemoryPrivate::cleanHandle()
+{
+    unix_key = 0;
+    return true;
+}
+
+bool QSharedMemoryPrivate::create(qint64 size)
+{
+    // build file if needed
+    bool createdFile = false;
+    int built = createUnixKeyFile(nativeKey);
+    if (built == -1) {
+        errorString = "QSharedMemory::handle:: unable to make key";
+        error = QSharedMemory::KeyError;
+        return false;
+    }
+    if (built == 1) {
+        createdFile = true;
+    }
+
+    // get handle
+    if (!handle()) {
+        if (createdFile)
+            ::unlink(nativeKey.c_str());
+        return false;
+    }
+
+    int flags = 0600 | IPC_CREAT | IPC_EXCL;
+    if (const size_t pageSize = hugePageSize(attachedOptions))
+        flags |= SHM_HUGETLB | (__builtin_ctzll(pageSize) << SHM_HUGE_SHIFT);
+
+    // create
+    if (-1 == shmget(unix_key, size_t(size), flags)) {
+        const std::string function("QSharedMemory::create");
+        if (setHugePageError(function)) {
+            if (createdFile)
+                ::unlink(nativeKey.c_str());
+            return false;
+        }
+        switch (errno) {
+        case EINVAL:
+            errorString = "QSharedMemory::handle: system-imposed size restrictions";
+            error = QSharedMemory::InvalidSize;
+            break;
+        default:
+            setErrorString(function);
+        }
+        if (createdFile && error != QSharedMemory::AlreadyExists)
+            ::unlink(nativeKey.c_str());
+        return false;
+    }
+
+    return true;
+}
+
+bool QSharedMemoryPrivate::attach(QSharedMemory::AccessMode mode)
+{
+    if (mode == QSharedMemory::CopyOnWrite) {
+        error = QSharedMemory::UnknownError;
+        errorString = "QSharedMemory::attach: copy-on-write is not supported for System V segments";
+        return false;
+    }
+
+    // grab the shared memory segment id
+    int id = shmget(unix_key, 0, (mode == QSharedMemory::ReadOnly ? 0400 : 0600));
+    if (-1 == id) {
+        setErrorString("QSharedMemory::attach (shmget)");
+        return false;
+    }
+
+    // grab the memory
+    memory = shmat(id, nullptr, (mode == QSharedMemory::ReadOnly ? SHM_RDONLY : 0));
+    if ((void *)-1 == memory) {
+        memory = nullptr;
+        setErrorString("QSharedMemory::attach (shmat)");
+        return false;
+    }
+
+    // grab the size
+    shmid_ds shmid_ds;
+    if (!shmctl(id, IPC_STAT, &shmid_ds)) {
+        size = qint64(shmid_ds.shm_segsz);
+    } else {
+        setErrorString("QSharedMemory::attach (shmctl)");
+        return false;
+    }
+
+    return true;
+}
+
+bool QSharedMemoryPrivate::moveMapping(void *address)
+{
+    if (memfd != -1)
+        return mapDescriptorAt(memfd, address);
+
+    int id = shmget(unix_key, 0, 0600);
+    if (-1 == id) {
+        setErrorString("QSharedMemory::attach (shmget)");
+        return false;
+    }
+
+    // without SHM_REMAP shmat() fails if the range is in use
+    void *mapped = shmat(id, address, 0);
+    if ((void *)-1 == mapped) {
+        if (errno == EINVAL) {
+            errorString = "QSharedMemory::attach (shmat): the fixed address range is in use";
+            error = QSharedMemory::OutOfResources;
+        } else {
+            setErrorString("QSharedMemory::attach (shmat)");
+        }
+        return false;
+    }
+
+    shmdt(memory);
+    memory = mapped;
+    return true;
+}
+
+bool QSharedMemoryPrivate::detach()
+{
+    // detach from the memory segment
+    if (-1 == shmdt(memory)) {
+        const std::string function("QSharedMemory::detach");
+        switch (errno) {
+        case EINVAL:
+            errorString = function + ": not attached";
+            error = QSharedMemory::NotFound;
+            break;
+        default:
+            setErrorString(function);
+        }
+        return false;
+    }
+    memory = nullptr;
+    size = 0;
+
+    // Get the number of current attachments
+    int id = shmget(unix_key, 0, 0400);
+    cleanHandle();
+
+    struct shmid_ds shmid_ds;
+    if (0 != shmctl(id, IPC_STAT, &shmid_ds)) {
+        switch (errno) {
+        case EINVAL:
+            return true;
+        default:
+            return false;
+        }
+    }
+    // If there are no attachments then remove it.
+    if (shmid_ds.shm_nattch == 0) {
+        // mark for removal
+        if (-1 == shmctl(id, IPC_RMID, &shmid_ds)) {
+            setErrorString("QSharedMemory::remove");
+            switch (errno) {
+            case EINVAL:
+                return true;
+            default:
+                return false;
+            }
+        }
+
+        // remove file
+        if (::unlink(nativeKey.c_str()) == -1)
+            return false;
+    }
+    return true;
+}
+
+#endif // QT_POSIX_IPC
@@ -37,80 +37,731 @@
 **
 ****************************************************************************/
 
-#include "qplatformdefs.h"
-
 #include "qsharedmemory.h"
 #include "qsharedmemory_p.h"
 #include "qsystemsemaphore.h"
-#include <qdebug.h>
 
 #include <errno.h>
+#include <fcntl.h>
+#include <sys/file.h>
+#include <sys/mman.h>
+#include <sys/resource.h>
+#include <unistd.h>
+#if defined(__linux__)
+#  include <sys/eventfd.h>
+#endif
+
+#include "qcore_unix_p.h"
+#include "qfutex_p.h"
 
-#ifndef QT_NO_SHAREDMEMORY
-#include <sys/types.h>
+QSharedMemoryPrivate::QSharedMemoryPrivate() :
+    memory(nullptr), size(0), error(QSharedMemory::NoError),
+    systemSemaphore(std::string()), lockOwnership(QSharedMemory::ProcessOwnership),
+    instanceId(newInstanceId()), heldLocks(0), preferWriters(true),
+    spinTime(0), collectStatistics(false), stripeCount(QSharedMemoryHeader::MaxLockStripes), stripeSize(4096), spinAcquires(0), blockedAcquires(0),
+    lockMode(QSharedMemory::SystemSemaphoreLock), header(nullptr), headerSize(0),
+    generation(0), accessMode(QSharedMemory::ReadWrite), memfd(-1), soleFileUser(false), fileGuard(-1),
+    changeEventFd(-1), changeWatcherStop(false), changeWatcherDone(false), changeWatcherSeen(0),
+    mappingOptions(QSharedMemory::NoMappingOption), attachedOptions(QSharedMemory::NoMappingOption),
+    requestedAddress(nullptr),
+    prefaultedPages(0), prefaultTime(0),
+    numaPolicy(QSharedMemory::NumaDefault), numaReplicas(false), readReplica(nullptr), readReplicaNode(-1),
 #ifndef QT_POSIX_IPC
-#include <sys/ipc.h>
-#include <sys/shm.h>
+    unix_key(0)
 #else
-#include <sys/mman.h>
+    hand(-1)
 #endif
-#include <sys/stat.h>
-#include <fcntl.h>
-#include <unistd.h>
-#endif //QT_NO_SHAREDMEMORY
+{
+}
 
-#include "private/qcore_unix_p.h"
+/*!
+    \internal
 
-#ifndef QT_NO_SHAREDMEMORY
-QT_BEGIN_NAMESPACE
+    Creates the unix file if needed.
+    returns \c true if the unix file was created.
 
-QSharedMemoryPrivate::QSharedMemoryPrivate() :
-#ifndef QT_NO_QOBJECT
-    QObjectPrivate(),
+    -1 error
+     0 already existed
+     1 created
+  */
+int QSharedMemoryPrivate::createUnixKeyFile(const std::string &fileName)
+{
+    int fd;
+    EINTR_LOOP(fd, ::open(fileName.c_str(), O_EXCL | O_CREAT | O_RDWR | O_CLOEXEC, 0640));
+    if (-1 == fd) {
+        if (errno == EEXIST)
+            return 0;
+        return -1;
+    } else {
+        qt_safe_close(fd);
+    }
+    return 1;
+}
+
+int QSharedMemoryPrivate::pageSize()
+{
+    static const int size = int(::sysconf(_SC_PAGESIZE));
+    return size;
+}
+
+/*!
+    \internal
+
+    Makes \a length bytes at \a address read-only, used to keep the data of
+    a ReadOnly attachment protected while its header stays writable.
+  */
+bool QSharedMemoryPrivate::protect(void *address, size_t length)
+{
+    if (::mprotect(address, length, PROT_READ) == -1) {
+        setErrorString("QSharedMemory::attach (mprotect)");
+        return false;
+    }
+    return true;
+}
+
+/*!
+    \internal
+
+    Replaces the mapping from \a offset to the end with a private
+    copy-on-write mapping of the same pages, so that a CopyOnWrite
+    attachment keeps sharing the segment header (and its lock) with
+    everybody else. Needs a descriptor, so System V segments can't do it.
+  */
+bool QSharedMemoryPrivate::mapPrivate(qint64 offset)
+{
+    const std::string function = "QSharedMemory::attach";
+    const int fd = segmentDescriptor();
+    if (fd == -1) {
+        error = QSharedMemory::UnknownError;
+        errorString = function + ": copy-on-write is not supported for System V segments";
+        return false;
+    }
+    if (hugePageSize(attachedOptions) && offset % qint64(hugePageSize(attachedOptions))) {
+        error = QSharedMemory::UnknownError;
+        errorString = function + ": copy-on-write of hugetlb segments needs the SystemSemaphoreLock mode";
+        return false;
+    }
+    if (size <= offset)
+        return true;
+
+    void *address = ::mmap(static_cast<char *>(memory) + offset, size_t(size - offset),
+                           PROT_READ | PROT_WRITE, MAP_PRIVATE | MAP_FIXED, fd, off_t(offset));
+    if (address == MAP_FAILED) {
+        setErrorString(function + " (mmap)");
+        return false;
+    }
+    return true;
+}
+
+/*!
+    \internal
+
+    Maps the segment referred to by \a fd a second time at \a address,
+    without replacing anything mapped there, and drops the old mapping.
+    On failure the old mapping is kept.
+  */
+bool QSharedMemoryPrivate::mapDescriptorAt(int fd, void *address)
+{
+#ifdef MAP_FIXED_NOREPLACE
+    const int flags = MAP_SHARED | MAP_FIXED_NOREPLACE;
+#else
+    // without MAP_FIXED_NOREPLACE the address is only a hint, checked below
+    const int flags = MAP_SHARED;
 #endif
-    memory(nullptr), size(0), error(QSharedMemory::NoError),
-#ifndef QT_NO_SYSTEMSEMAPHORE
-      systemSemaphore(QString()), lockedByMe(false),
+    void *mapped = ::mmap(address, size_t(size), PROT_READ | PROT_WRITE, flags, fd, 0);
+    if (mapped == MAP_FAILED || mapped != address) {
+        if (mapped == MAP_FAILED && errno != EEXIST) {
+            setErrorString("QSharedMemory::attach (mmap)");
+        } else {
+            errorString = "QSharedMemory::attach (mmap): the fixed address range is in use";
+            error = QSharedMemory::OutOfResources;
+        }
+        if (mapped != MAP_FAILED)
+            ::munmap(mapped, size_t(size));
+        return false;
+    }
+
+    ::munmap(memory, size_t(size));
+    memory = mapped;
+    return true;
+}
+
+/*!
+    \internal
+
+    Applies the mapping options that act on an established mapping. \a mode
+    is the access mode of the mapping.
+  */
+bool QSharedMemoryPrivate::applyMappingOptions(QSharedMemory::AccessMode mode)
+{
+    prefaultedPages = 0;
+    prefaultTime = std::chrono::nanoseconds(0);
+
+#ifdef MADV_HUGEPAGE
+    if ((attachedOptions & QSharedMemory::TransparentHugePages) && !hugePageSize(attachedOptions)
+            && ::madvise(memory, size_t(size), MADV_HUGEPAGE) == -1) {
+        errorString = "QSharedMemory::attach (madvise): transparent huge pages are not available";
+        error = QSharedMemory::OutOfResources;
+        return false;
+    }
+#else
+    if (attachedOptions & QSharedMemory::TransparentHugePages) {
+        errorString = "QSharedMemory::attach: transparent huge pages are not supported on this platform";
+        error = QSharedMemory::UnknownError;
+        return false;
+    }
 #endif
-#ifndef QT_POSIX_IPC
-      unix_key(0)
+    if (attachedOptions & (QSharedMemory::Prefault | QSharedMemory::LockInMemory))
+        return prefault(mode);
+    return true;
+}
+
+/*!
+    \internal
+
+    Grows the segment to hold \a size bytes of data and bumps the generation
+    in the header, so that other attachments remap on their next access.
+  */
+bool QSharedMemoryPrivate::resize(qint64 size, const std::string &function)
+{
+    const qint64 newSize = segmentSize(size, function);
+    if (!newSize)
+        return false;
+    if (newSize < this->size) {
+        error = QSharedMemory::InvalidSize;
+        errorString = function + ": segments can only grow";
+        return false;
+    }
+    if (newSize == this->size)
+        return true;
+
+    const int fd = segmentDescriptor();
+    if (fd == -1) {
+        error = QSharedMemory::UnknownError;
+        errorString = function + ": System V segments can't be resized";
+        return false;
+    }
+
+    int ret;
+    EINTR_LOOP(ret, ::ftruncate(fd, off_t(newSize)));
+    if (ret == -1) {
+        setErrorString(function + " (ftruncate)");
+        return false;
+    }
+    if (hugePageSize(attachedOptions)) {
+        EINTR_LOOP(ret, ::fallocate(fd, 0, off_t(this->size), off_t(newSize - this->size)));
+        if (ret == -1) {
+            if (!setHugePageError(function + " (fallocate)"))
+                setErrorString(function + " (fallocate)");
+            return false;
+        }
+    }
+
+    // the change watcher sleeps on a word in the header, which may move
+    const bool watching = stopChangeWatcher();
+    const bool remapped = remapSegment(newSize, function);
+    if (watching)
+        startChangeWatcher();
+    if (!remapped)
+        return false;
+    header->segmentSize.store(uint64_t(newSize), std::memory_order_relaxed);
+    generation = header->generation.fetch_add(1, std::memory_order_release) + 1;
+
+    // the policy covers the mapped range, extend it to the new pages
+    return applyNumaPolicy(false);
+}
+
+/*!
+    \internal
+
+    Moves the mapping to \a newSize bytes, keeping the data of a ReadOnly
+    attachment read-only.
+  */
+bool QSharedMemoryPrivate::remapSegment(qint64 newSize, const std::string &function)
+{
+#ifdef MREMAP_MAYMOVE
+    if (accessMode == QSharedMemory::CopyOnWrite && header && size > headerSize)
+        return remapPrivate(newSize, function);
+
+    // mremap() can't move a range split by mprotect(), so the protected data
+    // of a ReadOnly attachment is made writable again for the move
+    char *data = static_cast<char *>(memory) + headerSize;
+    const bool split = accessMode == QSharedMemory::ReadOnly && header && size > headerSize
+            && !hugePageSize(attachedOptions);
+    if (split && ::mprotect(data, size_t(size - headerSize), PROT_READ | PROT_WRITE) == -1) {
+        setErrorString(function + " (mprotect)");
+        return false;
+    }
+
+    // pointers into a FixedAddress segment must stay valid, grow it in place
+    const int flags = (attachedOptions & QSharedMemory::FixedAddress) ? 0 : MREMAP_MAYMOVE;
+    void *address = ::mremap(memory, size_t(size), size_t(newSize), flags);
+    if (address == MAP_FAILED) {
+        setErrorString(function + " (mremap)");
+        if (split)
+            protect(data, size_t(size - headerSize));
+        return false;
+    }
+    memory = address;
+    size = newSize;
+    header = static_cast<QSharedMemoryHeader *>(memory);
+    return !split || protect(static_cast<char *>(memory) + headerSize, size_t(size - headerSize));
 #else
-      hand(-1)
+    (void)newSize;
+    error = QSharedMemory::UnknownError;
+    errorString = function + ": segments can't be remapped on this platform";
+    return false;
 #endif
+}
+
+/*!
+    \internal
+
+    remapSegment() for a CopyOnWrite attachment: its shared header and
+    private data are separate mappings, which mremap() can't move as one.
+    Each part is moved on its own into a range reserved for the new size,
+    so the private copies of modified pages move along, and the part the
+    segment grew by is mapped privately after them. A FixedAddress
+    attachment only maps the new part in place.
+  */
+bool QSharedMemoryPrivate::remapPrivate(qint64 newSize, const std::string &function)
 {
+#ifdef MREMAP_FIXED
+    const int fd = segmentDescriptor();
+    const size_t dataSize = size_t(size - headerSize);
+    const bool inPlace = attachedOptions & QSharedMemory::FixedAddress;
+    char *target = static_cast<char *>(memory);
+    if (!inPlace) {
+        void *reserved = ::mmap(nullptr, size_t(newSize), PROT_NONE,
+                                MAP_PRIVATE | MAP_ANONYMOUS | MAP_NORESERVE, -1, 0);
+        if (reserved == MAP_FAILED) {
+            setErrorString(function + " (mmap)");
+            return false;
+        }
+        target = static_cast<char *>(reserved);
+        if (::mremap(memory, size_t(headerSize), size_t(headerSize), MREMAP_MAYMOVE | MREMAP_FIXED,
+                     target) == MAP_FAILED) {
+            setErrorString(function + " (mremap)");
+            ::munmap(target, size_t(newSize));
+            return false;
+        }
+        if (::mremap(static_cast<char *>(memory) + headerSize, dataSize, dataSize,
+                     MREMAP_MAYMOVE | MREMAP_FIXED, target + headerSize) == MAP_FAILED) {
+            setErrorString(function + " (mremap)");
+            // the old range of the header is free, put it back
+            ::mremap(target, size_t(headerSize), size_t(headerSize), MREMAP_MAYMOVE | MREMAP_FIXED, memory);
+            ::munmap(target, size_t(newSize));
+            return false;
+        }
+        memory = target;
+        header = static_cast<QSharedMemoryHeader *>(memory);
+    }
+
+#ifdef MAP_FIXED_NOREPLACE
+    const int flags = MAP_PRIVATE | (inPlace ? MAP_FIXED_NOREPLACE : MAP_FIXED);
+#else
+    const int flags = MAP_PRIVATE | (inPlace ? 0 : MAP_FIXED);
+#endif
+    void *grown = ::mmap(target + size, size_t(newSize - size), PROT_READ | PROT_WRITE, flags, fd, off_t(size));
+    if (grown != target + size) {
+        if (grown == MAP_FAILED && (!inPlace || errno != EEXIST)) {
+            setErrorString(function + " (mmap)");
+        } else {
+            error = QSharedMemory::OutOfResources;
+            errorString = function + ": address range is in use";
+        }
+        if (grown != MAP_FAILED)
+            ::munmap(grown, size_t(newSize - size));
+        // the mapping moved, but keeps its old size
+        if (!inPlace)
+            ::munmap(target + size, size_t(newSize - size));
+        return false;
+    }
+    size = newSize;
+    return true;
+#else
+    (void)newSize;
+    error = QSharedMemory::UnknownError;
+    errorString = function + ": copy-on-write segments can't be remapped on this platform";
+    return false;
+#endif
 }
 
-void QSharedMemoryPrivate::setErrorString(QLatin1String function)
+/*!
+    \internal
+
+    Opens the backing file \a fileName of a file-backed segment, creating it
+    with \a size bytes if \a size is not 0. The descriptor is kept in memfd
+    so the file is mapped like an anonymous segment, but it is never removed.
+
+    Every attachment holds a shared flock() on the file. Without any the
+    lock words in the header are left over from processes that are gone and
+    soleFileUser is set. Checking that and resetting the header must not
+    race with another attachment, so it happens under an exclusive flock()
+    on the guard file fileName + ".lock", which openFile() keeps until
+    shareFile(). A creator holds it until the header is initialized.
+  */
+bool QSharedMemoryPrivate::openFile(const std::string &fileName, qint64 size, QSharedMemory::AccessMode mode)
+{
+    const std::string function = size ? "QSharedMemory::createFile" : "QSharedMemory::attachFile";
+    const int oflag = (size ? O_CREAT | O_EXCL : 0)
+            | (mode == QSharedMemory::ReadWrite ? O_RDWR : O_RDONLY) | O_CLOEXEC;
+
+    // a creator takes the guard first, attachments could see its new
+    // file before it has a size and a header
+    int fd = -1;
+    if (!size) {
+        EINTR_LOOP(fd, ::open(fileName.c_str(), oflag, 0600));
+        if (fd == -1) {
+            setErrorString(function + " (open)");
+            return false;
+        }
+    }
+
+    // the guard file is never removed, a waiter could lock a stale one
+    EINTR_LOOP(fileGuard, ::open((fileName + ".lock").c_str(), O_RDONLY | O_CREAT | O_CLOEXEC, 0600));
+    int ret = fileGuard;
+    if (fileGuard != -1)
+        EINTR_LOOP(ret, ::flock(fileGuard, LOCK_EX));
+    if (ret == -1) {
+        setErrorString(function + (fileGuard == -1 ? " (open)" : " (flock)"));
+        if (fd != -1)
+            qt_safe_close(fd);
+        shareFile();
+        return false;
+    }
+
+    if (size) {
+        EINTR_LOOP(fd, ::open(fileName.c_str(), oflag, 0600));
+        if (fd == -1) {
+            setErrorString(function + " (open)");
+            shareFile();
+            return false;
+        }
+        EINTR_LOOP(ret, ::ftruncate(fd, off_t(size)));
+        if (ret == -1) {
+            setErrorString(function + " (ftruncate)");
+            qt_safe_close(fd);
+            ::unlink(fileName.c_str());
+            shareFile();
+            return false;
+        }
+    }
+
+    // other attachments wait for the guard, so nobody slips in while the
+    // exclusive lock is traded for a shared one
+    EINTR_LOOP(ret, ::flock(fd, LOCK_EX | LOCK_NB));
+    soleFileUser = (ret == 0);
+    EINTR_LOOP(ret, ::flock(fd, LOCK_SH));
+    if (ret == -1) {
+        setErrorString(function + " (flock)");
+        qt_safe_close(fd);
+        if (size)
+            ::unlink(fileName.c_str());
+        shareFile();
+        return false;
+    }
+
+    memfd = fd;
+    return true;
+}
+
+/*!
+    \internal
+
+    Releases the guard lock openFile() took, which lets other processes
+    attach the file. Does nothing if the guard isn't held.
+  */
+bool QSharedMemoryPrivate::shareFile()
+{
+    soleFileUser = false;
+    if (fileGuard == -1)
+        return true;
+    // closing the only descriptor of the guard drops its lock
+    qt_safe_close(fileGuard);
+    fileGuard = -1;
+    return true;
+}
+
+/*!
+    \internal
+
+    Writes the dirty pages of the mapping back to the backing store.
+  */
+bool QSharedMemoryPrivate::flush(QSharedMemory::FlushMode mode)
+{
+    if (::msync(memory, size_t(size), mode == QSharedMemory::SyncFlush ? MS_SYNC : MS_ASYNC) == -1) {
+        setErrorString("QSharedMemory::flush (msync)");
+        return false;
+    }
+    return true;
+}
+
+/*!
+    \internal
+
+    Starts the thread that turns changes of the change generation into
+    eventfd counts: it sleeps on the generation like waitForChange() and
+    adds the number of notify() calls it missed to the eventfd, so a burst
+    of notifications coalesces into one readable event.
+  */
+bool QSharedMemoryPrivate::startChangeWatcher()
+{
+#if defined(__linux__)
+    if (changeEventFd == -1) {
+        changeEventFd = ::eventfd(0, EFD_CLOEXEC | EFD_NONBLOCK);
+        if (changeEventFd == -1) {
+            setErrorString("QSharedMemory::notificationDescriptor (eventfd)");
+            return false;
+        }
+        changeWatcherSeen = header->changeGeneration.load();
+    }
+    if (changeWatcher.joinable())
+        return true;
+
+    changeWatcherStop = false;
+    changeWatcherDone = false;
+    changeWatcher = std::thread([this]() {
+        std::atomic<uint32_t> &generation = header->changeGeneration;
+        uint32_t seen = changeWatcherSeen;
+        header->changeWaiters.fetch_add(1);
+        while (!changeWatcherStop.load()) {
+            const uint32_t current = generation.load();
+            if (current == seen) {
+                QtFutex::futexWait(generation, seen);
+                continue;
+            }
+            const uint64_t count = uint32_t(current - seen);
+            seen = current;
+            ssize_t ret;
+            EINTR_LOOP(ret, ::write(changeEventFd, &count, sizeof(count)));
+        }
+        header->changeWaiters.fetch_sub(1);
+        changeWatcherSeen = seen;
+        changeWatcherDone = true;
+    });
+    return true;
+#else
+    error = QSharedMemory::UnknownError;
+    errorString = "QSharedMemory::notificationDescriptor: not supported on this platform";
+    return false;
+#endif
+}
+
+/*!
+    \internal
+
+    Stops the change watcher before the header moves or goes away and
+    returns \c true if it was running. The watcher may be just about to
+    sleep when it is told to stop, so it is woken until it is gone; other
+    sleepers on the generation see it unchanged and sleep again.
+  */
+bool QSharedMemoryPrivate::stopChangeWatcher()
+{
+    if (!changeWatcher.joinable())
+        return false;
+    changeWatcherStop = true;
+    while (!changeWatcherDone.load()) {
+        QtFutex::futexWakeAll(header->changeGeneration);
+        std::this_thread::sleep_for(std::chrono::microseconds(50));
+    }
+    changeWatcher.join();
+    return true;
+}
+
+void QSharedMemoryPrivate::closeChangeDescriptor()
+{
+    stopChangeWatcher();
+    if (changeEventFd != -1)
+        qt_safe_close(changeEventFd);
+    changeEventFd = -1;
+}
+
+/*!
+    \internal
+
+    Resets the eventfd and returns how many notifications it counted.
+  */
+quint64 QSharedMemoryPrivate::drainChangeDescriptor()
+{
+    uint64_t count = 0;
+    ssize_t ret;
+    EINTR_LOOP(ret, ::read(changeEventFd, &count, sizeof(count)));
+    return ret == ssize_t(sizeof(count)) ? quint64(count) : 0;
+}
+
+qint64 QSharedMemoryPrivate::currentProcessId()
+{
+    return qint64(::getpid());
+}
+
+/*!
+    \internal
+
+    Initializes the process-shared robust mutex of a RobustLock header. If
+    a process dies holding it, the kernel hands it to the next locker with
+    EOWNERDEAD instead of leaving everybody blocked.
+  */
+bool QSharedMemoryPrivate::initRobustLock()
+{
+    pthread_mutexattr_t attr;
+    int ret = pthread_mutexattr_init(&attr);
+    if (ret == 0)
+        ret = pthread_mutexattr_setpshared(&attr, PTHREAD_PROCESS_SHARED);
+    if (ret == 0)
+        ret = pthread_mutexattr_setrobust(&attr, PTHREAD_MUTEX_ROBUST);
+    if (ret == 0)
+        ret = pthread_mutex_init(&header->robustMutex, &attr);
+    pthread_mutexattr_destroy(&attr);
+    if (ret != 0) {
+        errno = ret;
+        setErrorString("QSharedMemory::create (pthread_mutex_init)");
+        return false;
+    }
+    return true;
+}
+
+/*!
+    \internal
+
+    Locks the robust mutex, waiting at most \a timeout. Returns 0,
+    EOWNERDEAD if the previous owner died holding it, ETIMEDOUT, or the
+    error of the pthread call.
+  */
+int QSharedMemoryPrivate::robustLock(std::chrono::nanoseconds timeout)
+{
+    int ret;
+    if (timeout == std::chrono::nanoseconds::max()) {
+        ret = pthread_mutex_lock(&header->robustMutex);
+    } else if (timeout == std::chrono::nanoseconds(0)) {
+        ret = pthread_mutex_trylock(&header->robustMutex);
+    } else {
+        // pthread_mutex_timedlock() takes an absolute CLOCK_REALTIME deadline
+        const auto deadline = std::chrono::system_clock::now().time_since_epoch()
+                + std::chrono::duration_cast<std::chrono::system_clock::duration>(timeout);
+        const auto seconds = std::chrono::duration_cast<std::chrono::seconds>(deadline);
+        struct timespec ts;
+        ts.tv_sec = time_t(seconds.count());
+        ts.tv_nsec = long(std::chrono::duration_cast<std::chrono::nanoseconds>(deadline - seconds).count());
+        ret = pthread_mutex_timedlock(&header->robustMutex, &ts);
+    }
+    return ret == EBUSY ? ETIMEDOUT : ret;
+}
+
+bool QSharedMemoryPrivate::robustUnlock()
+{
+    return pthread_mutex_unlock(&header->robustMutex) == 0;
+}
+
+void QSharedMemoryPrivate::robustMarkConsistent()
+{
+    pthread_mutex_consistent(&header->robustMutex);
+}
+
+static qint64 threadPageFaults()
+{
+    struct rusage usage;
+#ifdef RUSAGE_THREAD
+    if (::getrusage(RUSAGE_THREAD, &usage) == -1)
+#else
+    if (::getrusage(RUSAGE_SELF, &usage) == -1)
+#endif
+        return 0;
+    return qint64(usage.ru_minflt) + qint64(usage.ru_majflt);
+}
+
+/*!
+    \internal
+
+    Faults in every page of the mapping up front, so that the first access
+    doesn't take a page fault, and locks the mapping in memory if requested.
+    The number of page faults taken and the time spent are recorded.
+
+    MAP_POPULATE only exists for mmap() and not for shmat(), so the pages
+    are populated with madvise() on the established mapping, or touched one
+    by one on kernels without MADV_POPULATE_READ/WRITE.
+  */
+bool QSharedMemoryPrivate::prefault(QSharedMemory::AccessMode mode)
+{
+    const auto start = std::chrono::steady_clock::now();
+    const qint64 faults = threadPageFaults();
+
+    if (attachedOptions & QSharedMemory::LockInMemory) {
+        // mlock() faults the pages in as well
+        if (::mlock(memory, size_t(size)) == -1) {
+            if (errno == ENOMEM || errno == EPERM || errno == EAGAIN) {
+                errorString = "QSharedMemory::attach (mlock): unable to lock the segment in memory";
+                error = QSharedMemory::OutOfResources;
+            } else {
+                setErrorString("QSharedMemory::attach (mlock)");
+            }
+            return false;
+        }
+    } else {
+        int ret = -1;
+#if defined(MADV_POPULATE_READ) && defined(MADV_POPULATE_WRITE)
+        // populating a copy-on-write mapping for writing would copy every page
+        ret = ::madvise(memory, size_t(size),
+                        mode == QSharedMemory::ReadWrite ? MADV_POPULATE_WRITE : MADV_POPULATE_READ);
+        if (ret == -1 && errno != EINVAL) {
+            if (!setHugePageError("QSharedMemory::attach (madvise)"))
+                setErrorString("QSharedMemory::attach (madvise)");
+            return false;
+        }
+#endif
+        if (ret == -1) {
+            const size_t page = hugePageSize(attachedOptions) ? hugePageSize(attachedOptions) : size_t(pageSize());
+            // only read: writing back could lose a concurrent write
+            const volatile char *p = static_cast<const volatile char *>(memory);
+            for (size_t offset = 0; offset < size_t(size); offset += page)
+                (void)p[offset];
+        }
+    }
+
+    prefaultedPages = threadPageFaults() - faults;
+    prefaultTime = std::chrono::duration_cast<std::chrono::nanoseconds>(std::chrono::steady_clock::now() - start);
+    return true;
+}
+
+/*!
+    \internal
+
+    Reports a failed huge page allocation in \a function, if the error
+    came from an exhausted pool.
+  */
+bool QSharedMemoryPrivate::setHugePageError(const std::string &function)
+{
+    if (!hugePageSize(attachedOptions) || (errno != ENOMEM && errno != ENOSPC))
+        return false;
+    errorString = function + ": huge page pool exhausted";
+    error = QSharedMemory::OutOfResources;
+    return true;
+}
+
+void QSharedMemoryPrivate::setErrorString(const std::string &function)
 {
     // EINVAL is handled in functions so they can give better error strings
     switch (errno) {
     case EACCES:
-        errorString = QSharedMemory::tr("%1: permission denied").arg(function);
+        errorString = function + ": permission denied";
         error = QSharedMemory::PermissionDenied;
         break;
     case EEXIST:
-        errorString = QSharedMemory::tr("%1: already exists").arg(function);
+        errorString = function + ": already exists";
         error = QSharedMemory::AlreadyExists;
         break;
     case ENOENT:
-        errorString = QSharedMemory::tr("%1: doesn't exist").arg(function);
+        errorString = function + ": doesn't exist";
         error = QSharedMemory::NotFound;
         break;
     case EMFILE:
     case ENOMEM:
     case ENOSPC:
-        errorString = QSharedMemory::tr("%1: out of resources").arg(function);
+        errorString = function + ": out of resources";
         error = QSharedMemory::OutOfResources;
         break;
     default:
-        errorString = QSharedMemory::tr("%1: unknown error %2").arg(function).arg(errno);
+        errorString = function + ": unknown error " + std::to_string(errno);
         error = QSharedMemory::UnknownError;
-#if defined QSHAREDMEMORY_DEBUG
-        qDebug() << errorString << "key" << key << "errno" << errno << EINVAL;
-#endif
     }
 }
-
-QT_END_NAMESPACE
-
-#endif // QT_NO_SHAREDMEMORY
@@ -44,7 +44,17 @@
 
 QSharedMemoryPrivate::QSharedMemoryPrivate() :
         memory(nullptr), size(0), error(QSharedMemory::NoError),
-           systemSemaphore(std::string()), lockedByMe(false), hand(nullptr)
+           systemSemaphore(std::string()), lockOwnership(QSharedMemory::ProcessOwnership),
+    instanceId(newInstanceId()), heldLocks(0), preferWriters(true),
+    spinTime(0), collectStatistics(false), stripeCount(QSharedMemoryHeader::MaxLockStripes), stripeSize(4096), spinAcquires(0), blockedAcquires(0),
+           lockMode(QSharedMemory::SystemSemaphoreLock), header(nullptr), headerSize(0),
+           generation(0), accessMode(QSharedMemory::ReadWrite), memfd(-1), soleFileUser(false), fileGuard(-1),
+    changeEventFd(-1), changeWatcherStop(false), changeWatcherDone(false), changeWatcherSeen(0),
+           mappingOptions(QSharedMemory::NoMappingOption), attachedOptions(QSharedMemory::NoMappingOption),
+           requestedAddress(nullptr),
+           prefaultedPages(0), prefaultTime(0),
+           numaPolicy(QSharedMemory::NumaDefault), numaReplicas(false), readReplica(nullptr), readReplicaNode(-1),
+           hand(nullptr)
 {
 }
 
@@ -81,6 +91,138 @@ void QSharedMemoryPrivate::setErrorString(const std::string &function)
     }
 }
 
+int QSharedMemoryPrivate::pageSize()
+{
+    SYSTEM_INFO info;
+    GetSystemInfo(&info);
+    return int(info.dwPageSize);
+}
+
+bool QSharedMemoryPrivate::protect(void *address, size_t length)
+{
+    DWORD oldProtect;
+    if (!VirtualProtect(address, length, PAGE_READONLY, &oldProtect)) {
+        setErrorString("QSharedMemory::attach");
+        return false;
+    }
+    return true;
+}
+
+bool QSharedMemoryPrivate::applyMappingOptions(QSharedMemory::AccessMode)
+{
+    if (attachedOptions != QSharedMemory::NoMappingOption) {
+        error = QSharedMemory::UnknownError;
+        errorString = "QSharedMemory::attach: mapping options are not supported on this platform";
+        return false;
+    }
+    return true;
+}
+
+bool QSharedMemoryPrivate::openFile(const std::string &, qint64 size, QSharedMemory::AccessMode)
+{
+    error = QSharedMemory::UnknownError;
+    errorString = std::string(size ? "QSharedMemory::createFile" : "QSharedMemory::attachFile")
+            + ": file-backed segments are not supported on this platform";
+    return false;
+}
+
+bool QSharedMemoryPrivate::shareFile()
+{
+    return true;
+}
+
+bool QSharedMemoryPrivate::flush(QSharedMemory::FlushMode)
+{
+    // FlushViewOfFile() does not wait for the disk, there is no file handle
+    // to FlushFileBuffers() on for pagefile backed mappings
+    if (!FlushViewOfFile(memory, 0)) {
+        setErrorString("QSharedMemory::flush");
+        return false;
+    }
+    return true;
+}
+
+bool QSharedMemoryPrivate::mapPrivate(qint64)
+{
+    // views can only start at the allocation granularity, the header is smaller
+    error = QSharedMemory::UnknownError;
+    errorString = "QSharedMemory::attach: copy-on-write needs the SystemSemaphoreLock mode on this platform";
+    return false;
+}
+
+bool QSharedMemoryPrivate::moveMapping(void *)
+{
+    error = QSharedMemory::UnknownError;
+    errorString = "QSharedMemory::attach: fixed addresses are not supported on this platform";
+    return false;
+}
+
+bool QSharedMemoryPrivate::startChangeWatcher()
+{
+    error = QSharedMemory::UnknownError;
+    errorString = "QSharedMemory::notificationDescriptor: not supported on this platform";
+    return false;
+}
+
+bool QSharedMemoryPrivate::stopChangeWatcher()
+{
+    return false;
+}
+
+void QSharedMemoryPrivate::closeChangeDescriptor()
+{
+}
+
+quint64 QSharedMemoryPrivate::drainChangeDescriptor()
+{
+    return 0;
+}
+
+qint64 QSharedMemoryPrivate::currentProcessId()
+{
+    return qint64(GetCurrentProcessId());
+}
+
+bool QSharedMemoryPrivate::initRobustLock()
+{
+    error = QSharedMemory::UnknownError;
+    errorString = "QSharedMemory::create: robust locks are not supported on this platform";
+    return false;
+}
+
+int QSharedMemoryPrivate::robustLock(std::chrono::nanoseconds)
+{
+    return ENOTSUP;
+}
+
+bool QSharedMemoryPrivate::robustUnlock()
+{
+    return false;
+}
+
+void QSharedMemoryPrivate::robustMarkConsistent()
+{
+}
+
+int QSharedMemoryPrivate::segmentDescriptor() const
+{
+    return -1;
+}
+
+bool QSharedMemoryPrivate::resize(qint64, const std::string &function)
+{
+    error = QSharedMemory::UnknownError;
+    errorString = function + ": segments can't be resized on this platform";
+    return false;
+}
+
+bool QSharedMemoryPrivate::remapSegment(qint64, const std::string &function)
+{
+    error = QSharedMemory::UnknownError;
+    errorString = function + ": segments can't be remapped on this platform";
+    return false;
+}
+
 HANDLE QSharedMemoryPrivate::handle()
 {
     if (!hand) {
@@ -110,7 +252,7 @@ bool QSharedMemoryPrivate::cleanHandle()
     return true;
 }
 
-bool QSharedMemoryPrivate::create(int sz)
+bool QSharedMemoryPrivate::create(qint64 sz)
 {
     const std::string function("QSharedMemory::create");
     if (nativeKey.empty()) {
@@ -119,7 +261,8 @@ bool QSharedMemoryPrivate::create(int sz)
         return false;
     }
 
-    hand = CreateFileMapping(INVALID_HANDLE_VALUE, nullptr, PAGE_READWRITE, 0, sz, nativeKey.c_str());
+    hand = CreateFileMapping(INVALID_HANDLE_VALUE, nullptr, PAGE_READWRITE,
+                             DWORD(quint64(sz) >> 32), DWORD(quint64(sz) & 0xffffffff), nativeKey.c_str());
     setErrorString(function);
 
     // hand is valid when it already exists unlike unix so explicitly check
@@ -129,7 +272,8 @@ bool QSharedMemoryPrivate::create(int sz)
 bool QSharedMemoryPrivate::attach(QSharedMemory::AccessMode mode)
 {
     // Grab a pointer to the memory block
-    int permissions = (mode == QSharedMemory::ReadOnly ? FILE_MAP_READ : FILE_MAP_ALL_ACCESS);
+    int permissions = (mode == QSharedMemory::ReadOnly ? FILE_MAP_READ
+                       : mode == QSharedMemory::CopyOnWrite ? FILE_MAP_COPY : FILE_MAP_ALL_ACCESS);
     memory = (void *)MapViewOfFile(handle(), permissions, 0, 0, 0);
     if (nullptr == memory) {
         setErrorString("QSharedMemory::attach");
@@ -146,7 +290,7 @@ bool QSharedMemoryPrivate::attach(QSharedMemory::AccessMode mode)
         errorString = "QSharedMemory::attach: size query failed";
         return false;
     }
-    size = int(info.RegionSize);
+    size = qint64(info.RegionSize);
 
     return true;
 }
@@ -0,0 +1,570 @@
+/****************************************************************************
+**
+** Copyright (C) 2016 The Qt Company Ltd.
+** Contact: https://www.qt.io/licensing/
+**
+** This file is part of the QtCore module of the Qt Toolkit.
+**
+** $QT_BEGIN_LICENSE:LGPL$
+** Commercial License Usage
+** Licensees holding valid commercial Qt licenses may use this file in
+** accordance with the commercial license agreement provided with the
+** Software or, alternatively, in accordance with the terms contained in
+** a written agreement between you and The Qt Company. For licensing terms
+** and conditions see https://www.qt.io/terms-conditions. For further
+** information use the contact form at https://www.qt.io/contact-us.
+**
+** GNU Lesser General Public License Usage
+** Alternatively, this file may be used under the terms of the GNU Lesser
+** General Public License version 3 as published by the Free Software
+** Foundation and appearing in the file LICENSE.LGPL3 included in the
+** packaging of this file. Please review the following information to
+** ensure the GNU Lesser General Public License version 3 requirements
+** will be met: https://www.gnu.org/licenses/lgpl-3.0.html.
+**
+** GNU General Public License Usage
+** Alternatively, this file may be used under the terms of the GNU
+** General Public License version 2.0 or (at your option) the GNU General
+** Public license version 3 or any later version approved by the KDE Free
+** Qt Foundation. The licenses are as published by the Free Software
+** Foundation and appearing in the file LICENSE.GPL2 and LICENSE.GPL3
+** included in the packaging of this file. Please review the following
+** information to ensure the GNU General Public License requirements will
+** be met: https://www.gnu.org/licenses/gpl-2.0.html and
+** https://www.gnu.org/licenses/gpl-3.0.html.
+**
+** $QT_END_LICENSE$
+**
+****************************************************************************/
+
+#include "qsharedringbuffer.h"
+#include "qsharedringbuffer_p.h"
+#include "qsharedmemory.h"
+
+#include "qfutex_p.h"
+
+#include <algorithm>
+#include <cstring>
+#include <limits>
+
+/*!
+  \class QSharedRingBuffer
+  \inmodule QtCore
+
+  \brief The QSharedRingBuffer class streams variable-length messages from
+  one producer to one consumer through a shared memory segment.
+
+  The ring buffer is layered on the data() of a QSharedMemory segment the
+  caller created or attached. One process formats it with initialize(),
+  the other one attach()es to it afterwards; the segment must be mapped
+  ReadWrite on both sides and must not be resized while in use.
+
+  Exactly one producer and one consumer may use a ring at a time, so
+  neither side ever takes a lock: the producer only moves the tail index,
+  the consumer only moves the head index, and each index lives on a cache
+  line of its own. Both sides remember their last look at the other
+  side's index and only read it again when it runs out, which keeps the
+  cache lines from bouncing while the ring is neither full nor empty.
+
+  The producer asks for contiguous space with reserve(), builds the
+  message in place and publishes it with commit(); write() copies a ready
+  message. A message never wraps around the end of the ring, so it can
+  be read and written as one piece of memory.
+
+  The consumer takes all messages available, up to a limit, with a
+  single read(), which hands each one to a callback and frees them with
+  one store, or takes a single message with readInto().
+
+  Both sides can wait for space or messages with a timeout. A waiting
+  side sleeps on a futex and is woken by the other one; the other side
+  only enters the kernel while someone waits.
+
+  \sa QSharedMemory
+ */
+
+/*!
+  Constructs a ring buffer on \a sharedMemory. It can be used once the
+  segment is formatted with initialize() or attached with attach().
+
+  \sa setSharedMemory()
+ */
+QSharedRingBuffer::QSharedRingBuffer(QSharedMemory *sharedMemory)
+    : d(new QSharedRingBufferPrivate)
+{
+    d->sharedMemory = sharedMemory;
+}
+
+/*!
+  Destroys the ring buffer. The segment isn't touched.
+ */
+QSharedRingBuffer::~QSharedRingBuffer()
+{
+}
+
+/*!
+  Sets the segment of the ring buffer to \a sharedMemory and detaches
+  from the current one.
+
+  \sa sharedMemory()
+ */
+void QSharedRingBuffer::setSharedMemory(QSharedMemory *sharedMemory)
+{
+    detach();
+    d->sharedMemory = sharedMemory;
+}
+
+/*!
+  Returns the segment of the ring buffer.
+
+  \sa setSharedMemory()
+ */
+QSharedMemory *QSharedRingBuffer::sharedMemory() const
+{
+    return d->sharedMemory;
+}
+
+/*!
+  Formats the data of the segment as an empty ring and attaches to it.
+  The ring gets the largest power of two of bytes that fits after its
+  header. Returns \c false if the segment isn't attached or too small.
+
+  Call this once, before the other side calls attach(); formatting a ring
+  in use discards its messages.
+
+  \sa attach()
+ */
+bool QSharedRingBuffer::initialize()
+{
+    const std::string function = "QSharedRingBuffer::initialize";
+    if (!d->isMapped(function))
+        return false;
+    const qint64 available = d->sharedMemory->size() - qint64(sizeof(QSharedRingBufferHeader));
+    if (available < 64) {
+        d->setError(InvalidSize, function + ": segment is too small");
+        return false;
+    }
+    uint64_t capacity = 64;
+    while (capacity * 2 <= uint64_t(available))
+        capacity *= 2;
+
+    QSharedRingBufferHeader *header = static_cast<QSharedRingBufferHeader *>(d->sharedMemory->data());
+    header->version = QSharedRingBufferHeader::Version;
+    header->capacity = capacity;
+    header->tail.store(0, std::memory_order_relaxed);
+    header->consumerWaiting.store(0, std::memory_order_relaxed);
+    header->head.store(0, std::memory_order_relaxed);
+    header->producerWaiting.store(0, std::memory_order_relaxed);
+    header->magic.store(QSharedRingBufferHeader::Magic, std::memory_order_release);
+    return attach();
+}
+
+/*!
+  Attaches to the ring formatted in the segment by initialize(). Returns
+  \c false if the segment isn't attached or holds no ring.
+
+  \sa initialize(), detach()
+ */
+bool QSharedRingBuffer::attach()
+{
+    const std::string function = "QSharedRingBuffer::attach";
+    if (!d->isMapped(function))
+        return false;
+    QSharedRingBufferHeader *header = static_cast<QSharedRingBufferHeader *>(d->sharedMemory->data());
+    const qint64 available = d->sharedMemory->size() - qint64(sizeof(QSharedRingBufferHeader));
+    if (available < 64 || header->magic.load(std::memory_order_acquire) != QSharedRingBufferHeader::Magic
+            || header->version != QSharedRingBufferHeader::Version
+            || (header->capacity & (header->capacity - 1)) != 0
+            || header->capacity > uint64_t(available)) {
+        d->setError(InvalidFormat, function + ": segment holds no ring buffer");
+        return false;
+    }
+
+    d->header = header;
+    d->ring = reinterpret_cast<char *>(header + 1);
+    d->capacity = header->capacity;
+    d->mask = d->capacity - 1;
+    d->tail = d->cachedTail = header->tail.load(std::memory_order_acquire);
+    d->head = d->cachedHead = header->head.load(std::memory_order_acquire);
+    d->reservedSize = -1;
+    d->clearError();
+    return true;
+}
+
+/*!
+  Returns \c true if the ring buffer is attached to a ring.
+
+  \sa attach()
+ */
+bool QSharedRingBuffer::isAttached() const
+{
+    return d->header != nullptr;
+}
+
+/*!
+  Detaches from the ring; a pending reservation is dropped. The ring and
+  its messages stay in the segment.
+ */
+void QSharedRingBuffer::detach()
+{
+    d->header = nullptr;
+    d->ring = nullptr;
+    d->capacity = d->mask = 0;
+    d->reservedSize = -1;
+}
+
+/*!
+  Returns the number of bytes of the ring, or 0 if not attached. Every
+  message takes its size plus an eight byte record header, rounded up to
+  a multiple of eight.
+ */
+qint64 QSharedRingBuffer::capacity() const
+{
+    return qint64(d->capacity);
+}
+
+/*!
+  Returns the size of the largest message, half of the ring minus the
+  record header. Larger messages could need a padding record that fills
+  the rest of the ring and then not fit at its start either. The record
+  header stores the size in 32 bits, so rings of 8 GiB and more are
+  limited to messages of just under 4 GiB.
+ */
+qint64 QSharedRingBuffer::maxMessageSize() const
+{
+    if (!d->capacity)
+        return 0;
+    const uint64_t limit = std::numeric_limits<uint32_t>::max() - sizeof(QSharedRingBufferRecord);
+    return qint64(std::min(d->capacity / 2 - sizeof(QSharedRingBufferRecord), limit));
+}
+
+/*!
+  Returns the number of bytes committed but not read yet, including
+  record headers and padding. It's a snapshot the other side can change
+  at any time.
+ */
+qint64 QSharedRingBuffer::bytesAvailable() const
+{
+    if (!d->header)
+        return 0;
+    const uint64_t head = d->header->head.load(std::memory_order_acquire);
+    return qint64(d->header->tail.load(std::memory_order_acquire) - head);
+}
+
+/*!
+  Returns \c true if no committed message is waiting to be read.
+ */
+bool QSharedRingBuffer::isEmpty() const
+{
+    return bytesAvailable() == 0;
+}
+
+/*!
+  Reserves contiguous space for a message of \a size bytes and returns
+  a pointer to it. The message is invisible to the consumer until
+  commit(); reserving again before that drops the reservation. Only the
+  producer may call this function.
+
+  If the ring is too full, the call waits at most \a timeout for the
+  consumer to make room. With the default timeout of zero it never
+  blocks. Returns \c nullptr and sets the error to Timeout if there was
+  no room in time, or to InvalidSize if \a size exceeds maxMessageSize().
+
+  \sa commit(), write()
+ */
+void *QSharedRingBuffer::reserve(qint64 size, std::chrono::nanoseconds timeout)
+{
+    // hot path, the error texts are only built when needed
+    const char *function = "QSharedRingBuffer::reserve";
+    if (!d->header) {
+        d->setError(NotAttached, std::string(function) + ": not attached");
+        return nullptr;
+    }
+    if (size < 0 || size > maxMessageSize()) {
+        d->setError(InvalidSize, std::string(function) + ": invalid message size");
+        return nullptr;
+    }
+    const uint64_t length = QSharedRingBufferPrivate::recordSize(size);
+    const uint64_t offset = d->tail & d->mask;
+    const uint64_t padding = offset + length > d->capacity ? d->capacity - offset : 0;
+    const uint64_t needed = padding + length;
+    if (d->tail + needed - d->cachedHead > d->capacity) {
+        d->cachedHead = d->header->head.load(std::memory_order_acquire);
+        if (d->tail + needed - d->cachedHead > d->capacity && !d->waitForSpace(function, needed, timeout))
+            return nullptr;
+    }
+
+    if (padding) {
+        QSharedRingBufferRecord *record = d->record(d->tail);
+        record->size = uint32_t(padding);
+        record->type = QSharedRingBufferRecord::Padding;
+    }
+    d->reserved = d->tail + padding;
+    d->reservedSize = size;
+    d->clearError();
+    return d->record(d->reserved) + 1;
+}
+
+/*!
+  Publishes the message built in the space returned by reserve(). Its
+  \a size may be smaller than the reserved size. Wakes the consumer if
+  it waits for a message.
+
+  Returns \c false and sets the error to InvalidSize if nothing was
+  reserved or \a size exceeds the reservation.
+
+  \sa reserve()
+ */
+bool QSharedRingBuffer::commit(qint64 size)
+{
+    const char *function = "QSharedRingBuffer::commit";
+    if (!d->header) {
+        d->setError(NotAttached, std::string(function) + ": not attached");
+        return false;
+    }
+    if (size < 0 || size > d->reservedSize) {
+        d->setError(InvalidSize, std::string(function) + ": size exceeds the reservation");
+        return false;
+    }
+    QSharedRingBufferRecord *record = d->record(d->reserved);
+    record->size = uint32_t(size);
+    record->type = QSharedRingBufferRecord::Message;
+    d->tail = d->reserved + QSharedRingBufferPrivate::recordSize(size);
+    d->reservedSize = -1;
+    d->publishTail();
+    d->clearError();
+    return true;
+}
+
+/*!
+  Copies the message of \a size bytes at \a data into the ring and
+  commits it, waiting at most \a timeout for room like reserve().
+
+  \sa reserve(), commit()
+ */
+bool QSharedRingBuffer::write(const void *data, qint64 size, std::chrono::nanoseconds timeout)
+{
+    void *space = reserve(size, timeout);
+    if (!space)
+        return false;
+    memcpy(space, data, size_t(size));
+    return commit(size);
+}
+
+/*!
+  Hands up to \a maxMessages messages to \a reader one after another,
+  with a pointer to each message and its size, and returns how many
+  there were. The pointer is only valid during the call. The messages
+  are freed together after the last one, which wakes the producer if it
+  waits for room. Only the consumer may call this function.
+
+  If the ring is empty, the call waits at most \a timeout for a message.
+  With the default timeout of zero it never blocks. Returns 0 and sets
+  the error to Timeout if no message arrived in time.
+
+  \sa readInto()
+ */
+int QSharedRingBuffer::read(const std::function<void(const void *data, qint64 size)> &reader,
+                            int maxMessages, std::chrono::nanoseconds timeout)
+{
+    const char *function = "QSharedRingBuffer::read";
+    if (!d->header) {
+        d->setError(NotAttached, std::string(function) + ": not attached");
+        return 0;
+    }
+    if (maxMessages <= 0)
+        return 0;
+    if (d->head == d->cachedTail) {
+        d->cachedTail = d->header->tail.load(std::memory_order_acquire);
+        if (d->head == d->cachedTail && !d->waitForData(function, timeout))
+            return 0;
+    }
+
+    int count = 0;
+    while (d->head != d->cachedTail && count < maxMessages) {
+        const QSharedRingBufferRecord *record = d->record(d->head);
+        if (record->type == QSharedRingBufferRecord::Padding) {
+            d->head += record->size;
+            continue;
+        }
+        reader(record + 1, qint64(record->size));
+        d->head += QSharedRingBufferPrivate::recordSize(record->size);
+        ++count;
+    }
+    d->publishHead();
+    d->clearError();
+    return count;
+}
+
+/*!
+  Copies the next message into \a buffer and returns its size, waiting
+  at most \a timeout for one like read(). Returns -1 and sets the error
+  to InvalidSize, leaving the message in the ring, if it is larger than
+  \a maxSize, or to Timeout if no message arrived in time.
+
+  \sa read()
+ */
+qint64 QSharedRingBuffer::readInto(void *buffer, qint64 maxSize, std::chrono::nanoseconds timeout)
+{
+    const char *function = "QSharedRingBuffer::readInto";
+    if (!d->header) {
+        d->setError(NotAttached, std::string(function) + ": not attached");
+        return -1;
+    }
+    if (d->head == d->cachedTail) {
+        d->cachedTail = d->header->tail.load(std::memory_order_acquire);
+        if (d->head == d->cachedTail && !d->waitForData(function, timeout))
+            return -1;
+    }
+
+    const QSharedRingBufferRecord *record = d->record(d->head);
+    if (record->type == QSharedRingBufferRecord::Padding) {
+        // padding is only published together with the message after it
+        d->head += record->size;
+        record = d->record(d->head);
+    }
+    const qint64 size = qint64(record->size);
+    if (size > maxSize) {
+        d->setError(InvalidSize, std::string(function) + ": message is larger than the buffer");
+        return -1;
+    }
+    memcpy(buffer, record + 1, size_t(size));
+    d->head += QSharedRingBufferPrivate::recordSize(size);
+    d->publishHead();
+    d->clearError();
+    return size;
+}
+
+/*!
+  Returns a value indicating whether an error occurred, and, if so,
+  which error it was.
+
+  \sa errorString()
+ */
+QSharedRingBuffer::RingBufferError QSharedRingBuffer::error() const
+{
+    return d->error;
+}
+
+/*!
+  \enum QSharedRingBuffer::RingBufferError
+
+  \value NoError No error occurred.
+
+  \value NotAttached The segment isn't attached, or the ring buffer
+  isn't attached to a ring.
+
+  \value InvalidFormat The segment doesn't hold a ring formatted by
+  initialize().
+
+  \value InvalidSize The segment is too small for a ring, or a message
+  size is out of range.
+
+  \value Timeout There was no room or no message within the timeout.
+*/
+
+/*!
+  Returns a text description of the last error that occurred.
+
+  \sa error()
+ */
+std::string QSharedRingBuffer::errorString() const
+{
+    return d->errorString;
+}
+
+/*!
+    \internal
+
+    Returns \c true if the ring buffer has an attached segment. Sets the
+    error with \a function otherwise.
+  */
+bool QSharedRingBufferPrivate::isMapped(const std::string &function)
+{
+    if (!sharedMemory || !sharedMemory->isAttached()) {
+        setError(QSharedRingBuffer::NotAttached, function + ": segment is not attached");
+        return false;
+    }
+    return true;
+}
+
+/*!
+    \internal
+
+    Waits at most \a timeout until the consumer has freed enough of the
+    ring for \a needed bytes after the tail. The producer announces that
+    it sleeps before it looks at the head a last time; publishHead()
+    stores the head before it looks for a sleeper, so one of the two
+    sees the other.
+  */
+bool QSharedRingBufferPrivate::waitForSpace(const char *function, uint64_t needed,
+                                            std::chrono::nanoseconds timeout)
+{
+    if (timeout > std::chrono::nanoseconds(0)) {
+        const auto deadline = futexDeadline(timeout);
+        for (;;) {
+            header->producerWaiting.store(1, std::memory_order_seq_cst);
+            cachedHead = header->head.load(std::memory_order_seq_cst);
+            if (tail + needed - cachedHead <= capacity) {
+                header->producerWaiting.store(0, std::memory_order_relaxed);
+                return true;
+            }
+            if (!futexWaitUntil(header->producerWaiting, 1, deadline))
+                break;
+        }
+        header->producerWaiting.store(0, std::memory_order_relaxed);
+    }
+    setError(QSharedRingBuffer::Timeout, std::string(function) + ": ring buffer is full");
+    return false;
+}
+
+/*!
+    \internal
+
+    Waits at most \a timeout for a message after the head, the
+    counterpart of waitForSpace().
+  */
+bool QSharedRingBufferPrivate::waitForData(const char *function, std::chrono::nanoseconds timeout)
+{
+    if (timeout > std::chrono::nanoseconds(0)) {
+        const auto deadline = futexDeadline(timeout);
+        for (;;) {
+            header->consumerWaiting.store(1, std::memory_order_seq_cst);
+            cachedTail = header->tail.load(std::memory_order_seq_cst);
+            if (cachedTail != head) {
+                header->consumerWaiting.store(0, std::memory_order_relaxed);
+                return true;
+            }
+            if (!futexWaitUntil(header->consumerWaiting, 1, deadline))
+                break;
+        }
+        header->consumerWaiting.store(0, std::memory_order_relaxed);
+    }
+    setError(QSharedRingBuffer::Timeout, std::string(function) + ": ring buffer is empty");
+    return false;
+}
+
+/*!
+    \internal
+
+    Publishes the producer's tail and wakes the consumer if it sleeps.
+  */
+void QSharedRingBufferPrivate::publishTail()
+{
+    header->tail.store(tail, std::memory_order_seq_cst);
+    if (header->consumerWaiting.load(std::memory_order_seq_cst) != 0
+            && header->consumerWaiting.exchange(0, std::memory_order_relaxed) != 0)
+        QtFutex::futexWakeOne(header->consumerWaiting);
+}
+
+/*!
+    \internal
+
+    Publishes the consumer's head and wakes the producer if it sleeps.
+  */
+void QSharedRingBufferPrivate::publishHead()
+{
+    header->head.store(head, std::memory_order_seq_cst);
+    if (header->producerWaiting.load(std::memory_order_seq_cst) != 0
+            && header->producerWaiting.exchange(0, std::memory_order_relaxed) != 0)
+        QtFutex::futexWakeOne(header->producerWaiting);
+}
@@ -0,0 +1,490 @@
+/****************************************************************************
+**
+** Copyright (C) 2016 The Qt Company Ltd.
+** Contact: https://www.qt.io/licensing/
+**
+** This file is part of the QtCore module of the Qt Toolkit.
+**
+** $QT_BEGIN_LICENSE:LGPL$
+** Commercial License Usage
+** Licensees holding valid commercial Qt licenses may use this file in
+** accordance with the commercial license agreement provided with the
+** Software or, alternatively, in accordance with the terms contained in
+** a written agreement between you and The Qt Company. For licensing terms
+** and conditions see https://www.qt.io/terms-conditions. For further
+** information use the contact form at https://www.qt.io/contact-us.
+**
+** GNU Lesser General Public License Usage
+** Alternatively, this file may be used under the terms of the GNU Lesser
+** General Public License version 3 as published by the Free Software
+** Foundation and appearing in the file LICENSE.LGPL3 included in the
+** packaging of this file. Please review the following information to
+** ensure the GNU Lesser General Public License version 3 requirements
+** will be met: https://www.gnu.org/licenses/lgpl-3.0.html.
+**
+** GNU General Public License Usage
+** Alternatively, this file may be used under the terms of the GNU
+** General Public License version 2.0 or (at your option) the GNU General
+** Public license version 3 or any later version approved by the KDE Free
+** Qt Foundation. The licenses are as published by the Free Software
+** Foundation and appearing in the file LICENSE.GPL2 and LICENSE.GPL3
+** included in the packaging of this file. Please review the following
+** information to ensure the GNU General Public License requirements will
+** be met: https://www.gnu.org/licenses/gpl-2.0.html and
+** https://www.gnu.org/licenses/gpl-3.0.html.
+**
+** $QT_END_LICENSE$
+**
+****************************************************************************/
+
+#include "qsystembarrier.h"
+#include "qsystembarrier_p.h"
+
+#include "qfutex_p.h"
+
+#include <fcntl.h>
+
+#include <cerrno>
+#include <cstring>
+
+/*!
+  \class QSystemBarrier
+  \inmodule QtCore
+
+  \brief The QSystemBarrier class lets a fixed number of processes wait
+  for each other at a common point.
+
+  A barrier is created for a \l {QSystemBarrier::count()} {count} of
+  participants. Each participant calls arrive() when it reaches the
+  barrier and then wait() for the others, or arriveAndWait() to do both.
+  When the last participant arrives the barrier completes its current
+  phase, advances its generation and releases all waiters. The barrier
+  then starts over with no arrivals, so the same participants can use it
+  again for the next phase.
+
+  A system barrier is created with a string key like QSystemSemaphore;
+  other processes use the same key to open it. Its state lives in a small
+  shared memory segment and waiting participants sleep on a futex in it,
+  so neither arriving nor waiting involves a system semaphore. Only
+  opening and closing the barrier take one, derived from the key, which
+  keeps the last process closing it from removing the segment while
+  another one opens it.
+
+  Example: let worker processes start only after all of them loaded their
+  data
+  \code
+    QSystemBarrier loaded("loaded", workers);
+    loadSegment();
+    loaded.arriveAndWait();
+    score();
+  \endcode
+
+  Writes a participant made before arrive() are visible to every
+  participant once its wait() for that phase returned.
+
+  \sa QSystemSemaphore, QSharedMemory
+ */
+
+/*!
+  Requests a system barrier for the specified \a key with \a count
+  participants. The \a mode is used like the access mode of
+  QSystemSemaphore:
+
+  If the \a mode is \l {QSystemBarrier::} {Open} and a barrier identified
+  by \a key exists, it is used and \a count is ignored. Otherwise a new
+  barrier for \a count participants is created; a \a count of zero only
+  opens an existing barrier.
+
+  If the \a mode is \l {QSystemBarrier::} {Create}, an existing barrier
+  identified by \a key is reset to \a count participants with no
+  arrivals, which recovers a barrier left behind by a crashed process.
+
+  \sa setKey(), isValid()
+ */
+QSystemBarrier::QSystemBarrier(const std::string &key, int count, AccessMode mode)
+    : d(new QSystemBarrierPrivate)
+{
+    setKey(key, count, mode);
+}
+
+/*!
+  The destructor destroys the QSystemBarrier object. The underlying
+  segment is removed once the last instance using it is gone.
+*/
+QSystemBarrier::~QSystemBarrier()
+{
+    d->cleanHandle();
+}
+
+/*!
+  \enum QSystemBarrier::AccessMode
+
+  This enum is used by the constructor and setKey().
+
+  \value Open If the barrier already exists, its count and state are kept.
+  If it does not exist, it is created for the requested count.
+
+  \value Create The barrier is created for the requested count, or reset
+  to it if it already exists.
+*/
+
+/*!
+  This function works the same as the constructor. It reconstructs this
+  QSystemBarrier object for the new \a key; the \a count and \a mode
+  parameters are as defined for the constructor.
+
+  \sa QSystemBarrier(), key()
+ */
+void QSystemBarrier::setKey(const std::string &key, int count, AccessMode mode)
+{
+    if (key == d->key && mode == Open && isValid())
+        return;
+    d->clearError();
+    d->cleanHandle();
+    d->key = key;
+    d->count = count;
+    d->handle(mode);
+}
+
+/*!
+  Returns the key assigned to this system barrier.
+
+  \sa setKey()
+ */
+std::string QSystemBarrier::key() const
+{
+    return d->key;
+}
+
+/*!
+  Returns \c true if the barrier was created or opened successfully.
+
+  \sa error()
+ */
+bool QSystemBarrier::isValid() const
+{
+    return d->segment.isAttached();
+}
+
+/*!
+  Returns the number of participants the barrier waits for, or 0 if it
+  is not valid.
+ */
+int QSystemBarrier::count() const
+{
+    return isValid() ? int(d->header()->count) : 0;
+}
+
+/*!
+  Returns the number of phases the barrier has completed.
+
+  \sa wait()
+ */
+quint32 QSystemBarrier::generation() const
+{
+    return isValid() ? d->header()->generation.load(std::memory_order_acquire) : 0;
+}
+
+/*!
+  Registers the arrival of one participant without waiting and returns
+  the generation of the phase it counted for. Pass the returned value to
+  wait() to wait for the others. If this was the last arrival of the
+  phase, the generation advances and all waiters are woken.
+
+  An invalid barrier sets the error and returns 0.
+
+  \sa wait(), arriveAndWait()
+ */
+quint32 QSystemBarrier::arrive()
+{
+    if (!isValid()) {
+        d->setError(NotFound, "QSystemBarrier::arrive: barrier is not valid");
+        return 0;
+    }
+    QSystemBarrierHeader *header = d->header();
+    uint64_t state = header->state.load(std::memory_order_relaxed);
+    uint32_t generation;
+    bool completed;
+    uint64_t next;
+    do {
+        generation = uint32_t(state >> 32);
+        const uint32_t arrived = uint32_t(state) + 1;
+        completed = arrived >= header->count;
+        next = completed ? uint64_t(generation + 1) << 32 : (uint64_t(generation) << 32) | arrived;
+    } while (!header->state.compare_exchange_weak(state, next, std::memory_order_acq_rel,
+                                                  std::memory_order_relaxed));
+    if (completed) {
+        // A later phase may complete before this store is made, so the
+        // futex word only ever moves forward.
+        uint32_t published = header->generation.load(std::memory_order_relaxed);
+        while (int32_t(generation + 1 - published) > 0
+               && !header->generation.compare_exchange_weak(published, generation + 1,
+                                                            std::memory_order_seq_cst,
+                                                            std::memory_order_relaxed)) {
+        }
+        if (header->waiters.load(std::memory_order_seq_cst) != 0)
+            QtFutex::futexWakeAll(header->generation);
+    }
+    d->clearError();
+    return generation;
+}
+
+/*!
+  Waits until the phase with the given \a generation, as returned by
+  arrive(), has completed. Returns \c true right away if it already has.
+
+  If the phase doesn't complete within \a timeout, the call returns
+  \c false and sets the error to Timeout. The default waits forever.
+
+  \sa arrive(), arriveAndWait()
+ */
+bool QSystemBarrier::wait(quint32 generation, std::chrono::nanoseconds timeout)
+{
+    if (!isValid()) {
+        d->setError(NotFound, "QSystemBarrier::wait: barrier is not valid");
+        return false;
+    }
+    QSystemBarrierHeader *header = d->header();
+    const auto deadline = futexDeadline(timeout);
+    uint32_t current = header->generation.load(std::memory_order_acquire);
+    while (int32_t(current - generation) <= 0) {
+        // Register before the last check, arrive() reads the waiters after
+        // publishing the generation and skips the wake-up without them.
+        header->waiters.fetch_add(1, std::memory_order_seq_cst);
+        current = header->generation.load(std::memory_order_seq_cst);
+        const bool waited = int32_t(current - generation) > 0
+                || futexWaitUntil(header->generation, current, deadline);
+        header->waiters.fetch_sub(1, std::memory_order_relaxed);
+        if (!waited) {
+            d->setError(Timeout, "QSystemBarrier::wait: timed out");
+            return false;
+        }
+        current = header->generation.load(std::memory_order_acquire);
+    }
+    d->clearError();
+    return true;
+}
+
+/*!
+  Registers the arrival of one participant and waits at most \a timeout
+  for the others, like arrive() followed by wait(). Returns \c false and
+  sets the error to Timeout if the phase didn't complete in time; the
+  arrival still counts for it.
+
+  \sa arrive(), wait()
+ */
+bool QSystemBarrier::arriveAndWait(std::chrono::nanoseconds timeout)
+{
+    const quint32 generation = arrive();
+    if (error() != NoError)
+        return false;
+    return wait(generation, timeout);
+}
+
+/*!
+  Returns a value indicating whether an error occurred, and, if so,
+  which error it was.
+
+  \sa errorString()
+ */
+QSystemBarrier::SystemBarrierError QSystemBarrier::error() const
+{
+    return d->error;
+}
+
+/*!
+  \enum QSystemBarrier::SystemBarrierError
+
+  \value NoError No error occurred.
+
+  \value PermissionDenied The operation failed because the caller
+  didn't have the required permissions.
+
+  \value KeyError The operation failed because of an invalid key.
+
+  \value AlreadyExists The operation failed because a barrier with the
+  specified key already existed.
+
+  \value NotFound The operation failed because a barrier with the
+  specified key could not be found.
+
+  \value OutOfResources The operation failed because there was not
+  enough memory available to fill the request.
+
+  \value UnknownError Something else happened and it was bad.
+
+  \value Timeout wait() or arriveAndWait() gave up because the phase
+  didn't complete in time.
+
+  \value InvalidCount A barrier was to be created for less than one
+  participant.
+*/
+
+/*!
+  Returns a text description of the last error that occurred.
+
+  \sa error()
+ */
+std::string QSystemBarrier::errorString() const
+{
+    return d->errorString;
+}
+
+/*!
+    \internal
+
+    Copies the error of the barrier's segment, prefixing its text with
+    \a function.
+  */
+void QSystemBarrierPrivate::setSharedMemoryError(const std::string &function)
+{
+    QSystemBarrier::SystemBarrierError e;
+    switch (segment.error()) {
+    case QSharedMemory::PermissionDenied:
+        e = QSystemBarrier::PermissionDenied;
+        break;
+    case QSharedMemory::KeyError:
+        e = QSystemBarrier::KeyError;
+        break;
+    case QSharedMemory::AlreadyExists:
+        e = QSystemBarrier::AlreadyExists;
+        break;
+    case QSharedMemory::NotFound:
+        e = QSystemBarrier::NotFound;
+        break;
+    case QSharedMemory::OutOfResources:
+        e = QSystemBarrier::OutOfResources;
+        break;
+    default:
+        e = QSystemBarrier::UnknownError;
+        break;
+    }
+    setError(e, function + ": " + segment.errorString());
+}
+
+/*!
+    \internal
+
+    Sets the error from errno after opening or locking the guard file
+    failed, prefixed with \a function.
+  */
+void QSystemBarrierPrivate::setKeyLockError(const std::string &function)
+{
+    QSystemBarrier::SystemBarrierError e;
+    switch (errno) {
+    case EACCES:
+    case EPERM:
+        e = QSystemBarrier::PermissionDenied;
+        break;
+    case EMFILE:
+    case ENFILE:
+    case ENOSPC:
+    case ENOLCK:
+        e = QSystemBarrier::OutOfResources;
+        break;
+    default:
+        e = QSystemBarrier::UnknownError;
+        break;
+    }
+    setError(e, function + ": " + std::strerror(errno));
+}
+
+/*!
+    \internal
+
+    Creates or opens the segment of the barrier according to \a mode and
+    initializes it when it is new or is to be reset.
+
+    Native keys have no key semaphore in QSharedMemory, so this and
+    cleanHandle() hold an exclusive flock() on a guard file of their own:
+    otherwise the last detacher could remove the segment between another
+    process opening and attaching it, and a third process would then create
+    a second barrier. The guard file is never removed, a semaphore removed
+    by its creator would let the next opener lock a fresh one.
+  */
+bool QSystemBarrierPrivate::handle(QSystemBarrier::AccessMode mode)
+{
+    const std::string function = "QSystemBarrier::handle";
+    if (key.empty()) {
+        setError(QSystemBarrier::KeyError, function + ": key is empty");
+        return false;
+    }
+    if (mode == QSystemBarrier::Create && count <= 0) {
+        setError(QSystemBarrier::InvalidCount, function + ": count must be positive");
+        return false;
+    }
+    EINTR_LOOP(keyLockFd, ::open(makeKeyLockFileName().c_str(), O_RDONLY | O_CREAT | O_CLOEXEC, 0600));
+    if (keyLockFd == -1) {
+        setKeyLockError(function + " (open)");
+        return false;
+    }
+    QSystemBarrierLocker lock(keyLockFd);
+    if (!lock.lock()) {
+        setKeyLockError(function + " (flock)");
+        return false;
+    }
+    segment.setNativeKey(makeKeyFileName());
+
+    bool created = false;
+    if (!segment.attach()) {
+        if (segment.error() != QSharedMemory::NotFound) {
+            setSharedMemoryError(function);
+            return false;
+        }
+        if (count <= 0) {
+            setError(QSystemBarrier::NotFound, function + ": barrier does not exist");
+            return false;
+        }
+        created = segment.create(sizeof(QSystemBarrierHeader));
+        // lost the race against another creator
+        if (!created && (segment.error() != QSharedMemory::AlreadyExists || !segment.attach())) {
+            setSharedMemoryError(function);
+            return false;
+        }
+    }
+    if (segment.size() < qint64(sizeof(QSystemBarrierHeader))) {
+        setError(QSystemBarrier::KeyError, function + ": segment is not a barrier");
+        segment.detach();
+        return false;
+    }
+
+    QSystemBarrierHeader *header = this->header();
+    if (created || mode == QSystemBarrier::Create) {
+        header->version = QSystemBarrierHeader::Version;
+        header->count = uint32_t(count);
+        // a reset keeps the generation, so stale waiters don't pass
+        const uint64_t generation = header->state.load(std::memory_order_relaxed) >> 32;
+        header->state.store(generation << 32, std::memory_order_relaxed);
+        header->magic.store(QSystemBarrierHeader::Magic, std::memory_order_release);
+        return true;
+    }
+
+    // the creator initialized the segment before releasing the key lock
+    if (header->magic.load(std::memory_order_acquire) != QSystemBarrierHeader::Magic
+            || header->version != QSystemBarrierHeader::Version) {
+        setError(QSystemBarrier::KeyError, function + ": segment is not a barrier");
+        segment.detach();
+        return false;
+    }
+    return true;
+}
+
+/*!
+    \internal
+
+    Detaches from the segment under the key lock; the last one to detach
+    removes it. The guard file is closed but stays.
+  */
+void QSystemBarrierPrivate::cleanHandle()
+{
+    if (keyLockFd == -1)
+        return;
+    if (segment.isAttached()) {
+        QSystemBarrierLocker lock(keyLockFd);
+        // detach anyway, the mapping must not outlive the instance
+        lock.lock();
+        segment.detach();
+    }
+    qt_safe_close(keyLockFd);
+    keyLockFd = -1;
+}
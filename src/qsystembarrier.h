@@ -0,0 +1,94 @@
+/****************************************************************************
+**
+** Copyright (C) 2016 The Qt Company Ltd.
+** Contact: https://www.qt.io/licensing/
+**
+** This file is part of the QtCore module of the Qt Toolkit.
+**
+** $QT_BEGIN_LICENSE:LGPL$
+** Commercial License Usage
+** Licensees holding valid commercial Qt licenses may use this file in
+** accordance with the commercial license agreement provided with the
+** Software or, alternatively, in accordance with the terms contained in
+** a written agreement between you and The Qt Company. For licensing terms
+** and conditions see https://www.qt.io/terms-conditions. For further
+** information use the contact form at https://www.qt.io/contact-us.
+**
+** GNU Lesser General Public License Usage
+** Alternatively, this file may be used under the terms of the GNU Lesser
+** General Public License version 3 as published by the Free Software
+** Foundation and appearing in the file LICENSE.LGPL3 included in the
+** packaging of this file. Please review the following information to
+** ensure the GNU Lesser General Public License version 3 requirements
+** will be met: https://www.gnu.org/licenses/lgpl-3.0.html.
+**
+** GNU General Public License Usage
+** Alternatively, this file may be used under the terms of the GNU
+** General Public License version 2.0 or (at your option) the GNU General
+** Public license version 3 or any later version approved by the KDE Free
+** Qt Foundation. The licenses are as published by the Free Software
+** Foundation and appearing in the file LICENSE.GPL2 and LICENSE.GPL3
+** included in the packaging of this file. Please review the following
+** information to ensure the GNU General Public License requirements will
+** be met: https://www.gnu.org/licenses/gpl-2.0.html and
+** https://www.gnu.org/licenses/gpl-3.0.html.
+**
+** $QT_END_LICENSE$
+**
+****************************************************************************/
+
+#ifndef QSYSTEMBARRIER_H
+#define QSYSTEMBARRIER_H
+
+#include "qglobal.h"
+
+#include <chrono>
+#include <memory>
+#include <string>
+
+class QSystemBarrierPrivate;
+
+class QSystemBarrier
+{
+
+public:
+    enum AccessMode
+    {
+        Open,
+        Create
+    };
+
+    enum SystemBarrierError
+    {
+        NoError,
+        PermissionDenied,
+        KeyError,
+        AlreadyExists,
+        NotFound,
+        OutOfResources,
+        UnknownError,
+        Timeout,
+        InvalidCount
+    };
+
+    QSystemBarrier(const std::string &key, int count = 0, AccessMode mode = Open);
+    ~QSystemBarrier();
+
+    void setKey(const std::string &key, int count = 0, AccessMode mode = Open);
+    std::string key() const;
+    bool isValid() const;
+    int count() const;
+    quint32 generation() const;
+
+    quint32 arrive();
+    bool wait(quint32 generation, std::chrono::nanoseconds timeout = std::chrono::nanoseconds::max());
+    bool arriveAndWait(std::chrono::nanoseconds timeout = std::chrono::nanoseconds::max());
+
+    SystemBarrierError error() const;
+    std::string errorString() const;
+
+private:
+    std::unique_ptr<QSystemBarrierPrivate> d;
+};
+
+#endif // QSYSTEMBARRIER_H
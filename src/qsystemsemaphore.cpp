@@ -253,21 +253,78 @@ std::string QSystemSemaphore::key() const
 }
 
 /*!
-  Acquires one of the resources guarded by this semaphore, if there is
-  one available, and returns \c true. If all the resources guarded by this
-  semaphore have already been acquired, the call blocks until one of
-  them is released by another process or thread having a semaphore
-  with the same key.
+  Acquires \a n of the resources guarded by this semaphore, if they are
+  available, and returns \c true. If fewer are available, the call blocks
+  until enough of them are released by other processes or threads having
+  a semaphore with the same key.
+
+  If false is returned, a system error has occurred, or \a n is
+  negative. Call error() to get a value of
+  QSystemSemaphore::SystemSemaphoreError that indicates which error
+  occurred.
+
+  System V semaphores take the batch atomically in a single semop().
+  POSIX and Windows semaphores can only be taken one by one, so batches
+  of more than one resource first take a second semaphore (a mutex on
+  Windows) that keeps them from splitting the resources among
+  themselves. On POSIX the batch only holds it while it tries to take
+  all \a n without blocking; if they aren't there it gives back what it
+  took and sleeps until the next release(), then tries again. On both,
+  single acquirers compete with the batch for every released resource,
+  so a steady stream of them can starve it. Single acquires never take
+  the second semaphore, and neither do processes using Qt's
+  QSystemSemaphore on the same key; their releases don't wake a POSIX
+  batch either.
+
+  \sa release(), tryAcquire()
+ */
+bool QSystemSemaphore::acquire(int n)
+{
+    if (n == 0)
+        return true;
+    if (n < 0) {
+        d->setError(QSystemSemaphore::UnknownError, "QSystemSemaphore::acquire: n is negative");
+        return false;
+    }
+    return d->modifySemaphore(-n);
+}
+
+/*!
+  Acquires one of the resources guarded by this semaphore like acquire(),
+  but waits at most \a timeout for it. With the default timeout of zero
+  the call never blocks. Returns \c false and sets the error to Timeout
+  if no resource became available in time.
+
+  \sa acquire()
+ */
+bool QSystemSemaphore::tryAcquire(std::chrono::nanoseconds timeout)
+{
+    if (timeout < std::chrono::nanoseconds(0))
+        timeout = std::chrono::nanoseconds(0);
+    return d->modifySemaphore(-1, timeout);
+}
 
-  If false is returned, a system error has occurred. Call error()
-  to get a value of QSystemSemaphore::SystemSemaphoreError that
-  indicates which error occurred.
+/*!
+  \overload tryAcquire()
+
+  Acquires \a n resources all at once like acquire(int), but waits at
+  most \a timeout for them. If the call times out, none of the resources
+  are taken, but on POSIX and Windows other acquirers of the key may have
+  waited behind it for up to \a timeout.
 
-  \sa release()
+  \sa acquire()
  */
-bool QSystemSemaphore::acquire()
+bool QSystemSemaphore::tryAcquire(int n, std::chrono::nanoseconds timeout)
 {
-    return d->modifySemaphore(-1);
+    if (n == 0)
+        return true;
+    if (n < 0) {
+        d->setError(QSystemSemaphore::UnknownError, "QSystemSemaphore::tryAcquire: n is negative");
+        return false;
+    }
+    if (timeout < std::chrono::nanoseconds(0))
+        timeout = std::chrono::nanoseconds(0);
+    return d->modifySemaphore(-n, timeout);
 }
 
 /*!
@@ -333,6 +390,9 @@ QSystemSemaphore::SystemSemaphoreError QSystemSemaphore::error() const
   not enough memory available to fill the request.
 
   \value UnknownError Something else happened and it was bad.
+
+  \value Timeout tryAcquire() gave up because no resource became
+  available in time.
 */
 
 /*!
@@ -40,7 +40,9 @@
 #ifndef QSYSTEMSEMAPHORE_H
 #define QSYSTEMSEMAPHORE_H
 
+#include <chrono>
 #include <memory>
+#include <string>
 
 class QSystemSemaphorePrivate;
 
@@ -62,7 +64,8 @@ public:
         AlreadyExists,
         NotFound,
         OutOfResources,
-        UnknownError
+        UnknownError,
+        Timeout
     };
 
     QSystemSemaphore(const std::string &key, int initialValue = 0, AccessMode mode = Open);
@@ -71,7 +74,9 @@ public:
     void setKey(const std::string &key, int initialValue = 0, AccessMode mode = Open);
     std::string key() const;
 
-    bool acquire();
+    bool acquire(int n = 1);
+    bool tryAcquire(std::chrono::nanoseconds timeout = std::chrono::nanoseconds(0));
+    bool tryAcquire(int n, std::chrono::nanoseconds timeout = std::chrono::nanoseconds(0));
     bool release(int n = 1);
 
     SystemSemaphoreError error() const;
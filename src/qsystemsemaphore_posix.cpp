@@ -0,0 +1,311 @@
+/****************************************************************************
+**
+** Copyright (C) 2016 The Qt Company Ltd.
+** Contact: https://www.qt.io/licensing/
+**
+** This file is part of the QtCore module of the Qt Toolkit.
+**
+** $QT_BEGIN_LICENSE:LGPL$
+** Commercial License Usage
+** Licensees holding valid commercial Qt licenses may use this file in
+** accordance with the commercial license agreement provided with the
+** Software or, alternatively, in accordance with the terms contained in
+** a written agreement between you and The Qt Company. For licensing terms
+** and conditions see https://www.qt.io/terms-conditions. For further
+** information use the contact form at https://www.qt.io/contact-us.
+**
+** GNU Lesser General Public License Usage
+** Alternatively, this file may be used under the terms of the GNU Lesser
+** General Public License version 3 as published by the Free Software
+** Foundation and appearing in the file LICENSE.LGPL3 included in the
+** packaging of this file. Please review the following information to
+** ensure the GNU Lesser General Public License version 3 requirements
+** will be met: https://www.gnu.org/licenses/lgpl-3.0.html.
+**
+** GNU General Public License Usage
+** Alternatively, this file may be used under the terms of the GNU
+** General Public License version 2.0 or (at your option) the GNU General
+** Public license version 3 or any later version approved by the KDE Free
+** Qt Foundation. The licenses are as published by the Free Software
+** Foundation and appearing in the file LICENSE.GPL2 and LICENSE.GPL3
+** included in the packaging of this file. Please review the following
+** information to ensure the GNU General Public License requirements will
+** be met: https://www.gnu.org/licenses/gpl-2.0.html and
+** https://www.gnu.org/licenses/gpl-3.0.html.
+**
+** $QT_END_LICENSE$
+**
+****************************************************************************/
+
+#include "qsystemsemaphore.h"
+#include "qsystemsemaphore_p.h"
+
+#include <errno.h>
+
+#ifdef QT_POSIX_IPC
+
+#include <sys/mman.h>
+#include <sys/types.h>
+#include <fcntl.h>
+
+#include "qcore_unix_p.h"
+#include "qfutex_p.h"
+
+bool QSystemSemaphorePrivate::handle(QSystemSemaphore::AccessMode mode)
+{
+    if (semaphore != SEM_FAILED)
+        return true;  // we already have a semaphore
+
+    if (fileName.empty()) {
+        errorString = "QSystemSemaphore::handle: key is empty";
+        error = QSystemSemaphore::KeyError;
+        return false;
+    }
+
+    // Always try with O_EXCL so we know whether we created the semaphore.
+    int oflag = O_CREAT | O_EXCL;
+    for (int tryNum = 0, maxTries = 1; tryNum < maxTries; ++tryNum) {
+        do {
+            semaphore = ::sem_open(fileName.c_str(), oflag, 0600, initialValue);
+        } while (semaphore == SEM_FAILED && errno == EINTR);
+        if (semaphore == SEM_FAILED && errno == EEXIST) {
+            if (mode == QSystemSemaphore::Create) {
+                if (::sem_unlink(fileName.c_str()) == -1 && errno != ENOENT) {
+                    setErrorString("QSystemSemaphore::handle (sem_unlink)");
+                    return false;
+                }
+                // Race condition: the semaphore might be recreated before
+                // we call sem_open again, so we'll retry several times.
+                maxTries = 3;
+            } else {
+                // Race condition: if it no longer exists at the next sem_open
+                // call, we won't realize we created it, so we'll leak it later.
+                oflag &= ~O_EXCL;
+                maxTries = 2;
+            }
+        } else {
+            break;
+        }
+    }
+
+    if (semaphore == SEM_FAILED) {
+        setErrorString("QSystemSemaphore::handle");
+        return false;
+    }
+
+    createdSemaphore = (oflag & O_EXCL) != 0;
+
+    return true;
+}
+
+/*!
+    \internal
+
+    Opens the semaphore, with a single resource, that batch acquirers hold
+    while they take their resources, and the shared QSystemSemaphoreBatchState
+    that releases bump. POSIX semaphores can only be decremented one by
+    one; without the gate two batches could each take part of what the
+    other is waiting for.
+  */
+bool QSystemSemaphorePrivate::batchHandle()
+{
+    if (batchSemaphore != SEM_FAILED && batchState)
+        return true;
+
+    const std::string name = fileName + "_batch";
+    if (batchSemaphore == SEM_FAILED) {
+        do {
+            batchSemaphore = ::sem_open(name.c_str(), O_CREAT, 0600, 1);
+        } while (batchSemaphore == SEM_FAILED && errno == EINTR);
+        if (batchSemaphore == SEM_FAILED) {
+            setErrorString("QSystemSemaphore::handle (sem_open)");
+            return false;
+        }
+    }
+
+    // semaphores and shared memory objects have separate name spaces
+    int fd;
+    EINTR_LOOP(fd, ::shm_open(name.c_str(), O_RDWR | O_CREAT | O_CLOEXEC, 0600));
+    if (fd == -1) {
+        setErrorString("QSystemSemaphore::handle (shm_open)");
+        return false;
+    }
+    // every opener sizes it, the creator may not have done so yet; the
+    // new object is zero filled
+    int res;
+    EINTR_LOOP(res, ::ftruncate(fd, off_t(sizeof(QSystemSemaphoreBatchState))));
+    void *state = MAP_FAILED;
+    if (res != -1)
+        state = ::mmap(nullptr, sizeof(QSystemSemaphoreBatchState), PROT_READ | PROT_WRITE, MAP_SHARED, fd, 0);
+    if (state == MAP_FAILED) {
+        setErrorString(res == -1 ? "QSystemSemaphore::handle (ftruncate)" : "QSystemSemaphore::handle (mmap)");
+        qt_safe_close(fd);
+        return false;
+    }
+    qt_safe_close(fd);
+    batchState = static_cast<QSystemSemaphoreBatchState *>(state);
+    return true;
+}
+
+void QSystemSemaphorePrivate::cleanHandle()
+{
+    if (semaphore != SEM_FAILED) {
+        if (::sem_close(semaphore) == -1)
+            setErrorString("QSystemSemaphore::cleanHandle (sem_close)");
+        semaphore = SEM_FAILED;
+    }
+    if (batchSemaphore != SEM_FAILED) {
+        ::sem_close(batchSemaphore);
+        batchSemaphore = SEM_FAILED;
+    }
+    if (batchState) {
+        ::munmap(batchState, sizeof(QSystemSemaphoreBatchState));
+        batchState = nullptr;
+    }
+
+    if (createdSemaphore) {
+        if (::sem_unlink(fileName.c_str()) == -1 && errno != ENOENT)
+            setErrorString("QSystemSemaphore::cleanHandle (sem_unlink)");
+        ::sem_unlink((fileName + "_batch").c_str());
+        ::shm_unlink((fileName + "_batch").c_str());
+        createdSemaphore = false;
+    }
+}
+
+/*!
+    \internal
+
+    Takes one resource of \a sem, blocking forever for a \a timeout of
+    nanoseconds::max(), not at all for 0 and until \a deadline otherwise.
+  */
+static int semaphoreWait(sem_t *sem, std::chrono::nanoseconds timeout, const struct timespec &deadline)
+{
+    int res;
+    if (timeout == std::chrono::nanoseconds::max())
+        EINTR_LOOP(res, ::sem_wait(sem));
+    else if (timeout == std::chrono::nanoseconds(0))
+        EINTR_LOOP(res, ::sem_trywait(sem));
+    else
+        EINTR_LOOP(res, ::sem_timedwait(sem, &deadline));
+    return res;
+}
+
+/*!
+    \internal
+
+    Takes \a n resources of \a sem all at once. The batch is taken with
+    sem_trywait() under \a gate and given back if it is incomplete; the
+    gate is dropped before waiting. POSIX semaphores have no undo, so
+    nothing is held across a wait: a process killed while it waits for its
+    batch leaves the gate and the count as they were.
+
+    The wait is a futex wait on the release counter of \a state, read
+    before the attempt, so a release that came after it ends the wait at
+    once. Releases by processes that don't bump the counter, like ones
+    using Qt's QSystemSemaphore, don't wake the batch.
+  */
+static int semaphoreWaitBatch(sem_t *sem, sem_t *gate, QSystemSemaphoreBatchState *state, int n,
+                              std::chrono::nanoseconds timeout, const struct timespec &deadline)
+{
+    const auto until = futexDeadline(timeout);
+    for (;;) {
+        const uint32_t releases = state->releases.load();
+        int res = semaphoreWait(gate, timeout, deadline);
+        if (res == -1)
+            return -1;
+        int taken = 0;
+        while (taken < n) {
+            EINTR_LOOP(res, ::sem_trywait(sem));
+            if (res == -1)
+                break;
+            ++taken;
+        }
+        const int savedErrno = errno;
+        // an incomplete batch gives back what it took
+        for (; res == -1 && taken > 0; --taken)
+            ::sem_post(sem);
+        ::sem_post(gate);
+        if (res == 0)
+            return 0;
+        if (savedErrno != EAGAIN || timeout == std::chrono::nanoseconds(0)) {
+            errno = savedErrno;
+            return -1;
+        }
+
+        // a waiter killed here leaves the count too high, which only costs
+        // releases a needless wake
+        state->waiters.fetch_add(1);
+        const bool inTime = futexWaitUntil(state->releases, releases, until);
+        state->waiters.fetch_sub(1);
+        if (!inTime) {
+            errno = ETIMEDOUT;
+            return -1;
+        }
+    }
+}
+
+bool QSystemSemaphorePrivate::modifySemaphore(int count, std::chrono::nanoseconds timeout)
+{
+    if (!handle())
+        return false;
+
+    if (count > 0) {
+        // the batch state must be there to wake batch acquirers afterwards
+        if (!batchHandle())
+            return false;
+        int cnt = count;
+        do {
+            if (::sem_post(semaphore) == -1) {
+                setErrorString("QSystemSemaphore::modifySemaphore (sem_post)");
+                // rollback changes to preserve the SysV semaphore behavior
+                for ( ; cnt < count; ++cnt) {
+                    int res;
+                    EINTR_LOOP(res, ::sem_wait(semaphore));
+                }
+                return false;
+            }
+            --cnt;
+        } while (cnt > 0);
+        batchState->releases.fetch_add(1);
+        if (batchState->waiters.load())
+            QtFutex::futexWakeAll(batchState->releases);
+    } else {
+        // sem_timedwait() takes an absolute CLOCK_REALTIME deadline
+        struct timespec ts = {};
+        if (timeout != std::chrono::nanoseconds::max() && timeout != std::chrono::nanoseconds(0)) {
+            const auto deadline = std::chrono::system_clock::now().time_since_epoch()
+                    + std::chrono::duration_cast<std::chrono::system_clock::duration>(timeout);
+            const auto seconds = std::chrono::duration_cast<std::chrono::seconds>(deadline);
+            ts.tv_sec = time_t(seconds.count());
+            ts.tv_nsec = long(std::chrono::duration_cast<std::chrono::nanoseconds>(deadline - seconds).count());
+        }
+
+        int res;
+        if (count == -1) {
+            // single acquirers stay off the gate
+            res = semaphoreWait(semaphore, timeout, ts);
+        } else {
+            if (!batchHandle())
+                return false;
+            res = semaphoreWaitBatch(semaphore, batchSemaphore, batchState, -count, timeout, ts);
+        }
+        if (res == -1) {
+            if (errno == EAGAIN || errno == ETIMEDOUT) {
+                setError(QSystemSemaphore::Timeout, "QSystemSemaphore::modifySemaphore (sem_timedwait): timed out");
+                return false;
+            }
+            // If the semaphore was removed be nice and create it and then modifySemaphore again
+            if (errno == EINVAL || errno == EIDRM) {
+                semaphore = SEM_FAILED;
+                return modifySemaphore(count, timeout);
+            }
+            setErrorString("QSystemSemaphore::modifySemaphore (sem_wait)");
+            return false;
+        }
+    }
+
+    clearError();
+    return true;
+}
+
+#endif // QT_POSIX_IPC
@@ -0,0 +1,227 @@
+/****************************************************************************
+**
+** Copyright (C) 2016 The Qt Company Ltd.
+** Contact: https://www.qt.io/licensing/
+**
+** This file is part of the QtCore module of the Qt Toolkit.
+**
+** $QT_BEGIN_LICENSE:LGPL$
+** Commercial License Usage
+** Licensees holding valid commercial Qt licenses may use this file in
+** accordance with the commercial license agreement provided with the
+** Software or, alternatively, in accordance with the terms contained in
+** a written agreement between you and The Qt Company. For licensing terms
+** and conditions see https://www.qt.io/terms-conditions. For further
+** information use the contact form at https://www.qt.io/contact-us.
+**
+** GNU Lesser General Public License Usage
+** Alternatively, this file may be used under the terms of the GNU Lesser
+** General Public License version 3 as published by the Free Software
+** Foundation and appearing in the file LICENSE.LGPL3 included in the
+** packaging of this file. Please review the following information to
+** ensure the GNU Lesser General Public License version 3 requirements
+** will be met: https://www.gnu.org/licenses/lgpl-3.0.html.
+**
+** GNU General Public License Usage
+** Alternatively, this file may be used under the terms of the GNU
+** General Public License version 2.0 or (at your option) the GNU General
+** Public license version 3 or any later version approved by the KDE Free
+** Qt Foundation. The licenses are as published by the Free Software
+** Foundation and appearing in the file LICENSE.GPL2 and LICENSE.GPL3
+** included in the packaging of this file. Please review the following
+** information to ensure the GNU General Public License requirements will
+** be met: https://www.gnu.org/licenses/gpl-2.0.html and
+** https://www.gnu.org/licenses/gpl-3.0.html.
+**
+** $QT_END_LICENSE$
+**
+****************************************************************************/
+
+#include "qsystemsemaphore.h"
+#include "qsystemsemaphore_p.h"
+
+#include <errno.h>
+
+#ifndef QT_POSIX_IPC
+
+#include <sys/types.h>
+#include <sys/ipc.h>
+#include <sys/sem.h>
+#include <unistd.h>
+
+#include <climits>
+
+#include "qcore_unix_p.h"
+
+union qt_semun {
+    int val;                    /* value for SETVAL */
+    struct semid_ds *buf;       /* buffer for IPC_STAT, IPC_SET */
+    unsigned short *array;      /* array for GETALL, SETALL */
+};
+
+/*!
+    \internal
+
+    Setup unix_key
+ */
+key_t QSystemSemaphorePrivate::handle(QSystemSemaphore::AccessMode mode)
+{
+    if (-1 != unix_key)
+        return unix_key;
+
+    if (key.empty()) {
+        errorString = "QSystemSemaphore::handle:: key is empty";
+        error = QSystemSemaphore::KeyError;
+        return -1;
+    }
+
+    // ftok requires that an actual file exists somewhere
+    int built = QSharedMemoryPrivate::createUnixKeyFile(fileName);
+    if (-1 == built) {
+        errorString = "QSystemSemaphore::handle:: unable to make key";
+        error = QSystemSemaphore::KeyError;
+        return -1;
+    }
+    createdFile = (1 == built);
+
+    // Get the unix key for the created file
+    unix_key = qt_safe_ftok(fileName, 'Q');
+    if (-1 == unix_key) {
+        errorString = "QSystemSemaphore::handle:: ftok failed";
+        error = QSystemSemaphore::KeyError;
+        return -1;
+    }
+
+    // Get semaphore
+    semaphore = semget(unix_key, 1, 0600 | IPC_CREAT | IPC_EXCL);
+    if (-1 == semaphore) {
+        if (errno == EEXIST)
+            semaphore = semget(unix_key, 1, 0600 | IPC_CREAT);
+        if (-1 == semaphore) {
+            setErrorString("QSystemSemaphore::handle");
+            cleanHandle();
+            return -1;
+        }
+    } else {
+        createdSemaphore = true;
+        // Force cleanup of file, it is possible that it can be left over from a crash
+        createdFile = true;
+    }
+
+    if (mode == QSystemSemaphore::Create) {
+        createdSemaphore = true;
+        createdFile = true;
+    }
+
+    // Created semaphore so initialize its value.
+    if (createdSemaphore && initialValue >= 0) {
+        qt_semun init_op;
+        init_op.val = initialValue;
+        if (-1 == semctl(semaphore, 0, SETVAL, init_op)) {
+            setErrorString("QSystemSemaphore::handle");
+            cleanHandle();
+            return -1;
+        }
+    }
+
+    return unix_key;
+}
+
+/*!
+    \internal
+
+    Cleanup the unix_key
+ */
+void QSystemSemaphorePrivate::cleanHandle()
+{
+    unix_key = -1;
+
+    // remove the file if we made it
+    if (createdFile) {
+        ::unlink(fileName.c_str());
+        createdFile = false;
+    }
+
+    if (createdSemaphore) {
+        if (-1 != semaphore) {
+            if (-1 == semctl(semaphore, 0, IPC_RMID, 0))
+                setErrorString("QSystemSemaphore::cleanHandle");
+            semaphore = -1;
+        }
+        createdSemaphore = false;
+    }
+}
+
+/*!
+    \internal
+ */
+bool QSystemSemaphorePrivate::modifySemaphore(int count, std::chrono::nanoseconds timeout)
+{
+    if (-1 == handle())
+        return false;
+
+    if (count < SHRT_MIN || count > SHRT_MAX) {
+        setError(QSystemSemaphore::UnknownError, "QSystemSemaphore::modifySemaphore: count is out of range");
+        return false;
+    }
+
+    // a batch of resources is taken atomically by the single semop()
+    struct sembuf operation;
+    operation.sem_num = 0;
+    operation.sem_op = short(count);
+    operation.sem_flg = SEM_UNDO;
+
+    int res;
+    if (count > 0 || timeout == std::chrono::nanoseconds::max()) {
+        EINTR_LOOP(res, semop(semaphore, &operation, 1));
+    } else if (timeout == std::chrono::nanoseconds(0)) {
+        operation.sem_flg |= IPC_NOWAIT;
+        EINTR_LOOP(res, semop(semaphore, &operation, 1));
+    } else {
+        const auto deadline = std::chrono::steady_clock::now() + timeout;
+        do {
+#if defined(__linux__)
+            // semtimedop() takes a relative timeout, recompute it after EINTR
+            const auto left = std::chrono::duration_cast<std::chrono::nanoseconds>(
+                        deadline - std::chrono::steady_clock::now());
+            if (left <= std::chrono::nanoseconds(0)) {
+                res = -1;
+                errno = EAGAIN;
+                break;
+            }
+            struct timespec ts;
+            ts.tv_sec = time_t(left.count() / 1000000000);
+            ts.tv_nsec = long(left.count() % 1000000000);
+            res = semtimedop(semaphore, &operation, 1, &ts);
+#else
+            // no semtimedop(), poll
+            operation.sem_flg |= IPC_NOWAIT;
+            res = semop(semaphore, &operation, 1);
+            if (res == -1 && errno == EAGAIN && std::chrono::steady_clock::now() < deadline) {
+                ::usleep(1000);
+                errno = EINTR;
+            }
+#endif
+        } while (res == -1 && errno == EINTR);
+    }
+    if (-1 == res) {
+        if (errno == EAGAIN) {
+            setError(QSystemSemaphore::Timeout, "QSystemSemaphore::modifySemaphore (semtimedop): timed out");
+            return false;
+        }
+        // If the semaphore was removed be nice and create it and then modifySemaphore again
+        if (errno == EINVAL || errno == EIDRM) {
+            semaphore = -1;
+            cleanHandle();
+            handle();
+            return modifySemaphore(count, timeout);
+        }
+        setErrorString("QSystemSemaphore::modifySemaphore");
+        return false;
+    }
+
+    clearError();
+    return true;
+}
+
+#endif // QT_POSIX_IPC
@@ -40,11 +40,6 @@
 #include "qsystemsemaphore.h"
 #include "qsystemsemaphore_p.h"
 
-#include <qdebug.h>
-#include <qcoreapplication.h>
-
-#ifndef QT_NO_SYSTEMSEMAPHORE
-
 #include <sys/types.h>
 #ifndef QT_POSIX_IPC
 #include <sys/ipc.h>
@@ -53,51 +48,40 @@
 #include <fcntl.h>
 #include <errno.h>
 
-#include "private/qcore_unix_p.h"
-
-QT_BEGIN_NAMESPACE
-
 QSystemSemaphorePrivate::QSystemSemaphorePrivate() :
 #ifndef QT_POSIX_IPC
     unix_key(-1), semaphore(-1), createdFile(false),
 #else
-    semaphore(SEM_FAILED),
+    semaphore(SEM_FAILED), batchSemaphore(SEM_FAILED), batchState(nullptr),
 #endif // QT_POSIX_IPC
     createdSemaphore(false), error(QSystemSemaphore::NoError)
 {
 }
 
-void QSystemSemaphorePrivate::setErrorString(const QString &function)
+void QSystemSemaphorePrivate::setErrorString(const std::string &function)
 {
     // EINVAL is handled in functions so they can give better error strings
     switch (errno) {
     case EPERM:
     case EACCES:
-        errorString = QCoreApplication::translate("QSystemSemaphore", "%1: permission denied").arg(function);
+        errorString = function + ": permission denied";
         error = QSystemSemaphore::PermissionDenied;
         break;
     case EEXIST:
-        errorString = QCoreApplication::translate("QSystemSemaphore", "%1: already exists").arg(function);
+        errorString = function + ": already exists";
         error = QSystemSemaphore::AlreadyExists;
         break;
     case ENOENT:
-        errorString = QCoreApplication::translate("QSystemSemaphore", "%1: does not exist").arg(function);
+        errorString = function + ": does not exist";
         error = QSystemSemaphore::NotFound;
         break;
     case ERANGE:
     case ENOSPC:
-        errorString = QCoreApplication::translate("QSystemSemaphore", "%1: out of resources").arg(function);
+        errorString = function + ": out of resources";
         error = QSystemSemaphore::OutOfResources;
         break;
     default:
-        errorString = QCoreApplication::translate("QSystemSemaphore", "%1: unknown error %2").arg(function).arg(errno);
+        errorString = function + ": unknown error " + std::to_string(errno);
         error = QSystemSemaphore::UnknownError;
-#if defined QSYSTEMSEMAPHORE_DEBUG
-        qDebug() << errorString << "key" << key << "errno" << errno << EINVAL;
-#endif
     }
 }
-
-QT_END_NAMESPACE
-
-#endif // QT_NO_SYSTEMSEMAPHORE
@@ -85,14 +85,37 @@ HANDLE QSystemSemaphorePrivate::handle(QSystemSemaphore::AccessMode)
     return semaphore;
 }
 
+/*!
+    \internal
+
+    Opens the mutex that batch acquirers hold while they take their
+    resources one by one, so two batches can't each hold part of what the
+    other is waiting for. Single acquirers don't take it and compete with
+    the batch holding it for every resource released, so a steady stream
+    of them can starve the batch. Resources the batch took stay held
+    while it waits for the rest, which delays single acquirers in turn.
+  */
+HANDLE QSystemSemaphorePrivate::batchHandle()
+{
+    if (semaphoreLock == nullptr) {
+        semaphoreLock = CreateMutex(nullptr, FALSE, (fileName + "_batch").c_str());
+        if (semaphoreLock == nullptr)
+            setErrorString("QSystemSemaphore::handle");
+    }
+    return semaphoreLock;
+}
+
 void QSystemSemaphorePrivate::cleanHandle()
 {
     if (semaphore && !CloseHandle(semaphore)) {
     }
     semaphore = nullptr;
+    if (semaphoreLock)
+        CloseHandle(semaphoreLock);
+    semaphoreLock = nullptr;
 }
 
-bool QSystemSemaphorePrivate::modifySemaphore(int count)
+bool QSystemSemaphorePrivate::modifySemaphore(int count, std::chrono::nanoseconds timeout)
 {
     if (nullptr == handle())
         return false;
@@ -103,7 +126,52 @@ bool QSystemSemaphorePrivate::modifySemaphore(int count)
             return false;
         }
     } else {
-        if (WAIT_OBJECT_0 != WaitForSingleObjectEx(semaphore, INFINITE, FALSE)) {
+        DWORD milliseconds = INFINITE;
+        if (timeout != std::chrono::nanoseconds::max()) {
+            // round up so that a short timeout doesn't become a try
+            const auto ms = std::chrono::ceil<std::chrono::milliseconds>(timeout).count();
+            milliseconds = ms >= INFINITE ? INFINITE - 1 : DWORD(ms);
+        }
+        // single acquirers stay off the lock
+        if (count == -1) {
+            const DWORD result = WaitForSingleObjectEx(semaphore, milliseconds, FALSE);
+            if (result == WAIT_TIMEOUT) {
+                setError(QSystemSemaphore::Timeout, "QSystemSemaphore::modifySemaphore: timed out");
+                return false;
+            }
+            if (WAIT_OBJECT_0 != result) {
+                setErrorString("QSystemSemaphore::modifySemaphore");
+                return false;
+            }
+            clearError();
+            return true;
+        }
+        // batch acquirers queue on the lock, the one holding it takes its batch
+        if (nullptr == batchHandle())
+            return false;
+        const ULONGLONG deadline = GetTickCount64() + milliseconds;
+        auto left = [milliseconds, deadline]() {
+            if (milliseconds == INFINITE)
+                return INFINITE;
+            const ULONGLONG now = GetTickCount64();
+            return now >= deadline ? DWORD(0) : DWORD(deadline - now);
+        };
+        DWORD result = WaitForSingleObjectEx(semaphoreLock, milliseconds, FALSE);
+        if (result == WAIT_OBJECT_0 || result == WAIT_ABANDONED) {
+            LONG taken = 0;
+            while (taken < -count
+                   && (result = WaitForSingleObjectEx(semaphore, left(), FALSE)) == WAIT_OBJECT_0)
+                ++taken;
+            // an incomplete batch gives back what it took
+            if (result != WAIT_OBJECT_0 && taken > 0)
+                ReleaseSemaphore(semaphore, taken, nullptr);
+            ReleaseMutex(semaphoreLock);
+        }
+        if (result == WAIT_TIMEOUT) {
+            setError(QSystemSemaphore::Timeout, "QSystemSemaphore::modifySemaphore: timed out");
+            return false;
+        }
+        if (WAIT_OBJECT_0 != result) {
             setErrorString("QSystemSemaphore::modifySemaphore");
 
             return false;
@@ -1,9 +1,28 @@
 #include "catch2/catch_amalgamated.hpp"
 
 #include <qsharedmemory.h>
+#include <qsharedringbuffer.h>
+#include <qsystembarrier.h>
+#include <qsystemsemaphore.h>
 
+#include <atomic>
 #include <thread>
+#include <vector>
 #include <chrono>
+#include <cstdio>
+#include <cstring>
+#include <ios>
+#include <limits>
+
+#if defined(__linux__)
+#include <fcntl.h>
+#include <poll.h>
+#include <signal.h>
+#include <sys/mman.h>
+#include <sys/socket.h>
+#include <sys/wait.h>
+#include <unistd.h>
+#endif
 
 TEST_CASE("Create, destroy attach and detach tests", "[init]") {
     SECTION("Create and destroy") {
@@ -12,6 +31,18 @@ TEST_CASE("Create, destroy attach and detach tests", "[init]") {
         CHECK_THAT(sm.nativeKey(), Catch::Matchers::ContainsSubstring("testkey"));
     }
 
+#if defined(QT_POSIX_IPC)
+    SECTION("Qt compatible native key") {
+        QSharedMemory sm("test_key");
+        CHECK(sm.nativeKey() == "/qipc_sharedmemory_testkey00942f4668670f34c5943cf52c7ef3139fe2b8d6");
+    }
+#elif !defined(_WIN32)
+    SECTION("Qt compatible key file") {
+        QSharedMemory sm("test_key");
+        CHECK_THAT(sm.nativeKey(), Catch::Matchers::EndsWith("/qipc_sharedmemory_testkey00942f4668670f34c5943cf52c7ef3139fe2b8d6"));
+    }
+#endif
+
     SECTION("Attach and detach") {
         QSharedMemory sm_c("test_key"), sm_w("test_key"), sm_r("test_key");
         REQUIRE_FALSE(sm_c.isAttached());
@@ -24,6 +55,7 @@ TEST_CASE("Create, destroy attach and detach tests", "[init]") {
         REQUIRE(sm_w.isAttached());
         REQUIRE(sm_r.attach(QSharedMemory::ReadOnly));
         REQUIRE(sm_r.isAttached());
+        CHECK(sm_r.size() >= 256);
 
         REQUIRE(sm_c.detach());
         REQUIRE_FALSE(sm_c.isAttached());
@@ -37,6 +69,83 @@ TEST_CASE("Create, destroy attach and detach tests", "[init]") {
 
         REQUIRE_FALSE(sm_r.attach(QSharedMemory::ReadOnly));
     }
+
+#if defined(__linux__) && defined(QT_POSIX_IPC)
+    SECTION("Segments shared with Qt are kept") {
+        // a Qt 5.15 process creates the segment and takes no flock()
+        QSharedMemory sm_a("test_key");
+        sm_a.setMappingOptions(QSharedMemory::KeepOnDetach);
+        const int fd = shm_open(sm_a.nativeKey().c_str(), O_RDWR | O_CREAT | O_EXCL, 0600);
+        REQUIRE(fd != -1);
+        REQUIRE(ftruncate(fd, 4096) == 0);
+        REQUIRE(sm_a.attach());
+        REQUIRE(sm_a.detach());
+        QSharedMemory sm_b("test_key");
+        REQUIRE(sm_b.attach());
+        REQUIRE(sm_b.detach());
+        close(fd);
+        REQUIRE_FALSE(sm_b.attach());
+    }
+
+    SECTION("Unlink on last detach") {
+        QSharedMemory sm_c("test_key"), sm_a("test_key");
+        REQUIRE(sm_c.create(256));
+        REQUIRE(sm_a.attach());
+        REQUIRE(sm_c.detach());
+        REQUIRE(sm_c.attach());
+        REQUIRE(sm_c.detach());
+        REQUIRE(sm_a.detach());
+        REQUIRE_FALSE(sm_a.attach());
+        REQUIRE(sm_a.error() == QSharedMemory::NotFound);
+    }
+#endif
+
+    SECTION("Segments larger than 2 GiB") {
+        const qint64 size = qint64(3) << 30;
+        QSharedMemory sm_c("test_key"), sm_r("test_key");
+        REQUIRE_FALSE(sm_c.create(qint64(-1)));
+        REQUIRE(sm_c.error() == QSharedMemory::InvalidSize);
+        REQUIRE(sm_c.create(size));
+        REQUIRE(sm_c.size() == size);
+        REQUIRE(sm_r.attach(QSharedMemory::ReadOnly));
+        REQUIRE(sm_r.size() == size);
+        static_cast<char *>(sm_c.data())[size - 1] = 'x';
+        REQUIRE(static_cast<const char *>(sm_r.constData())[size - 1] == 'x');
+    }
+
+    SECTION("Header segments past 4 GiB") {
+        // sparse, only the header page is touched; with the header in front
+        // the mapping ends just past a multiple of 4 GiB
+        const qint64 size = (qint64(4) << 30) - 1;
+        QSharedMemory sm_c("test_key"), sm_a("test_key");
+        sm_c.setLockMode(QSharedMemory::FutexLock);
+        sm_a.setLockMode(QSharedMemory::FutexLock);
+        REQUIRE(sm_c.create(size));
+        REQUIRE(sm_a.attach());
+        REQUIRE(sm_a.size() == sm_c.size());
+        REQUIRE(sm_a.lock());
+        REQUIRE(sm_a.unlock());
+    }
+
+    SECTION("sizeof() sized segments") {
+        QSharedMemory sm_c("test_key");
+        REQUIRE(sm_c.create(sizeof(int) * 64));
+        REQUIRE(sm_c.size() >= qint64(sizeof(int) * 64));
+    }
+
+    SECTION("Other integral sizes compile") {
+        QSharedMemory sm_c("test_key");
+        REQUIRE(sm_c.create(long(4096)));
+        REQUIRE(sm_c.detach());
+        REQUIRE(sm_c.create(4096u));
+        REQUIRE(sm_c.detach());
+        REQUIRE(sm_c.create(std::streamsize(4096)));
+        REQUIRE(sm_c.detach());
+        REQUIRE(sm_c.create(short(4096)));
+        REQUIRE(sm_c.detach());
+        REQUIRE_FALSE(sm_c.create(std::numeric_limits<quint64>::max()));
+        REQUIRE(sm_c.error() == QSharedMemory::InvalidSize);
+    }
 }
 
 TEST_CASE("Lock and unlock tests", "[lock]") {
@@ -83,3 +192,1360 @@ TEST_CASE("Transfer data tests", "[sharemem]") {
     REQUIRE(sm_r.unlock());
 }
 
+
+TEST_CASE("Futex lock tests", "[lock]") {
+    QSharedMemory sm_c("test_key"), sm_w("test_key"), sm_r("test_key");
+    sm_c.setLockMode(QSharedMemory::FutexLock);
+    sm_w.setLockMode(QSharedMemory::FutexLock);
+    sm_r.setLockMode(QSharedMemory::FutexLock);
+    REQUIRE_FALSE(sm_c.lock());
+    REQUIRE(sm_c.error() == QSharedMemory::LockError);
+
+    REQUIRE(sm_c.create(256));
+    REQUIRE(sm_c.size() == 256);
+    REQUIRE(sm_w.attach(QSharedMemory::ReadWrite));
+    REQUIRE(sm_r.attach(QSharedMemory::ReadOnly));
+    REQUIRE(sm_w.size() == 256);
+
+    SECTION("Mutual exclusion") {
+        const int loops = 100000;
+        std::atomic<int> failures{0};
+        auto worker = [&failures](QSharedMemory *sm) {
+            for (int i = 0; i < loops; ++i) {
+                if (!sm->lock())
+                    ++failures;
+                ++*static_cast<int *>(sm->data());
+                if (!sm->unlock())
+                    ++failures;
+            }
+        };
+        std::thread t1(worker, &sm_c), t2(worker, &sm_w);
+        t1.join();
+        t2.join();
+        REQUIRE(failures == 0);
+
+        REQUIRE(sm_r.lock());
+        REQUIRE(*static_cast<const int *>(sm_r.constData()) == 2 * loops);
+        REQUIRE(sm_r.unlock());
+    }
+
+    SECTION("Lock mode mismatch") {
+        QSharedMemory sm_o("other_key"), sm_f("other_key");
+        REQUIRE(sm_o.create(256));
+        sm_f.setLockMode(QSharedMemory::FutexLock);
+        REQUIRE_FALSE(sm_f.attach());
+        REQUIRE(sm_f.error() == QSharedMemory::KeyError);
+    }
+
+    SECTION("Detach releases the lock") {
+        REQUIRE(sm_w.lock());
+        REQUIRE(sm_w.detach());
+        REQUIRE(sm_c.lock());
+        REQUIRE(sm_c.unlock());
+    }
+}
+
+#if defined(__linux__)
+TEST_CASE("Anonymous segment tests", "[memfd]") {
+    QSharedMemory sm_c, sm_r, sm_w;
+    sm_c.setLockMode(QSharedMemory::FutexLock);
+    sm_r.setLockMode(QSharedMemory::FutexLock);
+    sm_w.setLockMode(QSharedMemory::FutexLock);
+
+    REQUIRE_FALSE(sm_c.sendDescriptor(0));
+    REQUIRE(sm_c.error() == QSharedMemory::NotFound);
+
+    REQUIRE(sm_c.createAnonymous(4096));
+    REQUIRE(sm_c.key().empty());
+    REQUIRE(sm_c.descriptor() != -1);
+    REQUIRE(sm_c.size() == 4096);
+
+    const char *data = "Hello world from KTSM anonymous QSharedMemory!";
+    REQUIRE(sm_c.lock());
+    memcpy(sm_c.data(), data, strlen(data) + 1);
+    REQUIRE(sm_c.unlock());
+
+    SECTION("Descriptor passing") {
+        int sv[2];
+        REQUIRE(socketpair(AF_UNIX, SOCK_STREAM, 0, sv) == 0);
+        REQUIRE(sm_c.sendDescriptor(sv[0]));
+        REQUIRE(sm_r.receiveDescriptor(sv[1], QSharedMemory::ReadOnly));
+        close(sv[0]);
+        close(sv[1]);
+
+        REQUIRE(sm_r.size() == 4096);
+        REQUIRE(sm_r.lock());
+        REQUIRE_THAT((const char *)sm_r.constData(), Catch::Matchers::Equals(data));
+        REQUIRE(sm_r.unlock());
+        REQUIRE(sm_r.detach());
+        REQUIRE(sm_r.descriptor() == -1);
+    }
+
+    SECTION("More than one descriptor") {
+        int sv[2];
+        REQUIRE(socketpair(AF_UNIX, SOCK_STREAM, 0, sv) == 0);
+        const int fds[2] = { sm_c.descriptor(), sm_c.descriptor() };
+        char byte = 0;
+        iovec iov = { &byte, sizeof(byte) };
+        union {
+            cmsghdr header;
+            char buffer[CMSG_SPACE(sizeof(fds))];
+        } control;
+        msghdr msg = {};
+        msg.msg_iov = &iov;
+        msg.msg_iovlen = 1;
+        msg.msg_control = control.buffer;
+        msg.msg_controllen = sizeof(control.buffer);
+        cmsghdr *cmsg = CMSG_FIRSTHDR(&msg);
+        cmsg->cmsg_level = SOL_SOCKET;
+        cmsg->cmsg_type = SCM_RIGHTS;
+        cmsg->cmsg_len = CMSG_LEN(sizeof(fds));
+        memcpy(CMSG_DATA(cmsg), fds, sizeof(fds));
+        REQUIRE(sendmsg(sv[0], &msg, 0) == 1);
+
+        // the received descriptors are closed, the lowest free one is unchanged
+        const int lowest = dup(0);
+        close(lowest);
+        REQUIRE_FALSE(sm_r.receiveDescriptor(sv[1]));
+        REQUIRE(sm_r.error() == QSharedMemory::NotFound);
+        const int probe = dup(0);
+        close(probe);
+        REQUIRE(probe == lowest);
+        close(sv[0]);
+        close(sv[1]);
+    }
+
+    SECTION("Attach descriptor and seals") {
+        REQUIRE(sm_w.attachDescriptor(sm_c.descriptor()));
+        REQUIRE(sm_w.descriptor() != sm_c.descriptor());
+        REQUIRE_THAT((const char *)sm_w.constData(), Catch::Matchers::Equals(data));
+
+        REQUIRE(sm_c.seals() == QSharedMemory::NoSeal);
+        REQUIRE(sm_c.seal(QSharedMemory::SealShrink | QSharedMemory::SealGrow));
+        REQUIRE(sm_w.seals() == (QSharedMemory::SealShrink | QSharedMemory::SealGrow));
+        REQUIRE_FALSE(sm_c.seal(QSharedMemory::SealWrite));
+        REQUIRE(sm_c.error() == QSharedMemory::PermissionDenied);
+    }
+}
+#endif
+
+#if defined(__linux__)
+TEST_CASE("Huge page tests", "[hugepages]") {
+    const int hugePage = 2 * 1024 * 1024;
+
+    SECTION("Transparent huge pages round the size") {
+        QSharedMemory sm_c("test_key");
+        sm_c.setMappingOptions(QSharedMemory::TransparentHugePages);
+        REQUIRE(sm_c.create(256));
+        REQUIRE(sm_c.size() == hugePage);
+    }
+
+    SECTION("Hugetlb pages or a reported pool error") {
+        QSharedMemory sm_c("test_key"), sm_r("test_key");
+        sm_c.setMappingOptions(QSharedMemory::HugePages);
+        sm_r.setMappingOptions(QSharedMemory::HugePages);
+        if (sm_c.create(hugePage + 1)) {
+            REQUIRE(sm_c.size() == 2 * hugePage);
+            REQUIRE(sm_r.attach(QSharedMemory::ReadOnly));
+            REQUIRE(sm_r.size() == 2 * hugePage);
+        } else {
+            REQUIRE(sm_c.error() == QSharedMemory::OutOfResources);
+        }
+    }
+
+    SECTION("Anonymous hugetlb pages or a reported pool error") {
+        QSharedMemory sm_c;
+        sm_c.setMappingOptions(QSharedMemory::HugePages);
+        if (sm_c.createAnonymous(256))
+            REQUIRE(sm_c.size() == hugePage);
+        else
+            REQUIRE(sm_c.error() == QSharedMemory::OutOfResources);
+    }
+}
+#endif
+
+#if defined(__linux__)
+TEST_CASE("NUMA placement tests", "[numa]") {
+    QSharedMemory sm_c("test_key"), sm_w("test_key"), sm_r("test_key");
+
+    SECTION("Memory policy") {
+        REQUIRE(sm_c.setNumaPolicy(QSharedMemory::NumaInterleave, {0}));
+        REQUIRE(sm_c.create(4096));
+        REQUIRE(sm_c.numaPolicy() == QSharedMemory::NumaInterleave);
+        REQUIRE(sm_c.setNumaPolicy(QSharedMemory::NumaBind, {0}));
+        REQUIRE_FALSE(sm_c.setNumaPolicy(QSharedMemory::NumaBind, {-1}));
+        REQUIRE(sm_c.error() == QSharedMemory::UnknownError);
+        REQUIRE(sm_c.numaPolicy() == QSharedMemory::NumaBind);
+    }
+
+    SECTION("Read-mostly replicas") {
+        sm_c.setNumaReplicas(true);
+        sm_r.setNumaReplicas(true);
+        REQUIRE(sm_c.create(256));
+        REQUIRE(sm_c.numaNode() == -1);
+        REQUIRE(sm_w.attach(QSharedMemory::ReadWrite));
+        REQUIRE(sm_r.attach(QSharedMemory::ReadOnly));
+        REQUIRE(sm_r.numaNode() >= 0);
+
+        const char *data = "Hello world from the local node!";
+        REQUIRE(sm_c.lock());
+        memcpy(sm_c.data(), data, strlen(data) + 1);
+        REQUIRE(sm_c.updateReplicas());
+        REQUIRE(sm_c.unlock());
+
+        REQUIRE_THAT((const char *)sm_r.constData(), Catch::Matchers::Equals(data));
+        REQUIRE_FALSE(sm_r.updateReplicas());
+        REQUIRE(sm_r.error() == QSharedMemory::PermissionDenied);
+        REQUIRE(sm_w.numaNode() == -1);
+    }
+}
+#endif
+
+#if defined(__linux__)
+TEST_CASE("Prefault tests", "[prefault]") {
+    const int size = 64 * 4096;
+    QSharedMemory sm_c("test_key"), sm_r("test_key");
+    sm_c.setMappingOptions(QSharedMemory::Prefault);
+    REQUIRE(sm_c.create(size));
+    REQUIRE(sm_c.prefaultedPages() >= size / 4096);
+    REQUIRE(sm_c.prefaultTime().count() > 0);
+
+    sm_r.setMappingOptions(QSharedMemory::LockInMemory);
+    if (sm_r.attach(QSharedMemory::ReadOnly))
+        REQUIRE(sm_r.prefaultedPages() > 0);
+    else
+        REQUIRE(sm_r.error() == QSharedMemory::OutOfResources);
+}
+#endif
+
+#if defined(__linux__) && defined(QT_POSIX_IPC)
+TEST_CASE("Resize tests", "[resize]") {
+    QSharedMemory sm_c("test_key"), sm_w("test_key"), sm_r("test_key");
+    sm_c.setLockMode(QSharedMemory::FutexLock);
+    sm_w.setLockMode(QSharedMemory::FutexLock);
+    sm_r.setLockMode(QSharedMemory::FutexLock);
+    REQUIRE(sm_c.create(4096));
+    REQUIRE(sm_w.attach(QSharedMemory::ReadWrite));
+    REQUIRE(sm_r.attach(QSharedMemory::ReadOnly));
+    strcpy(static_cast<char *>(sm_c.data()), "kept");
+
+    REQUIRE_FALSE(sm_c.resize(1024));
+    REQUIRE(sm_c.error() == QSharedMemory::InvalidSize);
+    REQUIRE_FALSE(sm_r.resize(8192));
+    REQUIRE(sm_r.error() == QSharedMemory::PermissionDenied);
+
+    const qint64 size = 16 * 4096;
+    REQUIRE(sm_c.resize(size));
+    REQUIRE(sm_c.size() == size);
+    static_cast<char *>(sm_c.data())[size - 1] = 'x';
+
+    REQUIRE(sm_w.lock());
+    REQUIRE(sm_w.size() == size);
+    REQUIRE(static_cast<const char *>(sm_w.constData())[size - 1] == 'x');
+    REQUIRE(sm_w.unlock());
+
+    REQUIRE_THAT((const char *)sm_r.constData(), Catch::Matchers::Equals("kept"));
+    REQUIRE(sm_r.size() == size);
+    REQUIRE(static_cast<const char *>(sm_r.constData())[size - 1] == 'x');
+}
+#endif
+
+#if defined(__linux__) && defined(QT_POSIX_IPC)
+TEST_CASE("Resize with replicas tests", "[resize]") {
+    QSharedMemory sm_c("test_key"), sm_w("test_key"), sm_r("test_key");
+    sm_c.setLockMode(QSharedMemory::FutexLock);
+    sm_w.setLockMode(QSharedMemory::FutexLock);
+    sm_r.setLockMode(QSharedMemory::FutexLock);
+    sm_c.setNumaReplicas(true);
+    sm_r.setNumaReplicas(true);
+    REQUIRE(sm_c.create(4096));
+    REQUIRE(sm_w.attach(QSharedMemory::ReadWrite));
+    REQUIRE(sm_r.attach(QSharedMemory::ReadOnly));
+    REQUIRE(sm_r.numaNode() >= 0);
+
+    SECTION("Rejected by the attachment with replicas") {
+        REQUIRE_FALSE(sm_c.resize(16 * 4096));
+        REQUIRE(sm_c.error() == QSharedMemory::UnknownError);
+    }
+
+    SECTION("Rejected by an attachment without replicas") {
+        REQUIRE_FALSE(sm_w.resize(16 * 4096));
+        REQUIRE(sm_w.error() == QSharedMemory::UnknownError);
+    }
+
+    REQUIRE(sm_r.size() == 4096);
+    REQUIRE(sm_r.numaNode() >= 0);
+    REQUIRE(sm_c.lock());
+    strcpy(static_cast<char *>(sm_c.data()), "replicated");
+    REQUIRE(sm_c.updateReplicas());
+    REQUIRE(sm_c.unlock());
+    REQUIRE_THAT((const char *)sm_r.constData(), Catch::Matchers::Equals("replicated"));
+}
+#endif
+
+#if defined(__linux__)
+TEST_CASE("File-backed segment tests", "[file]") {
+    const std::string fileName = "/tmp/ktsm_file_backed_test";
+    std::remove(fileName.c_str());
+    const char *data = "Hello world from a file-backed QSharedMemory!";
+
+    {
+        QSharedMemory sm_c;
+        sm_c.setLockMode(QSharedMemory::FutexLock);
+        REQUIRE(sm_c.createFile(fileName, 4096));
+        REQUIRE(sm_c.size() == 4096);
+        REQUIRE(sm_c.descriptor() != -1);
+        REQUIRE(sm_c.lock());
+        memcpy(sm_c.data(), data, strlen(data) + 1);
+        REQUIRE(sm_c.unlock());
+        REQUIRE(sm_c.flush(QSharedMemory::AsyncFlush));
+        REQUIRE(sm_c.flush());
+
+        QSharedMemory sm_o;
+        REQUIRE_FALSE(sm_o.createFile(fileName, 4096));
+        REQUIRE(sm_o.error() == QSharedMemory::AlreadyExists);
+    }
+
+    // the contents survive the last detach
+    QSharedMemory sm_r;
+    sm_r.setLockMode(QSharedMemory::FutexLock);
+    REQUIRE(sm_r.attachFile(fileName, QSharedMemory::ReadOnly));
+    REQUIRE(sm_r.size() == 4096);
+    REQUIRE_THAT((const char *)sm_r.constData(), Catch::Matchers::Equals(data));
+    REQUIRE(sm_r.detach());
+
+    SECTION("Lock left behind by a crash") {
+        const pid_t pid = fork();
+        if (pid == 0) {
+            QSharedMemory sm_d;
+            sm_d.setLockMode(QSharedMemory::FutexLock);
+            _exit(sm_d.attachFile(fileName) && sm_d.lock() ? 0 : 1);
+        }
+        int status = 0;
+        REQUIRE(waitpid(pid, &status, 0) == pid);
+        REQUIRE(WEXITSTATUS(status) == 0);
+
+        // the only user of the file clears the stale lock word
+        QSharedMemory sm_a, sm_b;
+        sm_a.setLockMode(QSharedMemory::FutexLock);
+        sm_b.setLockMode(QSharedMemory::FutexLock);
+        REQUIRE(sm_a.attachFile(fileName));
+        REQUIRE(sm_a.lock(std::chrono::seconds(1)));
+
+        // while attached elsewhere the lock state is kept
+        REQUIRE(sm_b.attachFile(fileName));
+        REQUIRE_FALSE(sm_b.lock(std::chrono::milliseconds(10)));
+        REQUIRE(sm_b.error() == QSharedMemory::LockTimeout);
+        REQUIRE(sm_a.unlock());
+        REQUIRE(sm_b.lock());
+        REQUIRE(sm_b.unlock());
+    }
+
+    SECTION("Concurrent attaches keep the lock state") {
+        // an attachment that wrongly finds itself alone resets the lock
+        // word under the others and breaks mutual exclusion
+        const int threads = 4;
+        const int rounds = 200;
+        {
+            QSharedMemory sm_z;
+            sm_z.setLockMode(QSharedMemory::FutexLock);
+            REQUIRE(sm_z.attachFile(fileName));
+            *static_cast<int *>(sm_z.data()) = 0;
+        }
+        std::vector<std::thread> workers;
+        for (int i = 0; i < threads; ++i) {
+            workers.emplace_back([&fileName]() {
+                for (int round = 0; round < rounds; ++round) {
+                    QSharedMemory sm;
+                    sm.setLockMode(QSharedMemory::FutexLock);
+                    if (!sm.attachFile(fileName) || !sm.lock())
+                        continue;
+                    int *counter = static_cast<int *>(sm.data());
+                    const int value = *counter;
+                    std::this_thread::yield();
+                    *counter = value + 1;
+                    sm.unlock();
+                }
+            });
+        }
+        for (auto &worker : workers)
+            worker.join();
+
+        QSharedMemory sm_a;
+        sm_a.setLockMode(QSharedMemory::FutexLock);
+        REQUIRE(sm_a.attachFile(fileName));
+        REQUIRE(*static_cast<const int *>(sm_a.constData()) == threads * rounds);
+    }
+
+    REQUIRE(std::remove(fileName.c_str()) == 0);
+    REQUIRE(std::remove((fileName + ".lock").c_str()) == 0);
+    REQUIRE_FALSE(sm_r.attachFile(fileName));
+    REQUIRE(sm_r.error() == QSharedMemory::NotFound);
+}
+#endif
+
+#if defined(__linux__)
+TEST_CASE("Copy-on-write tests", "[cow]") {
+    const char *data = "Hello world from the shared snapshot!";
+
+#if defined(QT_POSIX_IPC)
+    SECTION("Private data") {
+        QSharedMemory sm_c("test_key"), sm_p("test_key");
+        REQUIRE(sm_c.create(4096));
+        memcpy(sm_c.data(), data, strlen(data) + 1);
+        REQUIRE(sm_p.attach(QSharedMemory::CopyOnWrite));
+        REQUIRE_THAT((const char *)sm_p.constData(), Catch::Matchers::Equals(data));
+
+        memcpy(sm_p.data(), "LOCAL", 5);
+        REQUIRE_THAT((const char *)sm_p.constData(), Catch::Matchers::StartsWith("LOCAL"));
+        REQUIRE_THAT((const char *)sm_c.constData(), Catch::Matchers::Equals(data));
+    }
+#else
+    SECTION("Not supported for System V segments") {
+        QSharedMemory sm_c("test_key");
+        REQUIRE_FALSE(sm_c.create(4096, QSharedMemory::CopyOnWrite));
+        REQUIRE(sm_c.error() == QSharedMemory::UnknownError);
+    }
+#endif
+
+    SECTION("Shared header") {
+        QSharedMemory sm_c, sm_p;
+        sm_c.setLockMode(QSharedMemory::FutexLock);
+        sm_p.setLockMode(QSharedMemory::FutexLock);
+        REQUIRE(sm_c.createAnonymous(4096));
+        memcpy(sm_c.data(), data, strlen(data) + 1);
+        REQUIRE(sm_p.attachDescriptor(sm_c.descriptor(), QSharedMemory::CopyOnWrite));
+
+        memcpy(sm_p.data(), "LOCAL", 5);
+        REQUIRE_THAT((const char *)sm_c.constData(), Catch::Matchers::Equals(data));
+
+        REQUIRE(sm_p.lock());
+        std::atomic<bool> locked{false};
+        std::thread t([&sm_c, &locked]() {
+            sm_c.lock();
+            locked = true;
+            sm_c.unlock();
+        });
+        std::this_thread::sleep_for(std::chrono::milliseconds(50));
+        REQUIRE_FALSE(locked);
+        REQUIRE(sm_p.unlock());
+        t.join();
+        REQUIRE(locked);
+
+        // follows a resize, keeping the private copy
+        REQUIRE(sm_c.resize(1 << 20));
+        static_cast<char *>(sm_c.data())[(1 << 20) - 1] = 'x';
+        REQUIRE(sm_p.lock());
+        REQUIRE(sm_p.size() >= (1 << 20));
+        REQUIRE(sm_p.unlock());
+        REQUIRE(sm_p.error() == QSharedMemory::NoError);
+        REQUIRE_THAT((const char *)sm_p.constData(), Catch::Matchers::StartsWith("LOCAL"));
+        REQUIRE(static_cast<const char *>(sm_p.constData())[(1 << 20) - 1] == 'x');
+        static_cast<char *>(sm_p.data())[(1 << 20) - 1] = 'y';
+        REQUIRE(static_cast<const char *>(sm_c.constData())[(1 << 20) - 1] == 'x');
+    }
+}
+#endif
+
+#if defined(__linux__)
+TEST_CASE("Fixed address tests", "[fixed]") {
+    QSharedMemory sm_c("test_key"), sm_a("test_key");
+    sm_c.setLockMode(QSharedMemory::FutexLock);
+    sm_a.setLockMode(QSharedMemory::FutexLock);
+    sm_c.setMappingOptions(QSharedMemory::FixedAddress);
+    sm_a.setMappingOptions(QSharedMemory::FixedAddress);
+
+    SECTION("Needs a segment header") {
+        QSharedMemory sm_s("other_key");
+        sm_s.setMappingOptions(QSharedMemory::FixedAddress);
+        REQUIRE_FALSE(sm_s.create(4096));
+        REQUIRE(sm_s.error() == QSharedMemory::UnknownError);
+    }
+
+    REQUIRE(sm_c.create(4096));
+    struct Node { Node *next; int value; };
+    Node *nodes = static_cast<Node *>(sm_c.data());
+    nodes[0] = { &nodes[1], 1 };
+    nodes[1] = { nullptr, 2 };
+
+    SECTION("Range in use") {
+        // this process has the segment mapped at the recorded address already
+        REQUIRE_FALSE(sm_a.attach());
+        REQUIRE(sm_a.error() == QSharedMemory::OutOfResources);
+        REQUIRE_FALSE(sm_a.isAttached());
+    }
+
+    SECTION("Same address in another process") {
+        void *base = sm_c.baseAddress();
+        const pid_t pid = fork();
+        if (pid == 0) {
+            // free the range the way a different process would have it,
+            // detach() would remove the segment shared with the parent
+            munmap(base, size_t(static_cast<char *>(sm_c.data()) - static_cast<char *>(base) + sm_c.size()));
+            if (!sm_a.attach(QSharedMemory::ReadOnly) || sm_a.baseAddress() != base)
+                _exit(1);
+            const Node *node = static_cast<const Node *>(sm_a.constData());
+            _exit(node->next->value == 2 ? 0 : 2);
+        }
+        int status = 0;
+        REQUIRE(waitpid(pid, &status, 0) == pid);
+        REQUIRE(WIFEXITED(status));
+        REQUIRE(WEXITSTATUS(status) == 0);
+    }
+}
+#endif
+
+TEST_CASE("Timed lock tests", "[lock]") {
+    const auto mode = GENERATE(QSharedMemory::SystemSemaphoreLock, QSharedMemory::FutexLock);
+    QSharedMemory sm_c("test_key"), sm_w("test_key");
+    sm_c.setLockMode(mode);
+    sm_w.setLockMode(mode);
+    REQUIRE(sm_c.create(256));
+    REQUIRE(sm_w.attach());
+
+    REQUIRE(sm_w.tryLock());
+    REQUIRE(sm_w.unlock());
+
+    REQUIRE(sm_c.lock());
+    REQUIRE_FALSE(sm_w.tryLock());
+    REQUIRE(sm_w.error() == QSharedMemory::LockTimeout);
+
+    const auto start = std::chrono::steady_clock::now();
+    REQUIRE_FALSE(sm_w.lock(std::chrono::milliseconds(50)));
+    REQUIRE(sm_w.error() == QSharedMemory::LockTimeout);
+    REQUIRE(std::chrono::steady_clock::now() - start >= std::chrono::milliseconds(50));
+
+    std::thread t([&sm_c]() {
+        std::this_thread::sleep_for(std::chrono::milliseconds(20));
+        sm_c.unlock();
+    });
+    REQUIRE(sm_w.lock(std::chrono::seconds(5)));
+    t.join();
+    REQUIRE(sm_w.unlock());
+}
+
+TEST_CASE("Reader-writer lock tests", "[lock]") {
+    QSharedMemory sm_c("test_key"), sm_r1("test_key"), sm_r2("test_key"), sm_w("test_key");
+    for (QSharedMemory *sm : { &sm_c, &sm_r1, &sm_r2, &sm_w })
+        sm->setLockMode(QSharedMemory::ReadWriteLock);
+    REQUIRE(sm_c.create(256));
+    REQUIRE(sm_r1.attach(QSharedMemory::ReadOnly));
+    REQUIRE(sm_r2.attach(QSharedMemory::ReadOnly));
+    REQUIRE(sm_w.attach());
+    REQUIRE(sm_w.writerPreference());
+
+    SECTION("Shared readers, exclusive writer") {
+        QSharedMemoryReadLocker r1(&sm_r1);
+        QSharedMemoryReadLocker r2(&sm_r2);
+        REQUIRE(r1.isLocked());
+        REQUIRE(r2.isLocked());
+        REQUIRE_FALSE(sm_w.unlockForWrite());
+        REQUIRE_FALSE(sm_w.lockForWrite(std::chrono::milliseconds(10)));
+        REQUIRE(sm_w.error() == QSharedMemory::LockTimeout);
+
+        r1.unlock();
+        r2.unlock();
+        QSharedMemoryWriteLocker w(&sm_w);
+        REQUIRE(w.isLocked());
+        REQUIRE_FALSE(sm_r1.lockForRead(std::chrono::milliseconds(10)));
+        REQUIRE(sm_r1.error() == QSharedMemory::LockTimeout);
+        REQUIRE_FALSE(sm_w.unlockForRead());
+    }
+
+    SECTION("No upgrade of a read lock") {
+        REQUIRE(sm_w.lockForRead());
+        REQUIRE_FALSE(sm_w.lockForWrite());
+        REQUIRE(sm_w.error() == QSharedMemory::LockError);
+        REQUIRE_FALSE(sm_w.lock(std::chrono::milliseconds(10)));
+        REQUIRE(sm_w.error() == QSharedMemory::LockError);
+
+        // still only the shared lock is held
+        REQUIRE(sm_r1.lockForRead(std::chrono::milliseconds(10)));
+        REQUIRE(sm_r1.unlockForRead());
+        REQUIRE(sm_w.unlockForRead());
+        REQUIRE(sm_w.lockForWrite());
+        REQUIRE(sm_w.unlockForWrite());
+    }
+
+    SECTION("Writer preference") {
+        REQUIRE(sm_r1.lockForRead());
+        std::atomic<bool> written{false};
+        std::thread writer([&sm_w, &written]() {
+            QSharedMemoryWriteLocker w(&sm_w);
+            written = true;
+        });
+        std::this_thread::sleep_for(std::chrono::milliseconds(50));
+        REQUIRE_FALSE(written);
+
+        // a waiting writer holds back new readers
+        REQUIRE_FALSE(sm_r2.lockForRead(std::chrono::milliseconds(10)));
+        sm_c.setWriterPreference(false);
+        REQUIRE_FALSE(sm_w.writerPreference());
+        REQUIRE(sm_r2.lockForRead(std::chrono::milliseconds(10)));
+        REQUIRE(sm_r2.unlockForRead());
+
+        REQUIRE(sm_r1.unlockForRead());
+        writer.join();
+        REQUIRE(written);
+    }
+
+    SECTION("Consistent reads") {
+        const int loops = 20000;
+        std::atomic<int> failures{0};
+        std::thread writer([&sm_w, &failures]() {
+            for (int i = 0; i < loops; ++i) {
+                QSharedMemoryWriteLocker w(&sm_w);
+                int *values = static_cast<int *>(sm_w.data());
+                ++values[0];
+                ++values[1];
+            }
+        });
+        auto reader = [&failures](QSharedMemory *sm) {
+            for (int i = 0; i < loops; ++i) {
+                QSharedMemoryReadLocker r(sm);
+                const int *values = static_cast<const int *>(sm->constData());
+                if (!r.isLocked() || values[0] != values[1])
+                    ++failures;
+            }
+        };
+        std::thread t1(reader, &sm_r1), t2(reader, &sm_r2);
+        writer.join();
+        t1.join();
+        t2.join();
+        REQUIRE(failures == 0);
+        REQUIRE(static_cast<const int *>(sm_c.constData())[0] == loops);
+    }
+}
+
+#ifndef __WIN32
+TEST_CASE("Robust lock tests", "[lock]") {
+    QSharedMemory sm_c("test_key"), sm_a("test_key");
+    sm_c.setLockMode(QSharedMemory::RobustLock);
+    sm_a.setLockMode(QSharedMemory::RobustLock);
+    REQUIRE(sm_c.create(256));
+    REQUIRE(sm_a.attach());
+
+    int handled = 0;
+    bool repaired = true;
+    sm_a.setConsistencyHandler([&handled, &repaired](QSharedMemory *sm) {
+        ++handled;
+        static_cast<int *>(sm->data())[0] = 0;
+        return repaired;
+    });
+
+    REQUIRE(sm_a.lock());
+    REQUIRE_FALSE(sm_a.lockOwnerDied());
+    REQUIRE_FALSE(sm_c.lock(std::chrono::milliseconds(10)));
+    REQUIRE(sm_c.error() == QSharedMemory::LockTimeout);
+    REQUIRE(sm_a.unlock());
+
+    // the child dies holding the lock
+    const pid_t pid = fork();
+    if (pid == 0) {
+        sm_c.lock();
+        static_cast<int *>(sm_c.data())[0] = 42;
+        _exit(0);
+    }
+    REQUIRE(pid > 0);
+    REQUIRE(waitpid(pid, nullptr, 0) == pid);
+
+    SECTION("Recovered") {
+        REQUIRE(sm_a.lock(std::chrono::seconds(1)));
+        REQUIRE(sm_a.lockOwnerDied());
+        // a query, asking again changes nothing
+        REQUIRE(sm_a.lockOwnerDied());
+        REQUIRE(handled == 1);
+        REQUIRE(static_cast<int *>(sm_a.data())[0] == 0);
+        REQUIRE(sm_a.unlock());
+
+        REQUIRE(sm_c.lock());
+        REQUIRE_FALSE(sm_c.lockOwnerDied());
+        REQUIRE(sm_c.unlock());
+    }
+
+    SECTION("Not recoverable") {
+        repaired = false;
+        REQUIRE_FALSE(sm_a.lock());
+        REQUIRE(sm_a.error() == QSharedMemory::LockError);
+        REQUIRE(handled == 1);
+        REQUIRE_FALSE(sm_c.lock());
+        REQUIRE(sm_c.error() == QSharedMemory::LockError);
+    }
+}
+#endif
+
+TEST_CASE("Seqlock tests", "[seqlock]") {
+    QSharedMemory sm_w("test_key"), sm_r("test_key");
+    sm_w.setLockMode(QSharedMemory::SeqLock);
+    sm_r.setLockMode(QSharedMemory::SeqLock);
+    REQUIRE(sm_w.create(2 * sizeof(int)));
+    REQUIRE(sm_r.attach(QSharedMemory::ReadOnly));
+
+    REQUIRE_FALSE(sm_r.beginWrite());
+    REQUIRE(sm_r.error() == QSharedMemory::PermissionDenied);
+    REQUIRE_FALSE(sm_w.endWrite());
+
+    const int loops = 20000;
+    std::atomic<int> failures{0};
+    std::thread writer([&sm_w, &failures]() {
+        for (int i = 1; i <= loops; ++i) {
+            if (!sm_w.beginWrite())
+                ++failures;
+            int *values = static_cast<int *>(sm_w.data());
+            values[0] = i;
+            values[1] = -i;
+            if (!sm_w.endWrite())
+                ++failures;
+        }
+    });
+
+    int last = 0;
+    while (last < loops) {
+        int values[2];
+        if (sm_r.readInto(values, sizeof(values)) != qint64(sizeof(values))
+                || values[0] != -values[1] || values[0] < last)
+            ++failures;
+        last = values[0];
+    }
+    writer.join();
+    REQUIRE(failures == 0);
+
+    qint64 seen = 0;
+    REQUIRE(sm_r.read([&seen](const void *, qint64 size) { seen = size; }));
+    REQUIRE(seen == sm_r.size());
+
+    // an update that never ends, as left by a writer that died
+    REQUIRE(sm_w.beginWrite());
+    int values[2];
+    REQUIRE(sm_r.readInto(values, sizeof(values), std::chrono::milliseconds(20)) == -1);
+    REQUIRE(sm_r.error() == QSharedMemory::LockTimeout);
+    REQUIRE(sm_w.endWrite());
+    REQUIRE(sm_r.readInto(values, sizeof(values), std::chrono::nanoseconds(0)) == qint64(sizeof(values)));
+}
+
+TEST_CASE("Adaptive spin lock tests", "[lock]") {
+    QSharedMemory sm_a("test_key"), sm_b("test_key");
+    sm_a.setLockMode(QSharedMemory::FutexLock);
+    sm_b.setLockMode(QSharedMemory::FutexLock);
+    REQUIRE(sm_a.create(64));
+    REQUIRE(sm_b.attach());
+    REQUIRE(sm_b.spinTime() == std::chrono::nanoseconds(0));
+
+    auto contend = [&sm_a, &sm_b](std::chrono::milliseconds hold) {
+        REQUIRE(sm_a.lock());
+        std::thread holder([&sm_a, hold]() {
+            std::this_thread::sleep_for(hold);
+            sm_a.unlock();
+        });
+        REQUIRE(sm_b.lock());
+        REQUIRE(sm_b.unlock());
+        holder.join();
+    };
+
+    SECTION("Spin succeeds") {
+        sm_b.setSpinTime(std::chrono::seconds(1));
+        contend(std::chrono::milliseconds(5));
+        REQUIRE(sm_b.spinAcquires() == 1);
+        REQUIRE(sm_b.blockedAcquires() == 0);
+    }
+
+    SECTION("Spin budget runs out") {
+        sm_b.setSpinTime(std::chrono::microseconds(100));
+        contend(std::chrono::milliseconds(50));
+        REQUIRE(sm_b.spinAcquires() == 0);
+        REQUIRE(sm_b.blockedAcquires() == 1);
+    }
+
+    SECTION("No spinning") {
+        contend(std::chrono::milliseconds(5));
+        REQUIRE(sm_b.spinAcquires() == 0);
+        REQUIRE(sm_b.blockedAcquires() == 1);
+    }
+
+    // uncontended locks count as neither
+    REQUIRE(sm_a.lock());
+    REQUIRE(sm_a.unlock());
+    REQUIRE(sm_a.spinAcquires() + sm_a.blockedAcquires() == 0);
+}
+
+TEST_CASE("Semaphore batch acquire tests", "[semaphore]") {
+    QSystemSemaphore producer("test_batch_key", 0, QSystemSemaphore::Create);
+    QSystemSemaphore consumer("test_batch_key");
+
+    REQUIRE(producer.release(3));
+    REQUIRE_FALSE(consumer.tryAcquire(4));
+    REQUIRE(consumer.error() == QSystemSemaphore::Timeout);
+    REQUIRE_FALSE(consumer.tryAcquire(4, std::chrono::milliseconds(10)));
+
+    // a failed batch takes nothing
+    REQUIRE(consumer.tryAcquire(3));
+    REQUIRE_FALSE(consumer.tryAcquire());
+
+    std::atomic<bool> acquired{false};
+    std::thread batch([&consumer, &acquired]() {
+        acquired = consumer.acquire(5);
+    });
+    REQUIRE(producer.release(2));
+    std::this_thread::sleep_for(std::chrono::milliseconds(20));
+    REQUIRE_FALSE(acquired);
+    REQUIRE(producer.release(3));
+    batch.join();
+    REQUIRE(acquired);
+    REQUIRE_FALSE(producer.tryAcquire());
+
+    REQUIRE(consumer.acquire(0));
+    REQUIRE_FALSE(consumer.acquire(-1));
+    REQUIRE(consumer.error() == QSystemSemaphore::UnknownError);
+    REQUIRE_FALSE(consumer.tryAcquire(-1, std::chrono::milliseconds(10)));
+    REQUIRE(consumer.error() == QSystemSemaphore::UnknownError);
+    REQUIRE(consumer.tryAcquire(0));
+}
+
+#ifndef __WIN32
+TEST_CASE("Semaphore acquirer killed while blocked", "[semaphore]") {
+    auto n = GENERATE(1, 2);
+    QSystemSemaphore holder("test_killed_key", 0, QSystemSemaphore::Create);
+
+    const pid_t pid = fork();
+    if (pid == 0) {
+        QSystemSemaphore waiter("test_killed_key");
+        waiter.acquire(n);
+        _exit(0);
+    }
+    REQUIRE(pid > 0);
+    std::this_thread::sleep_for(std::chrono::milliseconds(50));
+    REQUIRE(kill(pid, SIGKILL) == 0);
+    REQUIRE(waitpid(pid, nullptr, 0) == pid);
+
+    REQUIRE(holder.release(2));
+    QSystemSemaphore other("test_killed_key");
+    REQUIRE(other.tryAcquire(std::chrono::milliseconds(500)));
+    REQUIRE(other.tryAcquire(1, std::chrono::milliseconds(500)));
+    REQUIRE(holder.release(2));
+    REQUIRE(other.tryAcquire(2, std::chrono::milliseconds(500)));
+}
+#endif
+
+TEST_CASE("Thread ownership tests", "[lock]") {
+    auto mode = GENERATE(QSharedMemory::SystemSemaphoreLock, QSharedMemory::FutexLock,
+                         QSharedMemory::ReadWriteLock);
+    QSharedMemory sm("test_key");
+    sm.setLockMode(mode);
+    sm.setLockOwnership(QSharedMemory::ThreadOwnership);
+    REQUIRE(sm.create(sizeof(int)));
+
+    SECTION("Lock owned by thread") {
+        REQUIRE(sm.lock());
+        std::thread other([&sm]() {
+            REQUIRE_FALSE(sm.unlock());
+            REQUIRE_FALSE(sm.lock(std::chrono::milliseconds(10)));
+            REQUIRE(sm.error() == QSharedMemory::LockTimeout);
+        });
+        other.join();
+        REQUIRE(sm.unlock());
+        REQUIRE_FALSE(sm.unlock());
+    }
+
+    SECTION("Threads exclude each other") {
+        const int loops = 20000;
+        auto work = [&sm]() {
+            for (int i = 0; i < loops; ++i) {
+                sm.lock();
+                int *value = static_cast<int *>(sm.data());
+                *value = *value + 1;
+                sm.unlock();
+            }
+        };
+        std::thread t1(work), t2(work), t3(work);
+        t1.join();
+        t2.join();
+        t3.join();
+        REQUIRE(*static_cast<const int *>(sm.constData()) == 3 * loops);
+    }
+
+    SECTION("Recursive locking") {
+        sm.setLockOwnership(QSharedMemory::RecursiveThreadOwnership);
+        REQUIRE(sm.lock());
+        REQUIRE(sm.lock());
+        REQUIRE(sm.unlock());
+        std::thread other([&sm]() {
+            REQUIRE_FALSE(sm.tryLock());
+        });
+        other.join();
+        REQUIRE(sm.unlock());
+        REQUIRE(sm.tryLock());
+        REQUIRE(sm.unlock());
+    }
+}
+
+TEST_CASE("Thread ownership mapping tests", "[lock]") {
+    QSharedMemory sm("test_key");
+    sm.setLockMode(QSharedMemory::FutexLock);
+    sm.setLockOwnership(QSharedMemory::ThreadOwnership);
+    REQUIRE(sm.create(sizeof(int)));
+
+#if defined(QT_POSIX_IPC)
+    SECTION("No remap under another thread's lock") {
+        QSharedMemory other("test_key");
+        other.setLockMode(QSharedMemory::FutexLock);
+        REQUIRE(other.attach());
+        const qint64 oldSize = sm.size();
+
+        std::atomic<int> step{0};
+        const void *held = nullptr;
+        std::thread holder([&sm, &step, &held]() {
+            REQUIRE(sm.lockRange(0, sizeof(int)));
+            held = sm.data();
+            step = 1;
+            while (step != 2)
+                std::this_thread::yield();
+            REQUIRE(sm.data() == held);
+            REQUIRE(sm.unlockRange(0, sizeof(int)));
+        });
+        while (step != 1)
+            std::this_thread::yield();
+        REQUIRE(other.resize(1 << 20));
+        REQUIRE(sm.size() == oldSize);
+        REQUIRE(sm.data() == held);
+        REQUIRE_FALSE(sm.resize(2 << 20));
+        REQUIRE(sm.error() == QSharedMemory::LockError);
+        step = 2;
+        holder.join();
+        REQUIRE(sm.size() >= 1 << 20);
+    }
+#endif
+
+    SECTION("Lock state of a destroyed instance") {
+        auto *stale = new QSharedMemory("test_key");
+        stale->setLockMode(QSharedMemory::FutexLock);
+        stale->setLockOwnership(QSharedMemory::ThreadOwnership);
+        REQUIRE(stale->attach());
+
+        std::atomic<int> step{0};
+        QSharedMemory *fresh = nullptr;
+        std::thread holder([&stale, &fresh, &step]() {
+            REQUIRE(stale->lock());
+            step = 1;
+            while (step != 2)
+                std::this_thread::yield();
+            // likely allocated where the destroyed instance was
+            REQUIRE(fresh->tryLock());
+            QSharedMemory third("test_lock_state_key");
+            third.setLockMode(QSharedMemory::FutexLock);
+            REQUIRE(third.attach());
+            REQUIRE_FALSE(third.tryLock());
+            REQUIRE(fresh->unlock());
+        });
+        while (step != 1)
+            std::this_thread::yield();
+        delete stale;
+        fresh = new QSharedMemory("test_lock_state_key");
+        fresh->setLockMode(QSharedMemory::FutexLock);
+        fresh->setLockOwnership(QSharedMemory::ThreadOwnership);
+        REQUIRE(fresh->create(sizeof(int)));
+        step = 2;
+        holder.join();
+        delete fresh;
+    }
+}
+
+TEST_CASE("Range lock tests", "[lock]") {
+    QSharedMemory sm_a("test_key"), sm_b("test_key");
+    sm_a.setLockMode(QSharedMemory::FutexLock);
+    sm_b.setLockMode(QSharedMemory::FutexLock);
+    sm_a.setLockStripes(8, 64);
+    REQUIRE(sm_a.create(64 * 64));
+    REQUIRE(sm_b.attach());
+    REQUIRE(sm_b.lockStripes() == 8);
+
+    REQUIRE_FALSE(sm_a.lockRange(0, 0));
+    REQUIRE_FALSE(sm_a.lockRange(64 * 63, 65));
+    REQUIRE(sm_a.error() == QSharedMemory::LockError);
+
+    SECTION("Overlapping ranges exclude each other") {
+        QSharedMemoryRangeLocker locker(&sm_a, 100, 10);
+        REQUIRE(locker.isLocked());
+        REQUIRE_FALSE(sm_b.lockRange(64, 64, std::chrono::milliseconds(10)));
+        REQUIRE(sm_b.error() == QSharedMemory::LockTimeout);
+        // the whole segment spans every stripe, and none is held after the timeout
+        REQUIRE_FALSE(sm_b.lockRange(0, sm_b.size(), std::chrono::milliseconds(10)));
+        locker.unlock();
+        REQUIRE(sm_b.lockRange(0, sm_b.size(), std::chrono::milliseconds(10)));
+        REQUIRE(sm_b.unlockRange(0, sm_b.size()));
+    }
+
+    SECTION("Disjoint ranges don't") {
+        // find two chunks that hash to different stripes
+        REQUIRE(sm_a.lockRange(0, 64));
+        qint64 other = 64;
+        while (!sm_b.lockRange(other, 64, std::chrono::nanoseconds(0)))
+            other += 64;
+        REQUIRE(other < sm_b.size());
+        REQUIRE(sm_b.unlockRange(other, 64));
+        REQUIRE(sm_a.unlockRange(0, 64));
+    }
+
+    SECTION("An owner locks ranges sharing a stripe") {
+        // find a chunk that hashes to the stripe of the first one
+        REQUIRE(sm_a.lockRange(0, 64));
+        qint64 other = 64;
+        while (sm_b.lockRange(other, 64, std::chrono::nanoseconds(0))) {
+            REQUIRE(sm_b.unlockRange(other, 64));
+            other += 64;
+        }
+        REQUIRE(other < sm_a.size());
+        REQUIRE(sm_a.lockRange(other, 64, std::chrono::milliseconds(10)));
+        REQUIRE(sm_a.unlockRange(0, 64));
+        // the stripe stays locked for the other range
+        REQUIRE_FALSE(sm_b.lockRange(0, 64, std::chrono::milliseconds(10)));
+        REQUIRE(sm_a.unlockRange(other, 64));
+        REQUIRE_FALSE(sm_a.unlockRange(other, 64));
+        REQUIRE(sm_b.lockRange(0, 64, std::chrono::milliseconds(10)));
+        REQUIRE(sm_b.unlockRange(0, 64));
+    }
+
+    SECTION("Only the owner unlocks") {
+        REQUIRE_FALSE(sm_a.unlockRange(0, 64));
+        REQUIRE(sm_a.error() == QSharedMemory::LockError);
+
+        REQUIRE(sm_a.lockRange(0, 64));
+        REQUIRE_FALSE(sm_b.unlockRange(0, 64));
+        REQUIRE(sm_b.error() == QSharedMemory::LockError);
+        REQUIRE(sm_a.unlockRange(0, 64));
+        REQUIRE_FALSE(sm_a.unlockRange(0, 64));
+
+        sm_b.setLockOwnership(QSharedMemory::ThreadOwnership);
+        bool locked = false;
+        std::thread([&sm_b, &locked]() { locked = sm_b.lockRange(0, 64); }).join();
+        REQUIRE(locked);
+        REQUIRE_FALSE(sm_b.unlockRange(0, 64));
+        REQUIRE(sm_b.error() == QSharedMemory::LockError);
+        REQUIRE_FALSE(sm_a.lockRange(0, 64, std::chrono::milliseconds(10)));
+    }
+
+    SECTION("Concurrent writers") {
+        const int loops = 5000;
+        auto work = [loops](QSharedMemory *sm, int record) {
+            for (int i = 0; i < loops; ++i) {
+                QSharedMemoryRangeLocker locker(sm, record * 64, sizeof(int));
+                int *value = reinterpret_cast<int *>(static_cast<char *>(sm->data()) + record * 64);
+                *value = *value + 1;
+            }
+        };
+        QSharedMemory sm_c("test_key");
+        sm_c.setLockMode(QSharedMemory::FutexLock);
+        REQUIRE(sm_c.attach());
+        std::thread t1(work, &sm_a, 3), t2(work, &sm_b, 3), t3(work, &sm_c, 5);
+        t1.join();
+        t2.join();
+        t3.join();
+        const char *data = static_cast<const char *>(sm_a.constData());
+        REQUIRE(*reinterpret_cast<const int *>(data + 3 * 64) == 2 * loops);
+        REQUIRE(*reinterpret_cast<const int *>(data + 5 * 64) == loops);
+    }
+}
+
+TEST_CASE("Lock statistics tests", "[stats]") {
+    QSharedMemory sm_a("test_key"), sm_b("test_key");
+    sm_a.setLockMode(QSharedMemory::FutexLock);
+    sm_b.setLockMode(QSharedMemory::FutexLock);
+    REQUIRE_FALSE(sm_a.isLockStatisticsEnabled());
+    sm_a.setLockStatisticsEnabled(true);
+    REQUIRE(sm_a.create(64));
+    REQUIRE(sm_b.attach());
+    REQUIRE(sm_b.isLockStatisticsEnabled());
+
+    REQUIRE(sm_a.lock());
+    std::thread holder([&sm_a]() {
+        std::this_thread::sleep_for(std::chrono::milliseconds(20));
+        sm_a.unlock();
+    });
+    REQUIRE_FALSE(sm_b.tryLock());
+    REQUIRE(sm_b.lock());
+    holder.join();
+    REQUIRE(sm_b.unlock());
+
+    QSharedMemory::LockStatistics stats = sm_b.lockStatistics();
+    REQUIRE(stats.acquires == 2);
+    REQUIRE(stats.contendedAcquires == 1);
+    REQUIRE(stats.timeouts == 1);
+    REQUIRE(stats.totalWaitTime >= std::chrono::milliseconds(5));
+    REQUIRE(stats.totalHoldTime >= std::chrono::milliseconds(10));
+    REQUIRE(stats.lastHolderPid == qint64(getpid()));
+    quint64 waits = 0, holds = 0;
+    for (size_t i = 0; i < stats.waitHistogram.size(); ++i) {
+        waits += stats.waitHistogram[i];
+        holds += stats.holdHistogram[i];
+    }
+    REQUIRE(waits == 2);
+    REQUIRE(holds == 2);
+    REQUIRE(stats.waitHistogram[0] == 1);
+
+    sm_b.resetLockStatistics();
+    sm_b.setLockStatisticsEnabled(false);
+    REQUIRE_FALSE(sm_a.isLockStatisticsEnabled());
+    REQUIRE(sm_a.lock());
+    REQUIRE(sm_a.unlock());
+    REQUIRE(sm_a.lockStatistics().acquires == 0);
+}
+
+TEST_CASE("Change notification tests", "[notify]") {
+    QSharedMemory producer("test_key"), consumer("test_key");
+    producer.setLockMode(QSharedMemory::FutexLock);
+    consumer.setLockMode(QSharedMemory::FutexLock);
+    REQUIRE(producer.create(sizeof(int)));
+    REQUIRE(consumer.attach(QSharedMemory::ReadOnly));
+
+    const quint32 seen = consumer.changeGeneration();
+    REQUIRE_FALSE(consumer.waitForChange(seen, std::chrono::milliseconds(10)));
+    REQUIRE(consumer.error() == QSharedMemory::LockTimeout);
+
+    // a notification before the wait isn't lost
+    REQUIRE(producer.notify() == seen + 1);
+    REQUIRE(consumer.waitForChange(seen, std::chrono::nanoseconds(0)));
+
+    const quint32 current = consumer.changeGeneration();
+    std::atomic<bool> woken{false};
+    std::thread waiter([&consumer, &woken, current]() {
+        woken = consumer.waitForChange(current, std::chrono::seconds(5));
+    });
+    std::this_thread::sleep_for(std::chrono::milliseconds(20));
+    REQUIRE_FALSE(woken);
+    producer.lock();
+    *static_cast<int *>(producer.data()) = 42;
+    producer.unlock();
+    producer.notify();
+    waiter.join();
+    REQUIRE(woken);
+    REQUIRE(*static_cast<const int *>(consumer.constData()) == 42);
+}
+
+#if defined(__linux__)
+TEST_CASE("Notification descriptor tests", "[notify]") {
+    QSharedMemory producer("test_key"), consumer("test_key");
+    producer.setLockMode(QSharedMemory::FutexLock);
+    consumer.setLockMode(QSharedMemory::FutexLock);
+    REQUIRE(producer.create(64));
+    REQUIRE(consumer.attach());
+
+    const int fd = consumer.notificationDescriptor();
+    REQUIRE(fd != -1);
+    REQUIRE(consumer.notificationDescriptor() == fd);
+    REQUIRE(consumer.drainNotifications() == 0);
+
+    struct pollfd pfd = { fd, POLLIN, 0 };
+    REQUIRE(poll(&pfd, 1, 10) == 0);
+
+    for (int i = 0; i < 3; ++i)
+        producer.notify();
+    REQUIRE(poll(&pfd, 1, 5000) == 1);
+    REQUIRE((pfd.revents & POLLIN));
+
+    // wait until the burst is counted, then one read drains it
+    quint64 drained = 0;
+    for (int i = 0; i < 100 && drained < 3; ++i) {
+        drained += consumer.drainNotifications();
+        std::this_thread::sleep_for(std::chrono::milliseconds(1));
+    }
+    REQUIRE(drained == 3);
+    REQUIRE(poll(&pfd, 1, 0) == 0);
+
+#if defined(QT_POSIX_IPC)
+    // the watcher follows a resize that moves the header
+    REQUIRE(producer.resize(1 << 20));
+    REQUIRE(consumer.size() >= (1 << 20));
+    producer.notify();
+    REQUIRE(poll(&pfd, 1, 5000) == 1);
+    REQUIRE(consumer.drainNotifications() == 1);
+#endif
+
+    REQUIRE(consumer.detach());
+    REQUIRE(consumer.drainNotifications() == 0);
+}
+#endif
+
+#ifndef __WIN32
+TEST_CASE("System barrier tests", "[barrier]") {
+    SECTION("Invalid") {
+        QSystemBarrier missing("test_barrier");
+        REQUIRE_FALSE(missing.isValid());
+        REQUIRE(missing.error() == QSystemBarrier::NotFound);
+        REQUIRE_FALSE(missing.arriveAndWait());
+
+        QSystemBarrier empty("test_barrier", 0, QSystemBarrier::Create);
+        REQUIRE_FALSE(empty.isValid());
+        REQUIRE(empty.error() == QSystemBarrier::InvalidCount);
+    }
+
+    QSystemBarrier barrier("test_barrier", 3, QSystemBarrier::Create);
+    REQUIRE(barrier.isValid());
+    REQUIRE(barrier.count() == 3);
+    REQUIRE(barrier.generation() == 0);
+
+    // the count of an existing barrier is kept when opening it
+    QSystemBarrier opened("test_barrier", 5);
+    REQUIRE(opened.isValid());
+    REQUIRE(opened.count() == 3);
+
+    SECTION("Timeout") {
+        const quint32 token = barrier.arrive();
+        REQUIRE(token == 0);
+        REQUIRE_FALSE(barrier.wait(token, std::chrono::milliseconds(10)));
+        REQUIRE(barrier.error() == QSystemBarrier::Timeout);
+
+        opened.arrive();
+        // the last arrival completes the phase and doesn't block
+        REQUIRE(opened.arriveAndWait(std::chrono::nanoseconds(0)));
+        REQUIRE(barrier.wait(token, std::chrono::nanoseconds(0)));
+        REQUIRE(barrier.generation() == 1);
+        REQUIRE(opened.arrive() == 1);
+    }
+
+    SECTION("Processes") {
+        constexpr int Rounds = 200;
+        QSharedMemory sm("test_key");
+        REQUIRE(sm.create(int(Rounds * sizeof(std::atomic<int>))));
+        std::atomic<int> *arrivals = new (sm.data()) std::atomic<int>[Rounds]();
+
+        // nobody leaves a round before everybody counted themselves in it
+        auto run = [&barrier, arrivals]() {
+            for (int round = 0; round < Rounds; ++round) {
+                arrivals[round].fetch_add(1);
+                if (!barrier.arriveAndWait(std::chrono::seconds(5)) || arrivals[round].load() != 3)
+                    return false;
+            }
+            return true;
+        };
+        pid_t pids[2];
+        for (pid_t &pid : pids) {
+            pid = fork();
+            if (pid == 0)
+                _exit(run() ? 0 : 1);
+            REQUIRE(pid > 0);
+        }
+        REQUIRE(run());
+        for (pid_t pid : pids) {
+            int status = 0;
+            REQUIRE(waitpid(pid, &status, 0) == pid);
+            REQUIRE(WIFEXITED(status));
+            REQUIRE(WEXITSTATUS(status) == 0);
+        }
+        REQUIRE(barrier.generation() == Rounds);
+    }
+}
+
+TEST_CASE("System barrier open and close race", "[barrier]") {
+    const int threads = 4;
+    const int rounds = 200;
+    std::atomic<int> failures{0};
+    std::vector<std::thread> openers;
+    for (int i = 0; i < threads; ++i) {
+        openers.emplace_back([&failures]() {
+            for (int round = 0; round < rounds; ++round) {
+                QSystemBarrier barrier("test_barrier_race", 2);
+                if (!barrier.isValid() || barrier.count() != 2)
+                    ++failures;
+            }
+        });
+    }
+    for (auto &opener : openers)
+        opener.join();
+    REQUIRE(failures == 0);
+
+    // the last one to close removed the barrier
+    QSystemBarrier missing("test_barrier_race");
+    REQUIRE(missing.error() == QSystemBarrier::NotFound);
+}
+#endif
+
+TEST_CASE("Ring buffer tests", "[ringbuffer]") {
+    QSharedMemory sm_p("test_key"), sm_c("test_key");
+    REQUIRE(sm_p.create(4096));
+    REQUIRE(sm_c.attach());
+
+    QSharedRingBuffer producer(&sm_p), consumer(&sm_c);
+    REQUIRE_FALSE(consumer.attach());
+    REQUIRE(consumer.error() == QSharedRingBuffer::InvalidFormat);
+    REQUIRE(producer.initialize());
+    REQUIRE(consumer.attach());
+    REQUIRE(consumer.capacity() == 2048);
+    REQUIRE(consumer.isEmpty());
+
+    char buffer[2048];
+    REQUIRE(consumer.read([](const void *, qint64) {}) == 0);
+    REQUIRE(consumer.error() == QSharedRingBuffer::Timeout);
+    REQUIRE(producer.reserve(producer.maxMessageSize() + 1) == nullptr);
+    REQUIRE(producer.error() == QSharedRingBuffer::InvalidSize);
+
+    SECTION("Reserve and commit") {
+        char *space = static_cast<char *>(producer.reserve(64));
+        REQUIRE(space != nullptr);
+        strcpy(space, "hello");
+        REQUIRE(consumer.isEmpty());
+        REQUIRE_FALSE(producer.commit(65));
+        REQUIRE(producer.commit(5));
+
+        REQUIRE(consumer.readInto(buffer, 4) == -1);
+        REQUIRE(consumer.error() == QSharedRingBuffer::InvalidSize);
+        REQUIRE(consumer.readInto(buffer, sizeof(buffer)) == 5);
+        REQUIRE(memcmp(buffer, "hello", 5) == 0);
+        REQUIRE(consumer.isEmpty());
+    }
+
+    SECTION("Full and batch read") {
+        int written = 0;
+        while (producer.write(&written, sizeof(written)))
+            ++written;
+        REQUIRE(producer.error() == QSharedRingBuffer::Timeout);
+        REQUIRE(written == 2048 / 16);
+
+        int expected = 0;
+        auto check = [&expected](const void *data, qint64 size) {
+            if (size == sizeof(int) && *static_cast<const int *>(data) == expected)
+                ++expected;
+        };
+        REQUIRE(consumer.read(check, 10) == 10);
+        REQUIRE(producer.write(&written, sizeof(written)));
+        // a batch ends at the tail the consumer saw last
+        REQUIRE(consumer.read(check) == written - 10);
+        REQUIRE(consumer.read(check) == 1);
+        REQUIRE(expected == written + 1);
+    }
+
+    SECTION("Streaming between threads") {
+        // a small ring makes both sides block and messages wrap often
+        constexpr int Messages = 200000;
+        std::atomic<int> failures{0};
+        std::thread writer([&producer, &failures]() {
+            for (int i = 0; i < Messages; ++i) {
+                const qint64 size = qint64(sizeof(int)) + i % 300;
+                char *space = static_cast<char *>(producer.reserve(size, std::chrono::seconds(5)));
+                if (!space) {
+                    ++failures;
+                    return;
+                }
+                memcpy(space, &i, sizeof(int));
+                memset(space + sizeof(int), char(i), size_t(size) - sizeof(int));
+                producer.commit(size);
+            }
+        });
+        int received = 0;
+        while (received < Messages && failures == 0) {
+            const int read = consumer.read([&received, &failures](const void *data, qint64 size) {
+                const char *message = static_cast<const char *>(data);
+                int index;
+                memcpy(&index, message, sizeof(int));
+                if (index != received || size != qint64(sizeof(int)) + received % 300
+                        || (size > qint64(sizeof(int)) && message[size - 1] != char(received)))
+                    ++failures;
+                ++received;
+            }, 64, std::chrono::seconds(5));
+            if (read == 0)
+                ++failures;
+        }
+        writer.join();
+        REQUIRE(failures == 0);
+        REQUIRE(received == Messages);
+        REQUIRE(consumer.isEmpty());
+    }
+}